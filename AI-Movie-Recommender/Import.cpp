@@ -0,0 +1,235 @@
+﻿#include "Import.h"
+
+// Function to find every diary.csv under a directory tree, one per user export
+void findDiaryFiles(const string& directory, vector<string>& files) {
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA((directory + "/*").c_str(), &entry);
+    if (find == INVALID_HANDLE_VALUE) return;
+    do {
+        string name = entry.cFileName;
+        if (name == "." || name == "..") continue;
+        string path = directory + "/" + name;
+        if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) findDiaryFiles(path, files);
+        else if (name == "diary.csv") files.push_back(path);
+    } while (FindNextFileA(find, &entry));
+    FindClose(find);
+}
+
+// Function to name a user after the export directory holding their diary
+string exportUserName(const string& diaryPath) {
+    size_t slash = diaryPath.find_last_of("/\\");
+    if (slash == string::npos || slash == 0) return diaryPath;
+    size_t parent = diaryPath.find_last_of("/\\", slash - 1);
+    return diaryPath.substr(parent == string::npos ? 0 : parent + 1, slash - (parent == string::npos ? 0 : parent + 1));
+}
+
+// Function to read many users' exports into one corpus. The sorted paths are cut
+// into batches of consecutive files (sibling exports share directory metadata and
+// usually disk locality), each batch is read and parsed by one thread into its own
+// corpus, and films are interned through one shared InternTable. Batches are
+// then concatenated in path order and films renumbered by first appearance, so the
+// result is identical to adding the diaries one by one.
+RatingCorpus importUserExports(const vector<string>& diaryFiles, unsigned threads, size_t batchSize) {
+    batchSize = max<size_t>(1, batchSize);
+    size_t numBatches = (diaryFiles.size() + batchSize - 1) / batchSize;
+    vector<RatingCorpus> batches(numBatches);
+    InternTable dictionary;
+
+    parallelFor(numBatches, threads, [&](size_t b) {
+        RatingCorpus& batch = batches[b];
+        size_t end = min(diaryFiles.size(), (b + 1) * batchSize);
+        for (size_t i = b * batchSize; i < end; i++) {
+            appendUserDiary(batch, exportUserName(diaryFiles[i]), readLetterboxdCSV(diaryFiles[i], false),
+                [&](const string& key, uint16_t year) { return dictionary.intern(key, year); });
+        }
+        });
+    dictionary.freeze();
+
+    RatingCorpus corpus;
+    size_t totalRows = 0;
+    for (const RatingCorpus& batch : batches) totalRows += batch.userFilms.size();
+    corpus.userFilms.reserve(totalRows);
+    corpus.userHalfStars.reserve(totalRows);
+    corpus.userRowFlags.reserve(totalRows);
+    corpus.userRowTagBins.reserve(totalRows);
+    corpus.userRowDays.reserve(totalRows);
+
+    const uint32_t UNSEEN = UINT32_MAX;
+    vector<uint32_t> renumbered(dictionary.size(), UNSEEN);
+    for (RatingCorpus& batch : batches) {
+        uint64_t base = corpus.userFilms.size();
+        for (size_t u = 0; u < batch.numUsers(); u++) {
+            corpus.userNames.push_back(move(batch.userNames[u]));
+            corpus.userOffsets.push_back(base + batch.userOffsets[u + 1]);
+        }
+        for (uint32_t id : batch.userFilms) {
+            if (renumbered[id] == UNSEEN) {
+                renumbered[id] = (uint32_t)corpus.filmKeys.size();
+                corpus.filmKeys.push_back(dictionary.key(id));
+                corpus.filmYears.push_back((uint16_t)dictionary.value(id));
+            }
+            corpus.userFilms.push_back(renumbered[id]);
+        }
+        corpus.userHalfStars.insert(corpus.userHalfStars.end(), batch.userHalfStars.begin(), batch.userHalfStars.end());
+        corpus.userRowFlags.insert(corpus.userRowFlags.end(), batch.userRowFlags.begin(), batch.userRowFlags.end());
+        corpus.userRowTagBins.insert(corpus.userRowTagBins.end(), batch.userRowTagBins.begin(), batch.userRowTagBins.end());
+        corpus.userRowDays.insert(corpus.userRowDays.end(), batch.userRowDays.begin(), batch.userRowDays.end());
+        batch = RatingCorpus();
+    }
+    corpus.filmIndex.reserve(corpus.numFilms());
+    for (size_t f = 0; f < corpus.numFilms(); f++) {
+        corpus.filmIndex.emplace(corpus.filmKeys[f], (uint32_t)f);
+    }
+    return corpus;
+}
+
+// Function to write a corpus's diary rows and user profiles as a snapshot in the
+// model file format (call ensureUserProfiles first)
+bool writeCorpusSnapshot(const string& filename, const RatingCorpus& corpus) {
+    vector<uint64_t> keyOffsets = { 0 }, nameOffsets = { 0 };
+    vector<char> keyBytes, nameBytes;
+    for (const string& key : corpus.filmKeys) {
+        keyBytes.insert(keyBytes.end(), key.begin(), key.end());
+        keyOffsets.push_back(keyBytes.size());
+    }
+    for (const string& name : corpus.userNames) {
+        nameBytes.insert(nameBytes.end(), name.begin(), name.end());
+        nameOffsets.push_back(nameBytes.size());
+    }
+    vector<uint32_t> years(corpus.filmYears.begin(), corpus.filmYears.end());
+
+    return writeModelFile(filename, {
+        modelSection(SECTION_FILM_KEY_OFFSETS, ModelElementType::UInt64, keyOffsets),
+        modelSection(SECTION_FILM_KEY_BYTES, ModelElementType::Bytes, keyBytes),
+        modelSection(SECTION_CORPUS_FILM_YEARS, ModelElementType::UInt32, years),
+        modelSection(SECTION_CORPUS_USER_NAME_OFFSETS, ModelElementType::UInt64, nameOffsets),
+        modelSection(SECTION_CORPUS_USER_NAME_BYTES, ModelElementType::Bytes, nameBytes),
+        modelSection(SECTION_CORPUS_USER_OFFSETS, ModelElementType::UInt64, corpus.userOffsets),
+        modelSection(SECTION_CORPUS_USER_FILMS, ModelElementType::UInt32, corpus.userFilms),
+        modelSection(SECTION_CORPUS_HALF_STARS, ModelElementType::UInt8, corpus.userHalfStars),
+        modelSection(SECTION_CORPUS_ROW_FLAGS, ModelElementType::UInt8, corpus.userRowFlags),
+        modelSection(SECTION_CORPUS_ROW_TAG_BINS, ModelElementType::UInt64, corpus.userRowTagBins),
+        modelSection(SECTION_CORPUS_ROW_DAYS, ModelElementType::UInt32, corpus.userRowDays),
+        modelSection(SECTION_USER_PROFILES, ModelElementType::Float32, corpus.userProfiles, (uint32_t)PROFILE_WIDTH)
+        });
+}
+
+// Function to load a corpus snapshot written by writeCorpusSnapshot
+bool readCorpusSnapshot(const string& filename, RatingCorpus& corpus) {
+    MappedModel model;
+    if (!openModelFile(filename, ModelValidation::Full, model)) return false;
+
+    uint64_t numFilms = 0, numUsers = 0, numRows = 0, rows = 0;
+    const uint64_t* keyOffsets = model.sectionArray<uint64_t>(SECTION_FILM_KEY_OFFSETS, ModelElementType::UInt64, &numFilms);
+    const char* keyBytes = model.sectionArray<char>(SECTION_FILM_KEY_BYTES, ModelElementType::Bytes);
+    const uint32_t* years = model.sectionArray<uint32_t>(SECTION_CORPUS_FILM_YEARS, ModelElementType::UInt32, &rows);
+    const uint64_t* nameOffsets = model.sectionArray<uint64_t>(SECTION_CORPUS_USER_NAME_OFFSETS, ModelElementType::UInt64, &numUsers);
+    const char* nameBytes = model.sectionArray<char>(SECTION_CORPUS_USER_NAME_BYTES, ModelElementType::Bytes);
+    const uint64_t* userOffsets = model.sectionArray<uint64_t>(SECTION_CORPUS_USER_OFFSETS, ModelElementType::UInt64);
+    const uint32_t* films = model.sectionArray<uint32_t>(SECTION_CORPUS_USER_FILMS, ModelElementType::UInt32, &numRows);
+    const uint8_t* halfStars = model.sectionArray<uint8_t>(SECTION_CORPUS_HALF_STARS, ModelElementType::UInt8);
+    const uint8_t* flags = model.sectionArray<uint8_t>(SECTION_CORPUS_ROW_FLAGS, ModelElementType::UInt8);
+    const uint64_t* tagBins = model.sectionArray<uint64_t>(SECTION_CORPUS_ROW_TAG_BINS, ModelElementType::UInt64);
+    const int32_t* days = model.sectionArray<int32_t>(SECTION_CORPUS_ROW_DAYS, ModelElementType::UInt32);
+    if (keyOffsets == nullptr || keyBytes == nullptr || years == nullptr || nameOffsets == nullptr || nameBytes == nullptr
+        || userOffsets == nullptr || films == nullptr || halfStars == nullptr || flags == nullptr || tagBins == nullptr
+        || days == nullptr || numFilms == 0 || numUsers == 0 || rows + 1 != numFilms
+        || keyOffsets[numFilms - 1] > model.findSection(SECTION_FILM_KEY_BYTES)->byteSize
+        || nameOffsets[numUsers - 1] > model.findSection(SECTION_CORPUS_USER_NAME_BYTES)->byteSize
+        || model.findSection(SECTION_CORPUS_USER_OFFSETS)->rows != numUsers || userOffsets[numUsers - 1] != numRows) {
+        cerr << "Error: '" << filename << "' is not a valid corpus snapshot" << endl;
+        return false;
+    }
+    // Every per-row section must cover the same rows, and each offsets array must
+    // start at zero and never step backwards, before any of them is sliced
+    auto nonDecreasing = [](const uint64_t* offsets, uint64_t count) {
+        if (offsets[0] != 0) return false;
+        for (uint64_t i = 1; i < count; i++) {
+            if (offsets[i] < offsets[i - 1]) return false;
+        }
+        return true;
+    };
+    auto coversRows = [&](uint32_t id) {
+        const ModelSectionEntry* section = model.findSection(id);
+        return section->rows == numRows && section->cols == 1;
+    };
+    if (!coversRows(SECTION_CORPUS_HALF_STARS) || !coversRows(SECTION_CORPUS_ROW_FLAGS)
+        || !coversRows(SECTION_CORPUS_ROW_TAG_BINS) || !coversRows(SECTION_CORPUS_ROW_DAYS)
+        || !nonDecreasing(keyOffsets, numFilms) || !nonDecreasing(nameOffsets, numUsers)
+        || !nonDecreasing(userOffsets, numUsers)) {
+        cerr << "Error: Corpus snapshot '" << filename << "' has inconsistent section sizes or offsets" << endl;
+        return false;
+    }
+    numFilms--;
+    numUsers--;
+    for (uint64_t i = 0; i < numRows; i++) {
+        if (films[i] >= numFilms) {
+            cerr << "Error: Corpus snapshot '" << filename << "' has a row with an unknown film" << endl;
+            return false;
+        }
+    }
+
+    corpus = RatingCorpus();
+    for (uint64_t f = 0; f < numFilms; f++) {
+        corpus.filmKeys.emplace_back(keyBytes + keyOffsets[f], (size_t)(keyOffsets[f + 1] - keyOffsets[f]));
+        corpus.filmYears.push_back((uint16_t)years[f]);
+        corpus.filmIndex.emplace(corpus.filmKeys.back(), (uint32_t)f);
+    }
+    for (uint64_t u = 0; u < numUsers; u++) {
+        corpus.userNames.emplace_back(nameBytes + nameOffsets[u], (size_t)(nameOffsets[u + 1] - nameOffsets[u]));
+    }
+    corpus.userOffsets.assign(userOffsets, userOffsets + numUsers + 1);
+    corpus.userFilms.assign(films, films + numRows);
+    corpus.userHalfStars.assign(halfStars, halfStars + numRows);
+    corpus.userRowFlags.assign(flags, flags + numRows);
+    corpus.userRowTagBins.assign(tagBins, tagBins + numRows);
+    corpus.userRowDays.assign(days, days + numRows);
+
+    // Profiles of another width come from an older build; they are recomputed instead
+    uint32_t width = 0;
+    const float* profiles = model.sectionArray<float>(SECTION_USER_PROFILES, ModelElementType::Float32, &rows, &width);
+    if (profiles != nullptr && rows == numUsers && width == PROFILE_WIDTH) {
+        corpus.userProfiles.assign(profiles, profiles + numUsers * PROFILE_WIDTH);
+    }
+    return true;
+}
+
+// Function to import every user export under a directory tree into one corpus
+// snapshot, for --train --corpus=:
+//   --bulk-import <snapshot file> <directory> [--threads=N] [--batch=N]
+int runBulkImportCommand(const vector<string>& args) {
+    unsigned threads = 0;
+    size_t batchSize = 32;
+    vector<string> files;
+    for (const string& arg : args) {
+        if (arg.rfind("--threads=", 0) == 0) threads = (unsigned)stoul(arg.substr(10));
+        else if (arg.rfind("--batch=", 0) == 0) batchSize = stoul(arg.substr(8));
+        else files.push_back(arg);
+    }
+    if (files.size() != 2) {
+        cerr << "Usage: --bulk-import <snapshot file> <directory> [--threads=N] [--batch=N]" << endl;
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    vector<string> diaryFiles;
+    findDiaryFiles(files[1], diaryFiles);
+    sort(diaryFiles.begin(), diaryFiles.end());
+    if (diaryFiles.empty()) {
+        cerr << "Error: No diary.csv files under '" << files[1] << "'" << endl;
+        return 1;
+    }
+    double scanSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    RatingCorpus corpus = importUserExports(diaryFiles, threads, batchSize);
+    ensureUserProfiles(corpus, threads);
+    double importSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (!writeCorpusSnapshot(files[0], corpus)) return 1;
+
+    cout << "Found " << diaryFiles.size() << " exports in " << (scanSeconds * 1000.0) << " ms" << endl;
+    cout << "Imported " << corpus.numUsers() << " users, " << corpus.numFilms() << " films, " << corpus.userFilms.size()
+        << " diary rows in " << (importSeconds * 1000.0) << " ms (" << (corpus.numUsers() / importSeconds) << " users/s)" << endl;
+    cout << "Corpus snapshot written to " << files[0] << endl;
+    return 0;
+}
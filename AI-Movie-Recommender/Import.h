@@ -0,0 +1,195 @@
+﻿#pragma once
+
+#include "Recommender.h"
+
+// String -> id interning table for many threads at once, such as the film dictionary
+// of a bulk import. Keys hash to one of a power-of-two number of shards, each an
+// open-addressing (linear probing) table under its own lock with key bytes copied
+// into the shard's arena, so threads only wait on each other when they intern into
+// the same shard. Ids are dense and handed out in arrival order; each id keeps the
+// value given when its key was first interned.
+//
+// freeze() ends ingestion: it packs the keys into one arena in id order and builds a
+// single flat table that find() probes without taking any lock. intern() must not be
+// called on a frozen table.
+struct InternTable {
+    struct Slot {
+        uint64_t hash = 0;              // 0 marks an empty slot (hashes are made odd)
+        const char* key = nullptr;
+        uint32_t length = 0;
+        uint32_t id = 0;
+        uint32_t value = 0;
+    };
+
+    // Padded to a cache line, so one shard's lock traffic doesn't slow its neighbours
+    struct alignas(64) Shard {
+        mutex lock;
+        vector<Slot> slots;             // power-of-two size, at most 3/4 full
+        size_t used = 0;
+        vector<unique_ptr<char[]>> arena;
+        size_t arenaLeft = 0;
+        char* arenaNext = nullptr;
+
+        const char* storeKey(const char* key, size_t length) {
+            if (length > arenaLeft) {
+                size_t blockSize = max<size_t>(length, 64u << 10);
+                arena.emplace_back(new char[blockSize]);
+                arenaNext = arena.back().get();
+                arenaLeft = blockSize;
+            }
+            char* stored = arenaNext;
+            memcpy(stored, key, length);
+            arenaNext += length;
+            arenaLeft -= length;
+            return stored;
+        }
+
+        void grow() {
+            vector<Slot> old(max<size_t>(64, slots.size() * 2));
+            old.swap(slots);
+            size_t mask = slots.size() - 1;
+            for (const Slot& slot : old) {
+                if (slot.hash == 0) continue;
+                size_t i = slot.hash & mask;
+                while (slots[i].hash != 0) i = (i + 1) & mask;
+                slots[i] = slot;
+            }
+        }
+    };
+
+    unique_ptr<Shard[]> shards;
+    size_t shardMask = 0;
+    atomic<uint32_t> nextId{ 0 };
+
+    // Frozen form: keys packed in id order, and one table of (hash tag, id + 1) pairs
+    bool frozen = false;
+    vector<uint64_t> keyOffsets;
+    vector<char> keyBytes;
+    vector<uint64_t> frozenSlots;
+    vector<uint32_t> values;            // by id
+
+    // Shards default to four per hardware thread, so contention stays low as cores grow
+    explicit InternTable(size_t numShards = 0) {
+        if (numShards == 0) numShards = 4 * max(1u, thread::hardware_concurrency());
+        size_t count = 64;
+        while (count < numShards) count *= 2;
+        shards.reset(new Shard[count]);
+        shardMask = count - 1;
+    }
+
+    static uint64_t hashKey(const char* key, size_t length) {
+        return hashBytes(key, length) | 1;
+    }
+
+    // Function to get a key's id, adding it with 'value' if it is new
+    uint32_t intern(const char* key, size_t length, uint32_t value = 0) {
+        uint64_t hash = hashKey(key, length);
+        Shard& shard = shards[(hash >> 40) & shardMask];
+        lock_guard<mutex> guard(shard.lock);
+        if ((shard.used + 1) * 4 > shard.slots.size() * 3) shard.grow();
+
+        size_t mask = shard.slots.size() - 1;
+        size_t i = hash & mask;
+        for (; shard.slots[i].hash != 0; i = (i + 1) & mask) {
+            const Slot& slot = shard.slots[i];
+            if (slot.hash == hash && slot.length == length && memcmp(slot.key, key, length) == 0) return slot.id;
+        }
+        Slot& slot = shard.slots[i];
+        slot.hash = hash;
+        slot.key = shard.storeKey(key, length);
+        slot.length = (uint32_t)length;
+        slot.id = nextId++;
+        slot.value = value;
+        shard.used++;
+        return slot.id;
+    }
+
+    uint32_t intern(const string& key, uint32_t value = 0) {
+        return intern(key.data(), key.size(), value);
+    }
+
+    static const uint32_t NOT_FOUND = UINT32_MAX;
+
+    // Function to look a key up, returning NOT_FOUND if it was never interned
+    uint32_t find(const char* key, size_t length) const {
+        uint64_t hash = hashKey(key, length);
+        if (frozen) {
+            size_t mask = frozenSlots.size() - 1;
+            uint32_t tag = (uint32_t)(hash >> 32);
+            for (size_t i = hash & mask; frozenSlots[i] != 0; i = (i + 1) & mask) {
+                if ((uint32_t)(frozenSlots[i] >> 32) != tag) continue;
+                uint32_t id = (uint32_t)frozenSlots[i] - 1;
+                if (keyOffsets[id + 1] - keyOffsets[id] == length && memcmp(&keyBytes[keyOffsets[id]], key, length) == 0) {
+                    return id;
+                }
+            }
+            return NOT_FOUND;
+        }
+
+        Shard& shard = shards[(hash >> 40) & shardMask];
+        lock_guard<mutex> guard(shard.lock);
+        if (shard.slots.empty()) return NOT_FOUND;
+        size_t mask = shard.slots.size() - 1;
+        for (size_t i = hash & mask; shard.slots[i].hash != 0; i = (i + 1) & mask) {
+            const Slot& slot = shard.slots[i];
+            if (slot.hash == hash && slot.length == length && memcmp(slot.key, key, length) == 0) return slot.id;
+        }
+        return NOT_FOUND;
+    }
+
+    uint32_t find(const string& key) const {
+        return find(key.data(), key.size());
+    }
+
+    size_t size() const {
+        return nextId.load();
+    }
+
+    // Frozen tables only
+    string key(uint32_t id) const {
+        return string(&keyBytes[keyOffsets[id]], (size_t)(keyOffsets[id + 1] - keyOffsets[id]));
+    }
+
+    uint32_t value(uint32_t id) const {
+        return values[id];
+    }
+
+    // Function to end ingestion and switch to the lock-free read-only form
+    void freeze() {
+        if (frozen) return;
+        size_t count = size();
+        vector<const Slot*> byId(count);
+        for (size_t s = 0; s <= shardMask; s++) {
+            for (const Slot& slot : shards[s].slots) {
+                if (slot.hash != 0) byId[slot.id] = &slot;
+            }
+        }
+
+        keyOffsets.assign(count + 1, 0);
+        for (size_t id = 0; id < count; id++) keyOffsets[id + 1] = keyOffsets[id] + byId[id]->length;
+        keyBytes.resize((size_t)keyOffsets[count]);
+        size_t tableSize = 16;
+        while (tableSize < count * 2) tableSize *= 2;
+        frozenSlots.assign(tableSize, 0);
+        for (size_t id = 0; id < count; id++) {
+            const Slot& slot = *byId[id];
+            memcpy(&keyBytes[keyOffsets[id]], slot.key, slot.length);
+            size_t i = slot.hash & (tableSize - 1);
+            while (frozenSlots[i] != 0) i = (i + 1) & (tableSize - 1);
+            frozenSlots[i] = ((slot.hash >> 32) << 32) | (id + 1);
+        }
+
+        values.resize(count);
+        for (size_t id = 0; id < count; id++) values[id] = byId[id]->value;
+        shards.reset(new Shard[1]);
+        shardMask = 0;
+        frozen = true;
+    }
+};
+
+void findDiaryFiles(const string& directory, vector<string>& files);
+string exportUserName(const string& diaryPath);
+RatingCorpus importUserExports(const vector<string>& diaryFiles, unsigned threads, size_t batchSize);
+bool writeCorpusSnapshot(const string& filename, const RatingCorpus& corpus);
+bool readCorpusSnapshot(const string& filename, RatingCorpus& corpus);
+int runBulkImportCommand(const vector<string>& args);
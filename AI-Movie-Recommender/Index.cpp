@@ -0,0 +1,323 @@
+﻿#include "Index.h"
+
+IvfPqView ivfPqViewOf(const IvfPqIndex& index) {
+    return { index.dims, index.numLists, index.numSubspaces, index.subDims, index.coarseCentroids.data(),
+        index.codebooks.data(), index.listOffsets.data(), index.ids.data(), index.codes.data() };
+}
+
+// Function to build an IVF-PQ index over film vectors. numSubspaces must be even,
+// at most PQ_MAX_SUBSPACES and divide dims.
+IvfPqIndex buildIvfPq(const float* vectors, size_t numFilms, size_t dims, size_t numLists, size_t numSubspaces,
+    const ClusteringOptions& options) {
+    IvfPqIndex index;
+    index.dims = dims;
+    index.numSubspaces = numSubspaces;
+    index.subDims = dims / numSubspaces;
+
+    // Coarse quantizer
+    ClusteringOptions coarseOptions = options;
+    coarseOptions.clusters = numLists;
+    FilmClusters coarse = clusterFilms(vectors, numFilms, dims, coarseOptions);
+    index.numLists = coarse.numClusters;
+    index.coarseCentroids = coarse.centroids;
+
+    // One codebook per subspace, trained on that slice of the residuals
+    size_t subDims = index.subDims;
+    vector<uint8_t> filmCodes(numFilms * numSubspaces);
+    vector<float> slice(numFilms * subDims);
+    index.codebooks.assign(numSubspaces * PQ_CENTROIDS * subDims, 0.0f);
+
+    for (size_t m = 0; m < numSubspaces; m++) {
+        parallelFor(numFilms, options.threads, [&](size_t f) {
+            const float* centroid = &coarse.centroids[coarse.assignments[f] * dims];
+            for (size_t j = 0; j < subDims; j++) {
+                slice[f * subDims + j] = vectors[f * dims + m * subDims + j] - centroid[m * subDims + j];
+            }
+            });
+
+        ClusteringOptions subOptions = options;
+        subOptions.clusters = PQ_CENTROIDS;
+        subOptions.seed = options.seed + 1 + m;
+        FilmClusters codebook = clusterFilms(slice.data(), numFilms, subDims, subOptions);
+
+        copy(codebook.centroids.begin(), codebook.centroids.end(), index.codebooks.begin() + m * PQ_CENTROIDS * subDims);
+        for (size_t f = 0; f < numFilms; f++) {
+            filmCodes[f * numSubspaces + m] = (uint8_t)codebook.assignments[f];
+        }
+    }
+
+    // Lay each list out in blocks of 32, films in id order
+    vector<size_t> listSizes(index.numLists, 0);
+    for (uint32_t list : coarse.assignments) listSizes[list]++;
+    index.listOffsets.assign(index.numLists + 1, 0);
+    for (size_t l = 0; l < index.numLists; l++) {
+        index.listOffsets[l + 1] = index.listOffsets[l] + (listSizes[l] + PQ_BLOCK_SIZE - 1) / PQ_BLOCK_SIZE;
+    }
+
+    size_t numBlocks = (size_t)index.listOffsets[index.numLists];
+    size_t blockBytes = numSubspaces / 2 * PQ_BLOCK_SIZE;
+    index.ids.assign(numBlocks * PQ_BLOCK_SIZE, PQ_PADDING_ID);
+    index.codes.assign(numBlocks * blockBytes, 0);
+
+    vector<size_t> filled(index.numLists, 0);
+    for (size_t f = 0; f < numFilms; f++) {
+        uint32_t list = coarse.assignments[f];
+        size_t slot = filled[list]++;
+        size_t block = (size_t)index.listOffsets[list] + slot / PQ_BLOCK_SIZE;
+        size_t lane = slot % PQ_BLOCK_SIZE;
+
+        index.ids[block * PQ_BLOCK_SIZE + lane] = (uint32_t)f;
+        uint8_t* blockCodes = &index.codes[block * blockBytes];
+        for (size_t p = 0; p < numSubspaces / 2; p++) {
+            blockCodes[p * PQ_BLOCK_SIZE + lane] = (uint8_t)(filmCodes[f * numSubspaces + 2 * p] |
+                (filmCodes[f * numSubspaces + 2 * p + 1] << 4));
+        }
+    }
+
+    return index;
+}
+
+// Function to find the films with the highest estimated inner product with a query.
+// Scores are (query . coarse centroid) + the sum of per-subspace table lookups, with
+// the tables quantized to 8 bits so a whole block is scored with byte shuffles.
+// If exactVectors is given, the best 'rerank' estimates are rescored exactly.
+vector<ScoredFilm> searchIvfPq(const IvfPqView& index, const float* query, size_t k, size_t nprobe,
+    const float* exactVectors, size_t rerank, const uint64_t* excluded) {
+    const KernelTable& kernels = activeKernels();
+    auto dot = kernels.scoring.dotF32;
+    size_t M = index.numSubspaces;
+
+    vector<ScoredFilm> lists = selectTopK(index.numLists, nprobe, nullptr, [&](size_t l) {
+        return dot(query, index.coarseCentroids + l * index.dims, index.dims);
+        });
+
+    // Per-subspace tables, shifted to start at 0 and scaled by one shared step
+    vector<float> table(M * PQ_CENTROIDS);
+    float bias = 0.0f;
+    float step = 0.0f;
+    for (size_t m = 0; m < M; m++) {
+        float* row = &table[m * PQ_CENTROIDS];
+        for (size_t c = 0; c < PQ_CENTROIDS; c++) {
+            row[c] = dot(query + m * index.subDims, index.codebooks + (m * PQ_CENTROIDS + c) * index.subDims, index.subDims);
+        }
+        float low = *min_element(row, row + PQ_CENTROIDS);
+        float high = *max_element(row, row + PQ_CENTROIDS);
+        for (size_t c = 0; c < PQ_CENTROIDS; c++) row[c] -= low;
+        bias += low;
+        step = max(step, (high - low) / 255.0f);
+    }
+    if (step == 0.0f) step = 1.0f;
+
+    vector<uint8_t> quantized(M * PQ_CENTROIDS);
+    for (size_t i = 0; i < quantized.size(); i++) {
+        quantized[i] = (uint8_t)min(255L, lround(table[i] / step));
+    }
+
+    bool rescore = exactVectors != nullptr && rerank > k;
+    size_t keep = rescore ? rerank : k;
+    vector<ScoredFilm> heap;
+    heap.reserve(keep);
+    uint16_t sums[PQ_BLOCK_SIZE];
+    size_t blockBytes = index.blockBytes();
+
+    // Probed lists sit at random places in the code array, so each list's first blocks
+    // are prefetched while the previous list is scanned
+    for (size_t l = 0; l < lists.size(); l++) {
+        const ScoredFilm& list = lists[l];
+        if (l + 1 < lists.size()) {
+            uint64_t next = index.listOffsets[lists[l + 1].filmIndex];
+            uint64_t nextEnd = min(index.listOffsets[lists[l + 1].filmIndex + 1], next + 2);
+            prefetchBytes(index.codes + next * blockBytes, (size_t)(nextEnd - next) * blockBytes);
+            prefetchBytes(index.ids + next * PQ_BLOCK_SIZE, (size_t)(nextEnd - next) * PQ_BLOCK_SIZE * sizeof(uint32_t));
+        }
+        float base = list.score + bias;
+        for (uint64_t block = index.listOffsets[list.filmIndex]; block < index.listOffsets[list.filmIndex + 1]; block++) {
+            kernels.pqScanBlock(index.codes + block * blockBytes, quantized.data(), M / 2, sums);
+            const uint32_t* ids = index.ids + block * PQ_BLOCK_SIZE;
+            for (size_t lane = 0; lane < PQ_BLOCK_SIZE; lane++) {
+                if (ids[lane] == PQ_PADDING_ID || isFilmInBitmap(excluded, ids[lane])) continue;
+                pushTopK(heap, keep, (int)ids[lane], base + sums[lane] * step);
+            }
+        }
+    }
+
+    if (rescore) {
+        vector<ScoredFilm> candidates = finishTopK(heap);
+        heap.clear();
+        for (size_t c = 0; c < candidates.size(); c++) {
+            if (c + PREFETCH_DISTANCE < candidates.size()) {
+                prefetchBytes(exactVectors + (size_t)candidates[c + PREFETCH_DISTANCE].filmIndex * index.dims,
+                    index.dims * sizeof(float));
+            }
+            pushTopK(heap, k, candidates[c].filmIndex, dot(query, exactVectors + (size_t)candidates[c].filmIndex * index.dims, index.dims));
+        }
+    }
+    return finishTopK(heap);
+}
+
+// Function to resolve a model's IVF-PQ sections, if it has them
+bool loadIvfPqView(const MappedModel& model, IvfPqView& view) {
+    uint64_t rows = 0;
+    uint32_t cols = 0;
+    view = IvfPqView();
+
+    view.coarseCentroids = model.sectionArray<float>(SECTION_IVF_CENTROIDS, ModelElementType::Float32, &rows, &cols);
+    if (view.coarseCentroids == nullptr) return false;
+    view.numLists = (size_t)rows;
+    view.dims = cols;
+
+    view.codebooks = model.sectionArray<float>(SECTION_PQ_CODEBOOKS, ModelElementType::Float32, &rows, &cols);
+    view.listOffsets = model.sectionArray<uint64_t>(SECTION_IVF_LIST_OFFSETS, ModelElementType::UInt64);
+    view.ids = model.sectionArray<uint32_t>(SECTION_IVF_IDS, ModelElementType::UInt32);
+    view.codes = model.sectionArray<uint8_t>(SECTION_IVF_CODES, ModelElementType::UInt8);
+    if (view.codebooks == nullptr || view.listOffsets == nullptr || view.ids == nullptr || view.codes == nullptr ||
+        cols == 0 || rows % PQ_CENTROIDS != 0) {
+        cerr << "Error: Model IVF-PQ index is malformed" << endl;
+        return false;
+    }
+    view.numSubspaces = (size_t)(rows / PQ_CENTROIDS);
+    view.subDims = cols;
+
+    // Each list's blocks run from its offset to the next one's, so the offsets must
+    // cover every list, never step backwards and stay inside the code array
+    if (model.findSection(SECTION_IVF_LIST_OFFSETS)->rows != view.numLists + 1 || view.listOffsets[0] != 0) {
+        cerr << "Error: Model IVF-PQ index is malformed" << endl;
+        return false;
+    }
+    uint64_t numBlocks = view.listOffsets[view.numLists];
+    for (size_t l = 0; l < view.numLists; l++) {
+        if (view.listOffsets[l + 1] < view.listOffsets[l]) {
+            cerr << "Error: Model IVF-PQ index is malformed" << endl;
+            return false;
+        }
+    }
+    const ModelSectionEntry* ids = model.findSection(SECTION_IVF_IDS);
+    const ModelSectionEntry* codes = model.findSection(SECTION_IVF_CODES);
+    if (view.numSubspaces * view.subDims != view.dims || view.numSubspaces % 2 != 0 || view.numSubspaces > PQ_MAX_SUBSPACES ||
+        ids->rows != numBlocks * PQ_BLOCK_SIZE || codes->byteSize != numBlocks * view.blockBytes()) {
+        cerr << "Error: Model IVF-PQ index is malformed" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Function to build an IVF-PQ index for a model's films and store it with the model:
+//   --build-ivfpq <model file> <output model file> [--lists=N] [--subspaces=N] [--iterations=N] [--seed=N] [--threads=N]
+int runBuildIvfPqCommand(const vector<string>& args) {
+    ClusteringOptions options;
+    size_t numLists = 1024;
+    size_t numSubspaces = 0;
+    vector<string> files;
+    for (const string& arg : args) {
+        if (arg.rfind("--lists=", 0) == 0) numLists = stoul(arg.substr(8));
+        else if (arg.rfind("--subspaces=", 0) == 0) numSubspaces = stoul(arg.substr(12));
+        else if (arg.rfind("--iterations=", 0) == 0) options.iterations = stoi(arg.substr(13));
+        else if (arg.rfind("--seed=", 0) == 0) options.seed = stoull(arg.substr(7));
+        else if (arg.rfind("--threads=", 0) == 0) options.threads = (unsigned)stoul(arg.substr(10));
+        else files.push_back(arg);
+    }
+    if (files.size() != 2 || numLists == 0) {
+        cerr << "Usage: --build-ivfpq <model file> <output model file> [--lists=N] [--subspaces=N] [--iterations=N] [--seed=N] [--threads=N]" << endl;
+        return 1;
+    }
+
+    MappedModel model;
+    ModelView view;
+    if (!openModelFile(files[0], ModelValidation::Full, model) || !loadModelView(model, view)) {
+        return 1;
+    }
+    widenFactors(model, view);
+
+    // Two dimensions per 4-bit code by default
+    if (numSubspaces == 0) numSubspaces = view.dims / 2;
+    if (numSubspaces == 0 || numSubspaces % 2 != 0 || view.dims % numSubspaces != 0 || numSubspaces > PQ_MAX_SUBSPACES) {
+        cerr << "Error: --subspaces must be even, at most " << PQ_MAX_SUBSPACES << " and divide the model's "
+            << view.dims << " dimensions" << endl;
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    IvfPqIndex index = buildIvfPq(view.filmFactors, view.numFilms, view.dims, numLists, numSubspaces, options);
+    auto end = chrono::steady_clock::now();
+
+    size_t indexBytes = index.codes.size() + index.ids.size() * sizeof(uint32_t) +
+        (index.coarseCentroids.size() + index.codebooks.size()) * sizeof(float);
+    cout << "Built IVF-PQ index over " << view.numFilms << " films (" << index.numLists << " lists, "
+        << index.numSubspaces << " subspaces) in " << chrono::duration<double, milli>(end - start).count() << " ms" << endl;
+    cout << "Index size " << indexBytes / 1024 << " KB vs " << view.numFilms * view.dims * sizeof(float) / 1024
+        << " KB of float factors" << endl;
+
+    vector<ModelSectionData> sections = existingModelSections(model, { SECTION_IVF_CENTROIDS, SECTION_PQ_CODEBOOKS,
+        SECTION_IVF_LIST_OFFSETS, SECTION_IVF_IDS, SECTION_IVF_CODES });
+    sections.push_back(modelSection(SECTION_IVF_CENTROIDS, ModelElementType::Float32, index.coarseCentroids, (uint32_t)index.dims));
+    sections.push_back(modelSection(SECTION_PQ_CODEBOOKS, ModelElementType::Float32, index.codebooks, (uint32_t)index.subDims));
+    sections.push_back(modelSection(SECTION_IVF_LIST_OFFSETS, ModelElementType::UInt64, index.listOffsets));
+    sections.push_back(modelSection(SECTION_IVF_IDS, ModelElementType::UInt32, index.ids));
+    sections.push_back(modelSection(SECTION_IVF_CODES, ModelElementType::UInt8, index.codes));
+    if (!writeModelFile(files[1], sections)) return 1;
+
+    cout << "Model with IVF-PQ index written to " << files[1] << endl;
+    return 0;
+}
+
+// Function to measure IVF-PQ recall and latency against exact search, for a range of
+// probe counts, with and without exact re-ranking:
+//   --ivfpq-benchmark <model file> [--queries=N] [--k=N]
+int runIvfPqBenchmark(const vector<string>& args) {
+    size_t numQueries = 200;
+    size_t k = 10;
+    string filename;
+    for (const string& arg : args) {
+        if (arg.rfind("--queries=", 0) == 0) numQueries = stoul(arg.substr(10));
+        else if (arg.rfind("--k=", 0) == 0) k = stoul(arg.substr(4));
+        else filename = arg;
+    }
+
+    MappedModel model;
+    ModelView view;
+    IvfPqView index;
+    if (!openModelFile(filename, ModelValidation::Lazy, model) || !loadModelView(model, view)) {
+        return 1;
+    }
+    widenFactors(model, view);
+    if (!loadIvfPqView(model, index)) {
+        cerr << "Error: Model has no IVF-PQ index (build one with --build-ivfpq)" << endl;
+        return 1;
+    }
+
+    // Queries are user vectors when the model has them, otherwise film vectors
+    const float* queries = view.userFactors != nullptr ? view.userFactors : view.filmFactors;
+    size_t available = view.userFactors != nullptr ? view.numUsers : view.numFilms;
+    numQueries = min(numQueries, available);
+
+    vector<vector<ScoredFilm>> truth(numQueries);
+    for (size_t q = 0; q < numQueries; q++) {
+        truth[q] = topKFilmsF32(scoringKernels(), queries + q * view.dims, view.filmFactors, view.numFilms, view.dims, k);
+    }
+
+    cout.precision(3);
+    cout << fixed;
+    cout << "nprobe   recall@" << k << "   ms/query   recall (rerank)   ms/query (rerank)" << endl;
+    for (size_t nprobe = 1; nprobe <= index.numLists; nprobe *= 2) {
+        double recall[2] = { 0.0, 0.0 };
+        double ms[2] = { 0.0, 0.0 };
+        for (int rerank = 0; rerank < 2; rerank++) {
+            auto start = chrono::steady_clock::now();
+            for (size_t q = 0; q < numQueries; q++) {
+                vector<ScoredFilm> found = searchIvfPq(index, queries + q * view.dims, k, nprobe,
+                    rerank ? view.filmFactors : nullptr, rerank ? 4 * k : 0);
+                for (const ScoredFilm& film : found) {
+                    for (const ScoredFilm& expected : truth[q]) {
+                        if (expected.filmIndex == film.filmIndex) recall[rerank] += 1.0;
+                    }
+                }
+            }
+            auto end = chrono::steady_clock::now();
+            ms[rerank] = chrono::duration<double, milli>(end - start).count() / max<size_t>(1, numQueries);
+            recall[rerank] /= max<size_t>(1, numQueries * k);
+        }
+        cout << nprobe << string(9 - to_string(nprobe).size(), ' ') << recall[0] << "       " << ms[0]
+            << "      " << recall[1] << "             " << ms[1] << endl;
+    }
+    return 0;
+}
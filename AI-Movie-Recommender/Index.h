@@ -0,0 +1,50 @@
+﻿#pragma once
+
+#include "Recommender.h"
+
+// IVF-PQ: film vectors are bucketed by nearest coarse centroid, and the residual from
+// that centroid is stored as one 4-bit code per subspace (16 centroids each).
+// At 64 dimensions that is 16 bytes of codes plus a 4-byte id per film.
+const size_t PQ_BLOCK_SIZE = 32;
+const size_t PQ_CENTROIDS = 16;
+const uint32_t PQ_PADDING_ID = 0xFFFFFFFFu;
+// Fast-scan sums are 16-bit and each subspace adds up to 255 of them
+const size_t PQ_MAX_SUBSPACES = 65535 / 255;
+
+struct IvfPqIndex {
+    size_t dims = 0;
+    size_t numLists = 0;
+    size_t numSubspaces = 0;
+    size_t subDims = 0;
+    vector<float> coarseCentroids;  // numLists x dims
+    vector<float> codebooks;        // numSubspaces x 16 x subDims
+    vector<uint64_t> listOffsets;   // numLists + 1, in blocks of 32 films
+    vector<uint32_t> ids;           // blocks x 32 film ids, PQ_PADDING_ID fills the last block
+    vector<uint8_t> codes;          // blocks x (numSubspaces / 2) x 32 packed nibbles
+};
+
+// The same index as read-only arrays, either from an IvfPqIndex or a mapped model
+struct IvfPqView {
+    size_t dims = 0;
+    size_t numLists = 0;
+    size_t numSubspaces = 0;
+    size_t subDims = 0;
+    const float* coarseCentroids = nullptr;
+    const float* codebooks = nullptr;
+    const uint64_t* listOffsets = nullptr;
+    const uint32_t* ids = nullptr;
+    const uint8_t* codes = nullptr;
+
+    size_t blockBytes() const {
+        return numSubspaces / 2 * PQ_BLOCK_SIZE;
+    }
+};
+
+IvfPqView ivfPqViewOf(const IvfPqIndex& index);
+IvfPqIndex buildIvfPq(const float* vectors, size_t numFilms, size_t dims, size_t numLists, size_t numSubspaces,
+    const ClusteringOptions& options);
+vector<ScoredFilm> searchIvfPq(const IvfPqView& index, const float* query, size_t k, size_t nprobe,
+    const float* exactVectors = nullptr, size_t rerank = 0, const uint64_t* excluded = nullptr);
+bool loadIvfPqView(const MappedModel& model, IvfPqView& view);
+int runBuildIvfPqCommand(const vector<string>& args);
+int runIvfPqBenchmark(const vector<string>& args);
@@ -1,215 +1,3582 @@
-﻿#include <iostream>
-#include <fstream>
-#include <sstream>
-#include <string>
-#include <vector>
-#include <algorithm>
-#include <windows.h>
-
-using namespace std;
-
-// Structure to hold movie information
-struct Movie {
-    string date;
-    string name;
-    string year;
-    string letterboxdURI;
-    string rating;
-    string rewatch;
-    string tags;
-    string watchedDate;
+﻿#include "Recommender.h"
+#include "Import.h"
+#include "Index.h"
+#include "Reviews.h"
+#include "Shard.h"
+#include "Server.h"
+
+// Function to convert an IEEE half-precision value to float
+float halfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1F;
+    uint32_t mantissa = h & 0x3FF;
+    uint32_t bits;
+
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        }
+        else {
+            // Subnormal: shift until the implicit bit appears
+            exponent = 127 - 15 + 1;
+            while ((mantissa & 0x400) == 0) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            mantissa &= 0x3FF;
+            bits = sign | (exponent << 23) | (mantissa << 13);
+        }
+    }
+    else if (exponent == 0x1F) {
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    }
+    else {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Function to convert a float to IEEE half precision (round to nearest even)
+uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    uint32_t rawExponent = (bits >> 23) & 0xFF;
+    int32_t exponent = (int32_t)rawExponent - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFF;
+
+    if (rawExponent == 0xFF) {
+        return sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0);
+    }
+    if (exponent >= 0x1F) {
+        return sign | 0x7C00;
+    }
+    if (exponent <= 0) {
+        if (exponent < -10) return sign;
+
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t midpoint = 1u << (shift - 1);
+        if (remainder > midpoint || (remainder == midpoint && (half & 1))) {
+            half++;
+        }
+        return sign | (uint16_t)half;
+    }
+
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1FFF;
+    // A carry out of the mantissa correctly bumps the exponent
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+        half++;
+    }
+    return sign | (uint16_t)half;
+}
+
+// Function to convert a float to bfloat16 (round to nearest even, NaN stays NaN)
+uint16_t floatToBfloat16(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7FFFFFFF) > 0x7F800000) return (uint16_t)((bits >> 16) | 0x40);
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return (uint16_t)(bits >> 16);
+}
+
+// Function to quantize a float vector to int8, returning the scale to undo it
+float quantizeToInt8(const float* values, size_t n, int8_t* out) {
+    float maxAbs = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        maxAbs = max(maxAbs, fabs(values[i]));
+    }
+
+    float scale = maxAbs > 0.0f ? maxAbs / 127.0f : 1.0f;
+    for (size_t i = 0; i < n; i++) {
+        int q = (int)lround(values[i] / scale);
+        out[i] = (int8_t)min(127, max(-127, q));
+    }
+    return scale;
+}
+
+// Scalar kernels (baseline for every host)
+float dotF32Scalar(const float* a, const float* b, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+float dotF16Scalar(const float* a, const uint16_t* b, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        sum += a[i] * halfToFloat(b[i]);
+    }
+    return sum;
+}
+
+float dotBF16Scalar(const float* a, const uint16_t* b, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        sum += a[i] * bfloat16ToFloat(b[i]);
+    }
+    return sum;
+}
+
+int32_t dotI8Scalar(const int8_t* a, const int8_t* b, size_t n) {
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += (int32_t)a[i] * (int32_t)b[i];
+    }
+    return sum;
+}
+
+// SSE4 kernels
+TARGET_SSE4 float horizontalSumSSE4(__m128 v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 0x55));
+    return _mm_cvtss_f32(v);
+}
+
+TARGET_SSE4 float dotF32SSE4(const float* a, const float* b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    float sum = horizontalSumSSE4(_mm_add_ps(acc0, acc1));
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+TARGET_SSE4 float dotF16SSE4(const float* a, const uint16_t* b, size_t n) {
+    // No F16C guaranteed at this level, so widen in scalar and multiply in vector
+    __m128 acc = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 wide = _mm_setr_ps(halfToFloat(b[i]), halfToFloat(b[i + 1]),
+            halfToFloat(b[i + 2]), halfToFloat(b[i + 3]));
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), wide));
+    }
+    float sum = horizontalSumSSE4(acc);
+    for (; i < n; i++) {
+        sum += a[i] * halfToFloat(b[i]);
+    }
+    return sum;
+}
+
+TARGET_SSE4 float dotBF16SSE4(const float* a, const uint16_t* b, size_t n) {
+    // Widening bfloat16 is a zero-extend and a shift, no conversion instruction needed
+    __m128 acc = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i bits = _mm_slli_epi32(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(b + i))), 16);
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_castsi128_ps(bits)));
+    }
+    float sum = horizontalSumSSE4(acc);
+    for (; i < n; i++) {
+        sum += a[i] * bfloat16ToFloat(b[i]);
+    }
+    return sum;
+}
+
+TARGET_SSE4 int32_t dotI8SSE4(const int8_t* a, const int8_t* b, size_t n) {
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i va = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)(a + i)));
+        __m128i vb = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)(b + i)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(va, vb));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+    int32_t sum = _mm_cvtsi128_si32(acc);
+    for (; i < n; i++) {
+        sum += (int32_t)a[i] * (int32_t)b[i];
+    }
+    return sum;
+}
+
+// AVX2 kernels (FMA and F16C are checked alongside AVX2)
+TARGET_AVX2 float horizontalSumAVX2(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+    return _mm_cvtss_f32(sum);
+}
+
+TARGET_AVX2 float dotF32AVX2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float sum = horizontalSumAVX2(_mm256_add_ps(acc0, acc1));
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+TARGET_AVX2 float dotF16AVX2(const float* a, const uint16_t* b, size_t n) {
+    __m256 acc = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 wide = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(b + i)));
+        acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), wide, acc);
+    }
+    float sum = horizontalSumAVX2(acc);
+    for (; i < n; i++) {
+        sum += a[i] * halfToFloat(b[i]);
+    }
+    return sum;
+}
+
+TARGET_AVX2 float dotBF16AVX2(const float* a, const uint16_t* b, size_t n) {
+    __m256 acc = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i bits = _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(b + i))), 16);
+        acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_castsi256_ps(bits), acc);
+    }
+    float sum = horizontalSumAVX2(acc);
+    for (; i < n; i++) {
+        sum += a[i] * bfloat16ToFloat(b[i]);
+    }
+    return sum;
+}
+
+TARGET_AVX2 int32_t dotI8AVX2(const int8_t* a, const int8_t* b, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a + i)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+    }
+    __m128i sum4 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum4 = _mm_add_epi32(sum4, _mm_shuffle_epi32(sum4, 0x4E));
+    sum4 = _mm_add_epi32(sum4, _mm_shuffle_epi32(sum4, 0xB1));
+    int32_t sum = _mm_cvtsi128_si32(sum4);
+    for (; i < n; i++) {
+        sum += (int32_t)a[i] * (int32_t)b[i];
+    }
+    return sum;
+}
+
+// AVX-512 kernels (F + BW + VL), tails handled with masked loads
+TARGET_AVX512 float dotF32AVX512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < n) {
+        __mmask16 mask = (__mmask16)((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+TARGET_AVX512 float dotF16AVX512(const float* a, const uint16_t* b, size_t n) {
+    __m512 acc = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 wide = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(b + i)));
+        acc = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), wide, acc);
+    }
+    if (i < n) {
+        __mmask16 mask = (__mmask16)((1u << (n - i)) - 1);
+        __m512 wide = _mm512_cvtph_ps(_mm256_maskz_loadu_epi16(mask, b + i));
+        acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), wide, acc);
+    }
+    return _mm512_reduce_add_ps(acc);
+}
+
+TARGET_AVX512 float dotBF16AVX512(const float* a, const uint16_t* b, size_t n) {
+    __m512 acc = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i bits = _mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(b + i))), 16);
+        acc = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_castsi512_ps(bits), acc);
+    }
+    if (i < n) {
+        __mmask16 mask = (__mmask16)((1u << (n - i)) - 1);
+        __m512i bits = _mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm256_maskz_loadu_epi16(mask, b + i)), 16);
+        acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_castsi512_ps(bits), acc);
+    }
+    return _mm512_reduce_add_ps(acc);
+}
+
+TARGET_AVX512 int32_t dotI8AVX512(const int8_t* a, const int8_t* b, size_t n) {
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512i va = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i*)(a + i)));
+        __m512i vb = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i*)(b + i)));
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(va, vb));
+    }
+    if (i < n) {
+        __mmask32 mask = (__mmask32)((1ull << (n - i)) - 1);
+        __m512i va = _mm512_cvtepi8_epi16(_mm256_maskz_loadu_epi8(mask, a + i));
+        __m512i vb = _mm512_cvtepi8_epi16(_mm256_maskz_loadu_epi8(mask, b + i));
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(va, vb));
+    }
+    return _mm512_reduce_add_epi32(acc);
+}
+
+// Function to count trailing zero bits (value must be non-zero)
+inline int countTrailingZeros(uint64_t value) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return (int)index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+// Function to count set bits
+inline int popCount64(uint64_t value) {
+#if defined(_MSC_VER)
+    return (int)__popcnt64(value);
+#else
+    return __builtin_popcountll(value);
+#endif
+}
+
+// Parsing kernels: find the next quote or comma in a CSV line (or 'length' if none)
+size_t findCsvSpecialScalar(const char* text, size_t start, size_t length) {
+    for (size_t i = start; i < length; i++) {
+        if (text[i] == '"' || text[i] == ',') return i;
+    }
+    return length;
+}
+
+TARGET_SSE4 size_t findCsvSpecialSSE4(const char* text, size_t start, size_t length) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i comma = _mm_set1_epi8(',');
+    size_t i = start;
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(text + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, comma)));
+        if (mask != 0) return i + countTrailingZeros((uint32_t)mask);
+    }
+    return findCsvSpecialScalar(text, i, length);
+}
+
+TARGET_AVX2 size_t findCsvSpecialAVX2(const char* text, size_t start, size_t length) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i comma = _mm256_set1_epi8(',');
+    size_t i = start;
+    for (; i + 32 <= length; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(text + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, comma)));
+        if (mask != 0) return i + countTrailingZeros(mask);
+    }
+    return findCsvSpecialSSE4(text, i, length);
+}
+
+TARGET_AVX512 size_t findCsvSpecialAVX512(const char* text, size_t start, size_t length) {
+    const __m512i quote = _mm512_set1_epi8('"');
+    const __m512i comma = _mm512_set1_epi8(',');
+    for (size_t i = start; i < length; i += 64) {
+        // Masked loads never touch bytes past the end of the line
+        __mmask64 valid = length - i >= 64 ? ~0ull : ((1ull << (length - i)) - 1);
+        __m512i chunk = _mm512_maskz_loadu_epi8(valid, text + i);
+        __mmask64 mask = (_mm512_cmpeq_epi8_mask(chunk, quote) | _mm512_cmpeq_epi8_mask(chunk, comma)) & valid;
+        if (mask != 0) return i + countTrailingZeros(mask);
+    }
+    return length;
+}
+
+// Filtering kernels: write the indices of values >= threshold, returning how many
+size_t filterAtLeastScalar(const float* values, size_t n, float threshold, uint32_t* outIndices) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (values[i] >= threshold) outIndices[count++] = (uint32_t)i;
+    }
+    return count;
+}
+
+TARGET_SSE4 size_t filterAtLeastSSE4(const float* values, size_t n, float threshold, uint32_t* outIndices) {
+    const __m128 limit = _mm_set1_ps(threshold);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int mask = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(values + i), limit));
+        while (mask != 0) {
+            outIndices[count++] = (uint32_t)(i + countTrailingZeros((uint32_t)mask));
+            mask &= mask - 1;
+        }
+    }
+    for (; i < n; i++) {
+        if (values[i] >= threshold) outIndices[count++] = (uint32_t)i;
+    }
+    return count;
+}
+
+TARGET_AVX2 size_t filterAtLeastAVX2(const float* values, size_t n, float threshold, uint32_t* outIndices) {
+    const __m256 limit = _mm256_set1_ps(threshold);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(values + i), limit, _CMP_GE_OQ));
+        while (mask != 0) {
+            outIndices[count++] = (uint32_t)(i + countTrailingZeros((uint32_t)mask));
+            mask &= mask - 1;
+        }
+    }
+    for (; i < n; i++) {
+        if (values[i] >= threshold) outIndices[count++] = (uint32_t)i;
+    }
+    return count;
+}
+
+TARGET_AVX512 size_t filterAtLeastAVX512(const float* values, size_t n, float threshold, uint32_t* outIndices) {
+    const __m512 limit = _mm512_set1_ps(threshold);
+    const __m512i step = _mm512_set1_epi32(16);
+    __m512i indices = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    size_t count = 0;
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 valid = n - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        __mmask16 mask = _mm512_mask_cmp_ps_mask(valid, _mm512_maskz_loadu_ps(valid, values + i), limit, _CMP_GE_OQ);
+        _mm512_mask_compressstoreu_epi32(outIndices + count, mask, indices);
+        count += popCount64(mask);
+        indices = _mm512_add_epi32(indices, step);
+    }
+    return count;
+}
+
+// Hashing kernels: CRC-32C, identical results in software and hardware so
+// hashes stay stable across hosts
+uint32_t crc32cScalar(uint32_t crc, const void* data, size_t length) {
+    static const vector<uint32_t> table = [] {
+        vector<uint32_t> entries(256);
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++) {
+                value = (value & 1) ? (value >> 1) ^ 0x82F63B78u : value >> 1;
+            }
+            entries[i] = value;
+        }
+        return entries;
+    }();
+
+    const unsigned char* bytes = (const unsigned char*)data;
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+TARGET_SSE4 uint32_t crc32cSSE4(uint32_t crc, const void* data, size_t length) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint32_t crc32 = ~crc;
+#if defined(_M_X64) || defined(__x86_64__)
+    // The 8-byte form only exists in 64-bit mode
+    uint64_t value = crc32;
+    while (length >= 8) {
+        uint64_t chunk;
+        memcpy(&chunk, bytes, sizeof(chunk));
+        value = _mm_crc32_u64(value, chunk);
+        bytes += 8;
+        length -= 8;
+    }
+    crc32 = (uint32_t)value;
+#endif
+    while (length >= 4) {
+        uint32_t chunk;
+        memcpy(&chunk, bytes, sizeof(chunk));
+        crc32 = _mm_crc32_u32(crc32, chunk);
+        bytes += 4;
+        length -= 4;
+    }
+    while (length-- > 0) {
+        crc32 = _mm_crc32_u8(crc32, *bytes++);
+    }
+    return ~crc32;
+}
+
+// PQ fast-scan kernels: score a block of 32 product-quantized vectors against a
+// query's 8-bit lookup tables. Codes are 4-bit; byte v of pair p holds vector v's
+// code for subspace 2p in its low nibble and for subspace 2p+1 in its high nibble.
+// Each subspace has a 16-entry table, so lookups are in-register byte shuffles.
+void pqScanBlockScalar(const uint8_t* block, const uint8_t* lut, size_t numPairs, uint16_t* out) {
+    for (int v = 0; v < 32; v++) out[v] = 0;
+    for (size_t p = 0; p < numPairs; p++) {
+        const uint8_t* codes = block + p * 32;
+        const uint8_t* lutLow = lut + p * 32;
+        const uint8_t* lutHigh = lutLow + 16;
+        for (int v = 0; v < 32; v++) {
+            out[v] += lutLow[codes[v] & 0x0F] + lutHigh[codes[v] >> 4];
+        }
+    }
+}
+
+TARGET_SSE4 void pqScanBlockSSE4(const uint8_t* block, const uint8_t* lut, size_t numPairs, uint16_t* out) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc[4] = { zero, zero, zero, zero };
+
+    for (size_t p = 0; p < numPairs; p++) {
+        __m128i lutLow = _mm_loadu_si128((const __m128i*)(lut + p * 32));
+        __m128i lutHigh = _mm_loadu_si128((const __m128i*)(lut + p * 32 + 16));
+        for (int half = 0; half < 2; half++) {
+            __m128i codes = _mm_loadu_si128((const __m128i*)(block + p * 32 + half * 16));
+            __m128i a = _mm_shuffle_epi8(lutLow, _mm_and_si128(codes, nibble));
+            __m128i b = _mm_shuffle_epi8(lutHigh, _mm_and_si128(_mm_srli_epi16(codes, 4), nibble));
+            acc[half * 2] = _mm_add_epi16(acc[half * 2], _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)));
+            acc[half * 2 + 1] = _mm_add_epi16(acc[half * 2 + 1], _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)));
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i*)(out + i * 8), acc[i]);
+    }
+}
+
+TARGET_AVX2 void pqScanBlockAVX2(const uint8_t* block, const uint8_t* lut, size_t numPairs, uint16_t* out) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i accLow = zero;
+    __m256i accHigh = zero;
+
+    for (size_t p = 0; p < numPairs; p++) {
+        // Byte shuffles work within 128-bit lanes, so each table goes in both lanes
+        __m256i lutLow = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(lut + p * 32)));
+        __m256i lutHigh = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(lut + p * 32 + 16)));
+        __m256i codes = _mm256_loadu_si256((const __m256i*)(block + p * 32));
+        __m256i a = _mm256_shuffle_epi8(lutLow, _mm256_and_si256(codes, nibble));
+        __m256i b = _mm256_shuffle_epi8(lutHigh, _mm256_and_si256(_mm256_srli_epi16(codes, 4), nibble));
+        accLow = _mm256_add_epi16(accLow, _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero)));
+        accHigh = _mm256_add_epi16(accHigh, _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero)));
+    }
+
+    // Unpacking interleaves lanes: accLow holds vectors 0-7 and 16-23, accHigh 8-15 and 24-31
+    _mm_storeu_si128((__m128i*)(out + 0), _mm256_castsi256_si128(accLow));
+    _mm_storeu_si128((__m128i*)(out + 8), _mm256_castsi256_si128(accHigh));
+    _mm_storeu_si128((__m128i*)(out + 16), _mm256_extracti128_si256(accLow, 1));
+    _mm_storeu_si128((__m128i*)(out + 24), _mm256_extracti128_si256(accHigh, 1));
+}
+
+// CPU features relevant to the vectorized kernels
+struct CpuFeatures {
+    bool sse41 = false;
+    bool sse42 = false;
+    bool avx2 = false;
+    bool fma = false;
+    bool f16c = false;
+    bool avx512f = false;
+    bool avx512bw = false;
+    bool avx512vl = false;
+};
+
+void cpuidQuery(unsigned int leaf, unsigned int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, (int)leaf, (int)subleaf);
+    for (int i = 0; i < 4; i++) regs[i] = (unsigned int)r[i];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+uint64_t readXCR0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+// Function to detect which instruction sets this host (and its OS) supports
+CpuFeatures detectCpuFeatures() {
+    CpuFeatures features;
+    unsigned int regs[4];
+
+    cpuidQuery(0, 0, regs);
+    unsigned int maxLeaf = regs[0];
+
+    cpuidQuery(1, 0, regs);
+    features.sse41 = (regs[2] >> 19) & 1;
+    features.sse42 = (regs[2] >> 20) & 1;
+    features.fma = (regs[2] >> 12) & 1;
+    features.f16c = (regs[2] >> 29) & 1;
+    bool osxsave = (regs[2] >> 27) & 1;
+
+    // The OS must save the YMM/ZMM registers for AVX to be usable
+    uint64_t xcr0 = osxsave ? readXCR0() : 0;
+    bool osAvx = (xcr0 & 0x6) == 0x6;
+    bool osAvx512 = (xcr0 & 0xE6) == 0xE6;
+
+    if (maxLeaf >= 7) {
+        cpuidQuery(7, 0, regs);
+        features.avx2 = osAvx && ((regs[1] >> 5) & 1);
+        features.avx512f = osAvx512 && ((regs[1] >> 16) & 1);
+        features.avx512bw = osAvx512 && ((regs[1] >> 30) & 1);
+        features.avx512vl = osAvx512 && ((regs[1] >> 31) & 1);
+    }
+    if (!osAvx) {
+        features.fma = false;
+        features.f16c = false;
+    }
+
+    return features;
+}
+
+// Function to find the size of one core's L2 cache from the deterministic cache
+// parameters (leaf 4 on Intel, 0x8000001D on AMD); 256 KB if neither reports it
+size_t detectL2CacheBytes() {
+    unsigned int regs[4];
+    cpuidQuery(0, 0, regs);
+    unsigned int maxLeaf = regs[0];
+    cpuidQuery(0x80000000, 0, regs);
+    unsigned int maxExtendedLeaf = regs[0];
+
+    for (unsigned int leaf : { 4u, 0x8000001Du }) {
+        if (leaf == 4 ? maxLeaf < 4 : maxExtendedLeaf < leaf) continue;
+        for (unsigned int sub = 0; sub < 16; sub++) {
+            cpuidQuery(leaf, sub, regs);
+            unsigned int type = regs[0] & 0x1F;
+            if (type == 0) break;
+            if (((regs[0] >> 5) & 7) != 2 || type == 2) continue;    // skip instruction caches (type 2)
+            size_t ways = (regs[1] >> 22) + 1;
+            size_t partitions = ((regs[1] >> 12) & 0x3FF) + 1;
+            size_t lineSize = (regs[1] & 0xFFF) + 1;
+            size_t sets = (size_t)regs[2] + 1;
+            return ways * partitions * lineSize * sets;
+        }
+    }
+    return 256u << 10;
+}
+
+const char* isaLevelName(IsaLevel level) {
+    switch (level) {
+    case IsaLevel::SSE4: return "sse4";
+    case IsaLevel::AVX2: return "avx2";
+    case IsaLevel::AVX512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+// Function to parse an instruction set name as used by --isa and MOVIEREC_ISA
+bool parseIsaLevel(const string& name, IsaLevel& level) {
+    for (IsaLevel candidate : { IsaLevel::Scalar, IsaLevel::SSE4, IsaLevel::AVX2, IsaLevel::AVX512 }) {
+        if (name == isaLevelName(candidate)) {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Function to find the highest tier whose every kernel this host can run
+IsaLevel highestSupportedIsa(const CpuFeatures& cpu) {
+    if (cpu.avx512f && cpu.avx512bw && cpu.avx512vl && cpu.fma && cpu.f16c && cpu.sse42) {
+        return IsaLevel::AVX512;
+    }
+    if (cpu.avx2 && cpu.fma && cpu.f16c && cpu.sse42) {
+        return IsaLevel::AVX2;
+    }
+    if (cpu.sse41 && cpu.sse42) {
+        return IsaLevel::SSE4;
+    }
+    return IsaLevel::Scalar;
+}
+
+// Function to build the kernel table for a tier (the caller checks host support)
+KernelTable kernelTableFor(IsaLevel level) {
+    switch (level) {
+    case IsaLevel::AVX512:
+        return { level, { "avx512", dotF32AVX512, dotF16AVX512, dotBF16AVX512, dotI8AVX512 },
+            findCsvSpecialAVX512, "avx512", filterAtLeastAVX512, "avx512", crc32cSSE4, "sse4.2", pqScanBlockAVX2, "avx2" };
+    case IsaLevel::AVX2:
+        return { level, { "avx2", dotF32AVX2, dotF16AVX2, dotBF16AVX2, dotI8AVX2 },
+            findCsvSpecialAVX2, "avx2", filterAtLeastAVX2, "avx2", crc32cSSE4, "sse4.2", pqScanBlockAVX2, "avx2" };
+    case IsaLevel::SSE4:
+        return { level, { "sse4", dotF32SSE4, dotF16SSE4, dotBF16SSE4, dotI8SSE4 },
+            findCsvSpecialSSE4, "sse4", filterAtLeastSSE4, "sse4", crc32cSSE4, "sse4.2", pqScanBlockSSE4, "sse4" };
+    default:
+        return { IsaLevel::Scalar, { "scalar", dotF32Scalar, dotF16Scalar, dotBF16Scalar, dotI8Scalar },
+            findCsvSpecialScalar, "scalar", filterAtLeastScalar, "scalar", crc32cScalar, "scalar", pqScanBlockScalar, "scalar" };
+    }
+}
+
+// Function to list every tier this host can run, slowest first
+vector<IsaLevel> supportedIsaLevels() {
+    IsaLevel highest = highestSupportedIsa(detectCpuFeatures());
+    vector<IsaLevel> levels;
+    for (IsaLevel level : { IsaLevel::Scalar, IsaLevel::SSE4, IsaLevel::AVX2, IsaLevel::AVX512 }) {
+        if (level <= highest) levels.push_back(level);
+    }
+    return levels;
+}
+
+// Instruction set requested with --isa=<level>; takes precedence over MOVIEREC_ISA
+string isaOverride;
+
+// Function to choose the tier to run: the host's best unless overridden for testing.
+// Overrides above what the host supports are clamped rather than allowed to crash.
+IsaLevel selectIsaLevel(string& reason) {
+    IsaLevel highest = highestSupportedIsa(detectCpuFeatures());
+
+    string requested = isaOverride;
+    string source = "--isa";
+    if (requested.empty()) {
+        const char* env = getenv("MOVIEREC_ISA");
+        if (env != nullptr) requested = env;
+        source = "MOVIEREC_ISA";
+    }
+    if (requested.empty()) {
+        reason = "best available";
+        return highest;
+    }
+
+    IsaLevel level;
+    if (!parseIsaLevel(requested, level)) {
+        reason = "ignored unknown " + source + " value '" + requested + "'";
+        return highest;
+    }
+    if (level > highest) {
+        reason = source + "=" + requested + " not supported by this CPU, clamped";
+        return highest;
+    }
+    reason = "forced by " + source + "=" + requested;
+    return level;
+}
+
+string kernelSelectionReason;
+
+// Function to get the kernel table for this process (chosen once, at first use)
+const KernelTable& activeKernels() {
+    static const KernelTable table = kernelTableFor(selectIsaLevel(kernelSelectionReason));
+    return table;
+}
+
+const ScoringKernels& scoringKernels() {
+    return activeKernels().scoring;
+}
+
+// Function to report the detected CPU features and the variant chosen for each path
+void printKernelReport() {
+    CpuFeatures cpu = detectCpuFeatures();
+    const KernelTable& table = activeKernels();
+
+    cout << "CPU features:";
+    if (cpu.sse41) cout << " sse4.1";
+    if (cpu.sse42) cout << " sse4.2";
+    if (cpu.avx2) cout << " avx2";
+    if (cpu.fma) cout << " fma";
+    if (cpu.f16c) cout << " f16c";
+    if (cpu.avx512f) cout << " avx512f";
+    if (cpu.avx512bw) cout << " avx512bw";
+    if (cpu.avx512vl) cout << " avx512vl";
+    cout << endl;
+
+    cout << "Kernel tier: " << isaLevelName(table.level) << " (" << kernelSelectionReason << ")" << endl;
+    cout << "  parsing:   " << table.parseVariant << endl;
+    cout << "  scoring:   " << table.scoring.name << endl;
+    cout << "  filtering: " << table.filterVariant << endl;
+    cout << "  hashing:   " << table.hashVariant << endl;
+    cout << "  pq scan:   " << table.pqScanVariant << endl;
+}
+
+// Function to hash a byte string to 64 bits (stable across hosts and tiers)
+uint64_t hashBytes(const void* data, size_t length) {
+    uint64_t hash = ((uint64_t)activeKernels().crc32c(0, data, length) << 32) | (uint32_t)length;
+    // Finalizer to spread the CRC over all 64 bits
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Function to compute the L2 norm of a vector
+float l2Norm(const ScoringKernels& kernels, const float* a, size_t n) {
+    return sqrt(kernels.dotF32(a, a, n));
+}
+
+// Function to compute the cosine similarity of two vectors (0 if either is zero)
+float cosineSimilarity(const ScoringKernels& kernels, const float* a, const float* b, size_t n) {
+    float normA = l2Norm(kernels, a, n);
+    float normB = l2Norm(kernels, b, n);
+    if (normA == 0.0f || normB == 0.0f) return 0.0f;
+    return kernels.dotF32(a, b, n) / (normA * normB);
+}
+
+// Functions to score every film in a row-major factor matrix against a user vector
+void scoreFilmsF32(const ScoringKernels& kernels, const float* user, const float* films,
+    size_t numFilms, size_t dims, float* scores) {
+    for (size_t f = 0; f < numFilms; f++) {
+        scores[f] = kernels.dotF32(user, films + f * dims, dims);
+    }
+}
+
+void scoreFilmsF16(const ScoringKernels& kernels, const float* user, const uint16_t* films,
+    size_t numFilms, size_t dims, float* scores) {
+    for (size_t f = 0; f < numFilms; f++) {
+        scores[f] = kernels.dotF16(user, films + f * dims, dims);
+    }
+}
+
+void scoreFilmsI8(const ScoringKernels& kernels, const int8_t* user, float userScale,
+    const int8_t* films, const float* filmScales, size_t numFilms, size_t dims, float* scores) {
+    for (size_t f = 0; f < numFilms; f++) {
+        scores[f] = kernels.dotI8(user, films + f * dims, dims) * userScale * filmScales[f];
+    }
+}
+
+vector<ScoredFilm> topKFilmsF32(const ScoringKernels& kernels, const float* user, const float* films,
+    size_t numFilms, size_t dims, size_t k, const uint64_t* excluded) {
+    return selectTopK(numFilms, k, excluded, [&](size_t f) {
+        return kernels.dotF32(user, films + f * dims, dims);
+        });
+}
+
+vector<ScoredFilm> topKFilmsF16(const ScoringKernels& kernels, const float* user, const uint16_t* films,
+    size_t numFilms, size_t dims, size_t k, const uint64_t* excluded = nullptr) {
+    return selectTopK(numFilms, k, excluded, [&](size_t f) {
+        return kernels.dotF16(user, films + f * dims, dims);
+        });
+}
+
+vector<ScoredFilm> topKFilmsI8(const ScoringKernels& kernels, const int8_t* user, float userScale,
+    const int8_t* films, const float* filmScales, size_t numFilms, size_t dims, size_t k,
+    const uint64_t* excluded = nullptr) {
+    return selectTopK(numFilms, k, excluded, [&](size_t f) {
+        return kernels.dotI8(user, films + f * dims, dims) * userScale * filmScales[f];
+        });
+}
+
+// Function to trim whitespace from string
+string trim(const string& str) {
+    size_t first = str.find_first_not_of(" \t\r\n\"");
+    if (string::npos == first) {
+        return "";
+    }
+    size_t last = str.find_last_not_of(" \t\r\n\"");
+    return str.substr(first, (last - first + 1));
+}
+
+// Function to parse a CSV line (handles quoted fields with commas)
+vector<string> parseCSVLine(const string& line) {
+    vector<string> fields;
+    string field;
+    bool inQuotes = false;
+
+    const char* text = line.data();
+    size_t length = line.length();
+    auto findSpecial = activeKernels().findCsvSpecial;
+
+    size_t i = 0;
+    while (i < length) {
+        // Copy the run of ordinary characters up to the next quote or comma in one go
+        size_t next = findSpecial(text, i, length);
+        field.append(text + i, next - i);
+        if (next == length) break;
+
+        if (text[next] == '"') {
+            inQuotes = !inQuotes;
+        }
+        else if (!inQuotes) {
+            fields.push_back(trim(field));
+            field.clear();
+        }
+        else {
+            field += ',';
+        }
+        i = next + 1;
+    }
+
+    // Add the last field
+    fields.push_back(trim(field));
+
+    return fields;
+}
+
+// Safe string to double conversion
+double safeStringToDouble(const string& str) {
+    if (str.empty()) return 0.0;
+
+    try {
+        size_t idx;
+        double value = stod(str, &idx);
+        // Check if entire string was converted
+        if (idx != str.length()) {
+            return 0.0;
+        }
+        return value;
+    }
+    catch (...) {
+        return 0.0;
+    }
+}
+
+// Function to read and parse the Letterboxd diary CSV
+vector<Movie> readLetterboxdCSV(const string& filename, bool verbose) {
+    vector<Movie> movies;
+
+    // Try to open file with different methods
+    ifstream file;
+
+    // Try opening as-is
+    file.open(filename);
+
+    // If that fails, try with binary mode
+    if (!file.is_open()) {
+        file.open(filename, ios::binary);
+    }
+
+    if (!file.is_open()) {
+        cerr << "Error: Could not open file '" << filename << "'" << endl;
+        cerr << "Please check that:" << endl;
+        cerr << "  - The file path is correct" << endl;
+        cerr << "  - The file exists" << endl;
+        cerr << "  - You have permission to read the file" << endl;
+        return movies;
+    }
+
+    string line;
+    int lineNumber = 0;
+    bool isFirstLine = true;
+
+    while (getline(file, line)) {
+        lineNumber++;
+
+        // Remove any carriage return characters
+        if (!line.empty() && line[line.length() - 1] == '\r') {
+            line = line.substr(0, line.length() - 1);
+        }
+
+        // Skip header line
+        if (isFirstLine) {
+            isFirstLine = false;
+            if (verbose) cout << "CSV Header: " << line << endl << endl;
+            continue;
+        }
+
+        // Skip empty lines
+        if (line.empty()) continue;
+
+        try {
+            vector<string> fields = parseCSVLine(line);
+
+            // Debug: show how many fields we found
+            if (verbose && lineNumber == 2) {
+                cout << "First data line has " << fields.size() << " fields" << endl << endl;
+            }
+
+            // Letterboxd diary.csv format:
+            // Date,Name,Year,Letterboxd URI,Rating,Rewatch,Tags,Watched Date
+            if (fields.size() >= 2) {  // At minimum we need date and name
+                Movie movie;
+                movie.date = fields.size() > 0 ? fields[0] : "";
+                movie.name = fields.size() > 1 ? fields[1] : "";
+                movie.year = fields.size() > 2 ? fields[2] : "";
+                movie.letterboxdURI = fields.size() > 3 ? fields[3] : "";
+                movie.rating = fields.size() > 4 ? fields[4] : "";
+                movie.rewatch = fields.size() > 5 ? fields[5] : "";
+                movie.tags = fields.size() > 6 ? fields[6] : "";
+                movie.watchedDate = fields.size() > 7 ? fields[7] : "";
+
+                movies.push_back(movie);
+            }
+        }
+        catch (const exception& e) {
+            cerr << "Warning: Error parsing line " << lineNumber << ": " << e.what() << endl;
+            continue;
+        }
+        catch (...) {
+            cerr << "Warning: Unknown error parsing line " << lineNumber << endl;
+            continue;
+        }
+    }
+
+    file.close();
+
+    if (verbose) {
+        cout << "Successfully read " << movies.size() << " movies from CSV" << endl << endl;
+    }
+
+    return movies;
+}
+
+// Function to convert rating to stars
+string ratingToStars(const string& rating) {
+    if (rating.empty()) return "";
+
+    double ratingValue = safeStringToDouble(rating);
+
+    // Convert 0-5 scale to star display
+    if (ratingValue == 0.0) return "";
+
+    int fullStars = (int)ratingValue;
+    bool halfStar = (ratingValue - fullStars) >= 0.5;
+
+    string stars;
+    for (int i = 0; i < fullStars; i++) {
+        stars += "*";
+    }
+    if (halfStar) {
+        stars += "½";
+    }
+
+    return stars + " (" + rating + "/5)";
+}
+
+// Function to get the key that identifies a film across exports and models: "Name (Year)".
+// (The diary's Letterboxd URI points at the log entry, not the film.)
+string filmKeyFor(const Movie& movie) {
+    if (movie.year.empty()) return movie.name;
+    return movie.name + " (" + movie.year + ")";
+}
+
+// Function to open file dialog (Windows only)
+string openFileDialog() {
+    char filename[MAX_PATH] = "";
+
+    OPENFILENAMEA ofn;
+    ZeroMemory(&ofn, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = NULL;
+    ofn.lpstrFilter = "CSV Files (*.csv)\0*.csv\0All Files (*.*)\0*.*\0";
+    ofn.lpstrFile = filename;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.Flags = OFN_EXPLORER | OFN_FILEMUSTEXIST | OFN_HIDEREADONLY;
+    ofn.lpstrDefExt = "csv";
+    ofn.lpstrTitle = "Select Letterboxd diary.csv file";
+
+    if (GetOpenFileNameA(&ofn)) {
+        return string(filename);
+    }
+
+    return "";
+}
+
+uint64_t alignModelOffset(uint64_t offset) {
+    return (offset + MODEL_ALIGNMENT - 1) & ~(MODEL_ALIGNMENT - 1);
+}
+
+// Function to write a model file. Writes to a temporary file first and renames it
+// over the target, so a reader never maps a half-written model.
+bool writeModelFile(const string& filename, const vector<ModelSectionData>& sections) {
+    const KernelTable& kernels = activeKernels();
+
+    vector<ModelSectionEntry> table(sections.size());
+    uint64_t offset = alignModelOffset(sizeof(ModelFileHeader) + sections.size() * sizeof(ModelSectionEntry));
+    for (size_t i = 0; i < sections.size(); i++) {
+        const ModelSectionData& section = sections[i];
+        table[i].id = section.id;
+        table[i].elementType = (uint32_t)section.type;
+        table[i].offset = offset;
+        table[i].byteSize = section.byteSize;
+        table[i].rows = section.rows;
+        table[i].cols = section.cols;
+        table[i].crc = kernels.crc32c(0, section.data, (size_t)section.byteSize);
+        offset = alignModelOffset(offset + section.byteSize);
+    }
+
+    ModelFileHeader header = {};
+    memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+    header.version = MODEL_VERSION;
+    header.headerSize = sizeof(ModelFileHeader);
+    header.sectionCount = (uint32_t)sections.size();
+    header.alignment = (uint32_t)MODEL_ALIGNMENT;
+    header.fileSize = offset;
+    header.sectionTableCrc = kernels.crc32c(0, table.data(), table.size() * sizeof(ModelSectionEntry));
+    header.headerCrc = kernels.crc32c(0, &header, sizeof(header));
+
+    string tempName = filename + ".tmp";
+    ofstream out(tempName, ios::binary | ios::trunc);
+    if (!out.is_open()) {
+        cerr << "Error: Could not create model file '" << tempName << "'" << endl;
+        return false;
+    }
+
+    static const char padding[MODEL_ALIGNMENT] = {};
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)table.data(), table.size() * sizeof(ModelSectionEntry));
+    uint64_t written = sizeof(header) + table.size() * sizeof(ModelSectionEntry);
+    for (size_t i = 0; i < sections.size(); i++) {
+        out.write(padding, (streamsize)(table[i].offset - written));
+        out.write((const char*)sections[i].data, (streamsize)sections[i].byteSize);
+        written = table[i].offset + sections[i].byteSize;
+    }
+    out.write(padding, (streamsize)(header.fileSize - written));
+    out.close();
+
+    if (!out) {
+        cerr << "Error: Failed while writing model file '" << tempName << "'" << endl;
+        DeleteFileA(tempName.c_str());
+        return false;
+    }
+    if (!MoveFileExA(tempName.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        cerr << "Error: Could not replace model file '" << filename << "'" << endl;
+        DeleteFileA(tempName.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Function to map a model file and validate its header and section table
+bool openModelFile(const string& filename, ModelValidation validation, MappedModel& model) {
+    model.close();
+    model.validation = validation;
+
+    model.file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (model.file == INVALID_HANDLE_VALUE) {
+        cerr << "Error: Could not open model file '" << filename << "'" << endl;
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(model.file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(ModelFileHeader)) {
+        cerr << "Error: '" << filename << "' is too small to be a model file" << endl;
+        model.close();
+        return false;
+    }
+    model.size = (uint64_t)fileSize.QuadPart;
+
+    model.mapping = CreateFileMappingA(model.file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (model.mapping != NULL) {
+        model.base = (const unsigned char*)MapViewOfFile(model.mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (model.base == nullptr) {
+        cerr << "Error: Could not map model file '" << filename << "' (error " << GetLastError() << ")" << endl;
+        model.close();
+        return false;
+    }
+
+    const KernelTable& kernels = activeKernels();
+    ModelFileHeader header;
+    memcpy(&header, model.base, sizeof(header));
+    uint32_t storedCrc = header.headerCrc;
+    header.headerCrc = 0;
+
+    string problem;
+    if (memcmp(header.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC)) != 0) {
+        problem = "not a model file";
+    }
+    else if (header.version != MODEL_VERSION) {
+        problem = "unsupported model version " + to_string(header.version);
+    }
+    else if (kernels.crc32c(0, &header, sizeof(header)) != storedCrc) {
+        problem = "header checksum mismatch";
+    }
+    else if (header.fileSize != model.size) {
+        problem = "file is truncated or has trailing data";
+    }
+    else if (sizeof(ModelFileHeader) + (uint64_t)header.sectionCount * sizeof(ModelSectionEntry) > model.size) {
+        problem = "section table runs past the end of the file";
+    }
+
+    if (problem.empty()) {
+        model.header = (const ModelFileHeader*)model.base;
+        model.sections = (const ModelSectionEntry*)(model.base + sizeof(ModelFileHeader));
+        if (kernels.crc32c(0, model.sections, header.sectionCount * sizeof(ModelSectionEntry)) != header.sectionTableCrc) {
+            problem = "section table checksum mismatch";
+        }
+        for (uint32_t i = 0; problem.empty() && i < header.sectionCount; i++) {
+            const ModelSectionEntry& entry = model.sections[i];
+            if (entry.offset % MODEL_ALIGNMENT != 0 || entry.offset > model.size ||
+                entry.byteSize > model.size - entry.offset) {
+                problem = "section " + to_string(entry.id) + " is misaligned or out of bounds";
+            }
+            else {
+                // rows * rowBytes could overflow, so compare by dividing instead
+                uint64_t rowBytes = (uint64_t)entry.cols * modelElementSize((ModelElementType)entry.elementType);
+                bool consistent = rowBytes == 0 ? entry.byteSize == 0
+                    : entry.byteSize % rowBytes == 0 && entry.byteSize / rowBytes == entry.rows;
+                if (!consistent) problem = "section " + to_string(entry.id) + " has inconsistent dimensions";
+            }
+        }
+    }
+
+    if (!problem.empty()) {
+        cerr << "Error: Model file '" << filename << "': " << problem << endl;
+        model.close();
+        return false;
+    }
+
+    model.sectionState.reset(new atomic<int>[header.sectionCount]);
+    for (uint32_t i = 0; i < header.sectionCount; i++) {
+        model.sectionState[i].store(0);
+    }
+
+    if (validation == ModelValidation::Full) {
+        for (uint32_t i = 0; i < header.sectionCount; i++) {
+            if (!model.verifySection(&model.sections[i])) {
+                cerr << "Error: Model file '" << filename << "': section " << model.sections[i].id
+                    << " failed its checksum" << endl;
+                model.close();
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Function to widen one row of fp16 or bf16 factors into 'scratch'
+const float* widenFactorRow(const uint16_t* row, ModelElementType type, size_t dims, vector<float>& scratch) {
+    scratch.resize(dims);
+    for (size_t i = 0; i < dims; i++) {
+        scratch[i] = type == ModelElementType::Float16 ? halfToFloat(row[i]) : bfloat16ToFloat(row[i]);
+    }
+    return scratch.data();
+}
+
+// Function to resolve a factor matrix stored as float32, fp16 or bf16. A float32
+// matrix comes back in 'floats'; a half-precision one in 'packed', as stored.
+bool factorSection(const MappedModel& model, uint32_t id, uint64_t& rows, uint32_t& cols,
+    const float*& floats, const uint16_t*& packed, ModelElementType& storedType) {
+    floats = nullptr;
+    packed = nullptr;
+    const ModelSectionEntry* entry = model.findSection(id);
+    if (entry == nullptr) return false;
+    storedType = (ModelElementType)entry->elementType;
+    if (storedType == ModelElementType::Float16 || storedType == ModelElementType::BFloat16) {
+        packed = model.sectionArray<uint16_t>(id, storedType, &rows, &cols);
+        return packed != nullptr;
+    }
+    floats = model.sectionArray<float>(id, ModelElementType::Float32, &rows, &cols);
+    return floats != nullptr;
+}
+
+// Function to give a view float copies of any half-precision factor matrices, for the
+// commands that hand whole matrices to float code (clustering, index builds, export).
+// The copies are kept by the model.
+void widenFactors(const MappedModel& model, ModelView& view) {
+    auto widen = [&](const uint16_t* values, ModelElementType type, size_t rows) {
+        unique_ptr<float[]> wide(new float[rows * view.dims]);
+        for (size_t i = 0; i < rows * view.dims; i++) {
+            wide[i] = type == ModelElementType::Float16 ? halfToFloat(values[i]) : bfloat16ToFloat(values[i]);
+        }
+        model.widened.push_back(move(wide));
+        return (const float*)model.widened.back().get();
+    };
+    if (view.filmFactors == nullptr && view.filmFactorsHalf != nullptr) {
+        view.filmFactors = widen(view.filmFactorsHalf, view.filmFactorType, view.numFilms);
+    }
+    if (view.userFactors == nullptr && view.userFactorsHalf != nullptr) {
+        view.userFactors = widen(view.userFactorsHalf, view.userFactorType, view.numUsers);
+    }
+}
+
+// Function to resolve the standard sections of a mapped model into a view
+bool loadModelView(const MappedModel& model, ModelView& view) {
+    uint64_t rows = 0;
+    uint32_t cols = 0;
+    view = ModelView();
+
+    if (!factorSection(model, SECTION_FILM_FACTORS, rows, cols, view.filmFactors, view.filmFactorsHalf, view.filmFactorType)
+        || cols == 0) {
+        cerr << "Error: Model has no film factor matrix" << endl;
+        return false;
+    }
+    view.numFilms = (size_t)rows;
+    view.dims = cols;
+
+    if (factorSection(model, SECTION_USER_FACTORS, rows, cols, view.userFactors, view.userFactorsHalf, view.userFactorType)) {
+        if (cols != view.dims) {
+            cerr << "Error: Model user and film factors have different dimensions" << endl;
+            return false;
+        }
+        view.numUsers = (size_t)rows;
+    }
+
+    view.filmKeyOffsets = model.sectionArray<uint64_t>(SECTION_FILM_KEY_OFFSETS, ModelElementType::UInt64, &rows);
+    if (view.filmKeyOffsets != nullptr) {
+        const ModelSectionEntry* bytes = model.findSection(SECTION_FILM_KEY_BYTES);
+        view.filmKeyBytes = model.sectionArray<char>(SECTION_FILM_KEY_BYTES, ModelElementType::Bytes);
+        if (view.filmKeyBytes == nullptr || rows != view.numFilms + 1 ||
+            view.filmKeyOffsets[view.numFilms] > bytes->byteSize) {
+            cerr << "Error: Model film key table is malformed" << endl;
+            return false;
+        }
+        // filmKey() takes differences of neighbouring offsets, so one decreasing pair
+        // would read far outside the key bytes
+        for (size_t f = 0; f < view.numFilms; f++) {
+            if (view.filmKeyOffsets[f] > view.filmKeyOffsets[f + 1]) {
+                cerr << "Error: Model film key offsets decrease at film " << f << endl;
+                return false;
+            }
+        }
+    }
+
+    view.clusterCentroids = model.sectionArray<float>(SECTION_CLUSTER_CENTROIDS, ModelElementType::Float32, &rows, &cols);
+    if (view.clusterCentroids != nullptr) {
+        view.numClusters = (size_t)rows;
+        view.filmClusters = model.sectionArray<uint32_t>(SECTION_FILM_CLUSTERS, ModelElementType::UInt32, &rows);
+        if (cols != view.dims || view.filmClusters == nullptr || rows != view.numFilms) {
+            cerr << "Error: Model film clusters are malformed" << endl;
+            return false;
+        }
+        // Cluster ids index per-cluster arrays sized by numClusters
+        for (size_t f = 0; f < view.numFilms; f++) {
+            if (view.filmClusters[f] >= view.numClusters) {
+                cerr << "Error: Model film " << f << " is assigned to unknown cluster " << view.filmClusters[f] << endl;
+                return false;
+            }
+        }
+    }
+
+    view.userProfiles = model.sectionArray<float>(SECTION_USER_PROFILES, ModelElementType::Float32, &rows, &cols);
+    if (view.userProfiles != nullptr) {
+        view.profileWidth = cols;
+        if (rows != view.numUsers) {
+            cerr << "Error: Model user profiles don't match its users" << endl;
+            return false;
+        }
+        if (cols != PROFILE_WIDTH) {
+            // Written by a build with another profile layout: unusable, but the rest is fine
+            cerr << "Warning: Ignoring model user profiles of width " << cols << " (expected " << PROFILE_WIDTH
+                << "); retrain to refresh them" << endl;
+            view.userProfiles = nullptr;
+            view.profileWidth = 0;
+        }
+    }
+
+    const float* globalMean = model.sectionArray<float>(SECTION_GLOBAL_MEAN, ModelElementType::Float32, &rows);
+    if (globalMean != nullptr) {
+        view.globalMean = rows > 0 ? globalMean[0] : 0.0f;
+        view.filmBiases = model.sectionArray<float>(SECTION_FILM_BIASES, ModelElementType::Float32, &rows);
+        if (view.filmBiases == nullptr || rows != view.numFilms) {
+            cerr << "Error: Model film biases are malformed" << endl;
+            return false;
+        }
+        view.userBiases = model.sectionArray<float>(SECTION_USER_BIASES, ModelElementType::Float32, &rows, &cols);
+        if (view.userBiases != nullptr && (rows != view.numUsers || cols != 2)) {
+            cerr << "Error: Model user biases are malformed" << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Shrinkage toward zero for biases estimated from few ratings
+const double FILM_BIAS_SHRINKAGE = 25.0;
+const double USER_BIAS_SHRINKAGE = 10.0;
+// Pseudo-ratings pulling a user's scale toward 1
+const double USER_SCALE_SHRINKAGE = 5.0;
+
+// Function to build the film key -> model row lookup used to match diary rows
+unordered_map<string, uint32_t> buildFilmIndex(const ModelView& view) {
+    unordered_map<string, uint32_t> index;
+    index.reserve(view.numFilms);
+    for (size_t f = 0; f < view.numFilms; f++) {
+        index.emplace(view.filmKey(f), (uint32_t)f);
+    }
+    return index;
+}
+
+void initFoldIn(FoldInState& state, const ModelView& view, double lambda) {
+    state.dims = view.dims;
+    state.lambda = lambda;
+    state.gram.assign(view.dims * view.dims, 0.0);
+    state.rhs.assign(view.dims, 0.0);
+    state.vectorSum.assign(view.dims, 0.0);
+    state.normalized = view.filmBiases != nullptr;
+    state.targetSum = 0.0;
+    state.userBias = 0.0;
+    state.ratedCount = 0;
+    state.ratedFilms.clear();
+    state.ratedTargets.clear();
+    state.userVector.assign(view.dims, 0.0f);
+    state.watchedBitmap.assign((view.numFilms + 63) / 64, 0);
+}
+
+// Function to add one watched film (and its rating, if any) to the normal equations
+void addFoldInRow(FoldInState& state, const ModelView& view, size_t film, double rating) {
+    state.watchedBitmap[film >> 6] |= 1ull << (film & 63);
+    if (rating <= 0.0) return;
+
+    double target = rating;
+    if (state.normalized) {
+        target -= view.globalMean + view.filmBiases[film];
+    }
+    state.targetSum += target;
+
+    const float* v = view.filmVector(film, state.filmScratch);
+    size_t d = state.dims;
+    for (size_t i = 0; i < d; i++) {
+        double vi = v[i];
+        state.rhs[i] += target * vi;
+        state.vectorSum[i] += vi;
+        // Only the lower triangle is read by the solver
+        for (size_t j = 0; j <= i; j++) {
+            state.gram[i * d + j] += vi * v[j];
+        }
+    }
+    state.ratedCount++;
+    state.ratedFilms.push_back((uint32_t)film);
+    state.ratedTargets.push_back((float)target);
+}
+
+// Function to solve (gram + lambda I) u = rhs by Cholesky decomposition
+bool solveFoldIn(FoldInState& state) {
+    size_t d = state.dims;
+    if (state.normalized) {
+        state.userBias = state.targetSum / (USER_BIAS_SHRINKAGE + state.ratedCount);
+    }
+
+    vector<double>& lower = state.lower;
+    lower.assign(d * d, 0.0);
+
+    for (size_t i = 0; i < d; i++) {
+        for (size_t j = 0; j <= i; j++) {
+            double sum = state.gram[i * d + j] + (i == j ? state.lambda : 0.0);
+            for (size_t k = 0; k < j; k++) {
+                sum -= lower[i * d + k] * lower[j * d + k];
+            }
+            if (i == j) {
+                if (sum <= 0.0) return false;
+                lower[i * d + i] = sqrt(sum);
+            }
+            else {
+                lower[i * d + j] = sum / lower[j * d + j];
+            }
+        }
+    }
+
+    // Forward substitution (L y = rhs), then back substitution (L^T u = y)
+    vector<double> y(d);
+    for (size_t i = 0; i < d; i++) {
+        double sum = state.rhs[i] - state.userBias * state.vectorSum[i];
+        for (size_t k = 0; k < i; k++) sum -= lower[i * d + k] * y[k];
+        y[i] = sum / lower[i * d + i];
+    }
+    for (size_t i = d; i-- > 0;) {
+        double sum = y[i];
+        for (size_t k = i + 1; k < d; k++) sum -= lower[k * d + i] * y[k];
+        y[i] = sum / lower[i * d + i];
+    }
+
+    for (size_t i = 0; i < d; i++) {
+        state.userVector[i] = (float)y[i];
+    }
+    return true;
+}
+
+// Function to fold diary rows into a user's state, returning how many matched model films
+size_t foldInDiaryRows(FoldInState& state, const ModelView& view, const unordered_map<string, uint32_t>& filmIndex,
+    const vector<Movie>& movies, size_t firstRow) {
+    size_t matched = 0;
+    for (size_t i = firstRow; i < movies.size(); i++) {
+        auto it = filmIndex.find(filmKeyFor(movies[i]));
+        if (it == filmIndex.end()) continue;
+        addFoldInRow(state, view, it->second, safeStringToDouble(movies[i].rating));
+        matched++;
+    }
+    return matched;
+}
+
+// Function to identify a diary row, so re-importing a file only picks up new entries
+uint64_t diaryRowKey(const Movie& movie) {
+    string key = movie.date + '\x1f' + movie.name + '\x1f' + movie.year + '\x1f' + movie.watchedDate + '\x1f' + movie.rating;
+    return hashBytes(key.data(), key.size());
+}
+
+// Function to re-read a diary export and append only rows not seen before.
+// Returns the number of rows appended.
+size_t importNewDiaryRows(const string& filename, vector<Movie>& movies) {
+    unordered_set<uint64_t> known;
+    known.reserve(movies.size());
+    for (const Movie& movie : movies) {
+        known.insert(diaryRowKey(movie));
+    }
+
+    size_t before = movies.size();
+    for (const Movie& movie : readLetterboxdCSV(filename)) {
+        if (known.insert(diaryRowKey(movie)).second) {
+            movies.push_back(movie);
+        }
+    }
+    return movies.size() - before;
+}
+
+// Score added to films on the user's watchlist, so they surface among close candidates
+// without pushing out films the model is much more confident about
+const float WATCHLIST_BOOST = 0.5f;
+
+// Function to mark the films of a Letterboxd watchlist export in a model film bitmap.
+// Returns the number of watchlist rows found in the model.
+size_t loadWatchlistBitmap(const string& filename, const ModelView& view,
+    const unordered_map<string, uint32_t>& filmIndex, vector<uint64_t>& bitmap) {
+    bitmap.assign((view.numFilms + 63) / 64, 0);
+
+    // watchlist.csv shares its leading columns (Date,Name,Year,Letterboxd URI) with diary.csv
+    size_t matched = 0;
+    for (const Movie& movie : readLetterboxdCSV(filename, false)) {
+        auto it = filmIndex.find(filmKeyFor(movie));
+        if (it == filmIndex.end()) continue;
+        bitmap[it->second >> 6] |= 1ull << (it->second & 63);
+        matched++;
+    }
+    return matched;
+}
+
+// Function to find a folded-in user's best unwatched films. With a normalized model the
+// film bias is part of the score; the global mean and user bias don't change the order.
+// Watchlisted films are boosted by a bitmap check inside the same top-k pass.
+vector<ScoredFilm> recommendForFoldIn(const ModelView& view, const FoldInState& state, size_t count) {
+    const ScoringKernels& kernels = scoringKernels();
+    const float* user = state.userVector.data();
+    const uint64_t* watchlist = state.watchlistBitmap.empty() ? nullptr : state.watchlistBitmap.data();
+    if (view.filmBiases == nullptr && watchlist == nullptr && view.filmFactors != nullptr) {
+        return topKFilmsF32(kernels, user, view.filmFactors, view.numFilms, view.dims, count, state.watchedBitmap.data());
+    }
+    return selectTopK(view.numFilms, count, state.watchedBitmap.data(), [&](size_t f) {
+        float score = view.filmDot(kernels, user, f);
+        if (view.filmBiases != nullptr) score += view.filmBiases[f];
+        if (watchlist != nullptr && isFilmInBitmap(watchlist, f)) score += WATCHLIST_BOOST;
+        return score;
+        });
+}
+
+// Function to attribute a recommended film's score to the user's rated films. Since
+// u = (gram + lambda I)^-1 sum_j t_j v_j, the score v_f . u splits exactly into
+// t_j * (v_j . w) with w = (gram + lambda I)^-1 v_f; w comes from the Cholesky factor
+// the last solve left behind, so each explanation is two triangular solves and one
+// dot product per rated film. Returns the largest positive contributors first.
+vector<ScoredFilm> explainRecommendation(const ModelView& view, const FoldInState& state, size_t film, size_t count) {
+    size_t d = state.dims;
+    const vector<double>& lower = state.lower;
+    if (lower.size() != d * d) return {};
+
+    vector<float> scratch;
+    const float* v = view.filmVector(film, scratch);
+    vector<double> y(d);
+    for (size_t i = 0; i < d; i++) {
+        double sum = v[i];
+        for (size_t k = 0; k < i; k++) sum -= lower[i * d + k] * y[k];
+        y[i] = sum / lower[i * d + i];
+    }
+    vector<float> w(d);
+    for (size_t i = d; i-- > 0;) {
+        double sum = y[i];
+        for (size_t k = i + 1; k < d; k++) sum -= lower[k * d + i] * y[k];
+        y[i] = sum / lower[i * d + i];
+        w[i] = (float)y[i];
+    }
+
+    // Rewatched films have one row per rating, so contributions are summed per film
+    const ScoringKernels& kernels = scoringKernels();
+    unordered_map<uint32_t, float> byFilm;
+    for (size_t j = 0; j < state.ratedFilms.size(); j++) {
+        uint32_t rated = state.ratedFilms[j];
+        float target = state.ratedTargets[j] - (float)state.userBias;
+        byFilm[rated] += target * view.filmDot(kernels, w.data(), rated);
+    }
+
+    vector<ScoredFilm> heap;
+    heap.reserve(count);
+    for (const auto& entry : byFilm) {
+        if (entry.second > 0.0f) pushTopK(heap, count, entry.first, entry.second);
+    }
+    return finishTopK(heap);
+}
+
+// Function to print the top recommendations for a folded-in user, optionally with the
+// rated films that contributed most to each one and the keywords of the user's own
+// reviews of those films
+void printRecommendations(const ModelView& view, const FoldInState& state, size_t count, bool explain = false,
+    const unordered_map<uint32_t, vector<string>>* reviewKeywords = nullptr) {
+    vector<ScoredFilm> top = recommendForFoldIn(view, state, count);
+
+    for (size_t i = 0; i < top.size(); i++) {
+        cout << (i + 1) << ". " << view.filmKey(top[i].filmIndex);
+        if (!state.watchlistBitmap.empty() && isFilmInBitmap(state.watchlistBitmap.data(), top[i].filmIndex)) {
+            cout << " (on your watchlist)";
+        }
+        cout << endl;
+        if (!explain) continue;
+
+        vector<ScoredFilm> reasons = explainRecommendation(view, state, top[i].filmIndex, 3);
+        if (reasons.empty()) continue;
+        cout << "   Because you rated: ";
+        for (size_t r = 0; r < reasons.size(); r++) {
+            if (r > 0) cout << ", ";
+            cout << view.filmKey(reasons[r].filmIndex);
+            if (reviewKeywords == nullptr) continue;
+            auto words = reviewKeywords->find((uint32_t)reasons[r].filmIndex);
+            if (words == reviewKeywords->end() || words->second.empty()) continue;
+            cout << " (you wrote about ";
+            for (size_t w = 0; w < words->second.size(); w++) {
+                cout << (w > 0 ? ", " : "") << words->second[w];
+            }
+            cout << ")";
+        }
+        cout << endl;
+    }
+}
+
+// Function to summarize a user's taste as the film clusters their watches fall into,
+// each illustrated with films from the user's own history
+void printTasteProfile(const ModelView& view, const FoldInState& state) {
+    if (view.filmClusters == nullptr) return;
+
+    vector<vector<uint32_t>> watchedByCluster(view.numClusters);
+    size_t watched = 0;
+    for (size_t f = 0; f < view.numFilms; f++) {
+        if (isFilmInBitmap(state.watchedBitmap.data(), f)) {
+            watchedByCluster[view.filmClusters[f]].push_back((uint32_t)f);
+            watched++;
+        }
+    }
+    if (watched == 0) return;
+
+    vector<uint32_t> clusters(view.numClusters);
+    for (size_t c = 0; c < clusters.size(); c++) clusters[c] = (uint32_t)c;
+    sort(clusters.begin(), clusters.end(), [&](uint32_t a, uint32_t b) {
+        return watchedByCluster[a].size() > watchedByCluster[b].size();
+        });
+
+    cout << endl << "Your taste profile:" << endl;
+    for (size_t i = 0; i < clusters.size() && i < 3; i++) {
+        const vector<uint32_t>& films = watchedByCluster[clusters[i]];
+        if (films.empty()) break;
+
+        cout << "  " << (100 * films.size() / watched) << "% of your films, like ";
+        for (size_t j = 0; j < films.size() && j < 3; j++) {
+            cout << (j > 0 ? ", " : "") << view.filmKey(films[j]);
+        }
+        cout << endl;
+    }
+}
+
+// Function to get how uncertain the current user vector is along a film's vector:
+// v^T (gram + lambda I)^-1 v, computed as |L^-1 v|^2 from the last solve's factor
+double foldInUncertainty(const FoldInState& state, const float* v) {
+    size_t d = state.dims;
+    double total = 0.0;
+    vector<double> y(d);
+    for (size_t i = 0; i < d; i++) {
+        double sum = v[i];
+        for (size_t k = 0; k < i; k++) sum -= state.lower[i * d + k] * y[k];
+        y[i] = sum / state.lower[i * d + i];
+        total += y[i] * y[i];
+    }
+    return total;
+}
+
+// Function to pick the films worth asking about: the ones with the strongest
+// vectors, which are the films the model knows best
+vector<uint32_t> buildOnboardingPool(const ModelView& view, size_t poolSize) {
+    const ScoringKernels& kernels = scoringKernels();
+    vector<float> scratch;
+    vector<ScoredFilm> strongest = selectTopK(view.numFilms, poolSize, nullptr, [&](size_t f) {
+        const float* v = view.filmVector(f, scratch);
+        return kernels.dotF32(v, v, view.dims);
+        });
+
+    vector<uint32_t> pool;
+    for (const ScoredFilm& film : strongest) {
+        pool.push_back((uint32_t)film.filmIndex);
+    }
+    return pool;
+}
+
+// Function to choose the next question: the pool film whose rating would tell us the
+// most, i.e. the one the current user vector is least certain about. When the model
+// has film clusters, films from clusters already asked about are only used once
+// every cluster in the pool has had a turn, so the questions stay diverse.
+int pickOnboardingFilm(const ModelView& view, const FoldInState& state, const vector<uint32_t>& pool,
+    const vector<char>& askedClusters) {
+    bool freshClusterLeft = false;
+    if (view.filmClusters != nullptr) {
+        for (uint32_t film : pool) {
+            if (!isFilmInBitmap(state.watchedBitmap.data(), film) && !askedClusters[view.filmClusters[film]]) {
+                freshClusterLeft = true;
+                break;
+            }
+        }
+    }
+
+    int best = -1;
+    double bestUncertainty = -1.0;
+    vector<float> scratch;
+    for (uint32_t film : pool) {
+        if (isFilmInBitmap(state.watchedBitmap.data(), film)) continue;
+        if (freshClusterLeft && askedClusters[view.filmClusters[film]]) continue;
+        double uncertainty = foldInUncertainty(state, view.filmVector(film, scratch));
+        if (uncertainty > bestUncertainty) {
+            bestUncertainty = uncertainty;
+            best = (int)film;
+        }
+    }
+    return best;
+}
+
+// Function to onboard a user without a diary: ask about a few informative films,
+// folding each answer into a temporary user vector and refreshing recommendations
+void runOnboarding() {
+    cout << endl << "Enter the path to a trained model file: ";
+    string modelFile;
+    getline(cin, modelFile);
+    if (!modelFile.empty() && modelFile[0] == '"') {
+        modelFile = modelFile.substr(1, modelFile.length() - 2);
+    }
+
+    MappedModel model;
+    ModelView view;
+    if (!openModelFile(modelFile, ModelValidation::Lazy, model) || !loadModelView(model, view)) {
+        return;
+    }
+    if (view.filmKeyOffsets == nullptr) {
+        cerr << "Error: Model has no film names to ask about" << endl;
+        return;
+    }
+
+    const size_t maxQuestions = 15;
+    const size_t poolSize = 2000;
+
+    FoldInState state;
+    initFoldIn(state, view, 0.1);
+    solveFoldIn(state);
+    vector<uint32_t> pool = buildOnboardingPool(view, poolSize);
+    vector<char> askedClusters(view.numClusters, 0);
+
+    cout << endl << "Rate each film from 0.5 to 5, press Enter if you haven't seen it," << endl;
+    cout << "or type Q to stop." << endl;
+
+    for (size_t question = 0; question < maxQuestions; question++) {
+        int film = pickOnboardingFilm(view, state, pool, askedClusters);
+        if (film < 0) break;
+        if (view.filmClusters != nullptr) {
+            askedClusters[view.filmClusters[film]] = 1;
+        }
+
+        cout << endl << "Have you seen " << view.filmKey(film) << "? Rating: ";
+        string answer;
+        getline(cin, answer);
+        if (answer == "Q" || answer == "q") break;
+
+        // Never ask about (or recommend) the same film twice
+        double rating = min(5.0, safeStringToDouble(trim(answer)));
+        addFoldInRow(state, view, film, rating);
+        if (rating <= 0.0) continue;
+
+        auto start = chrono::steady_clock::now();
+        solveFoldIn(state);
+        vector<ScoredFilm> top = recommendForFoldIn(view, state, 5);
+        auto end = chrono::steady_clock::now();
+
+        cout << "Recommendations so far (" << view.numFilms << " films scored in "
+            << chrono::duration<double, milli>(end - start).count() << " ms):" << endl;
+        for (size_t i = 0; i < top.size(); i++) {
+            cout << "  " << (i + 1) << ". " << view.filmKey(top[i].filmIndex) << endl;
+        }
+    }
+
+    if (state.ratedCount == 0) {
+        cout << endl << "No ratings given, so there is nothing to recommend from yet." << endl;
+        return;
+    }
+
+    solveFoldIn(state);
+    cout << endl << "Based on your " << state.ratedCount << " ratings, you might like:" << endl;
+    printRecommendations(view, state, 10);
+}
+
+// Function to print a model file's header and section table
+void printModelInfo(const string& filename) {
+    MappedModel model;
+    if (!openModelFile(filename, ModelValidation::Full, model)) return;
+
+    cout << "Model file: " << filename << endl;
+    cout << "  Version " << model.header->version << ", " << model.size << " bytes, "
+        << model.header->sectionCount << " sections (all checksums ok)" << endl;
+    for (uint32_t i = 0; i < model.header->sectionCount; i++) {
+        const ModelSectionEntry& entry = model.sections[i];
+        cout << "  section " << entry.id << ": " << entry.rows << " x " << entry.cols
+            << " (type " << entry.elementType << "), " << entry.byteSize << " bytes at offset " << entry.offset << endl;
+    }
+}
+
+// Function to run body(item) for every item in [0, count) across worker threads.
+// Items are handed out dynamically, so results must depend only on the item, never
+// on which thread ran it or in what order.
+void parallelFor(size_t count, unsigned threads, const function<void(size_t)>& body) {
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    threads = (unsigned)min<size_t>(threads, count);
+
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; i++) body(i);
+        return;
+    }
+
+    atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+            body(i);
+        }
+    };
+
+    vector<thread> pool;
+    for (unsigned t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : pool) t.join();
+}
+
+// Counter-based random stream (Philox4x32-10). A stream is fully determined by
+// (seed, epoch, item), so any thread can reproduce any work item's draws.
+struct PhiloxStream {
+    uint32_t key[2];
+    uint32_t counter[4];
+    uint32_t block[4];
+    int used = 4;
+
+    PhiloxStream(uint64_t seed, uint32_t epoch, uint64_t item) {
+        key[0] = (uint32_t)seed;
+        key[1] = (uint32_t)(seed >> 32);
+        counter[0] = 0;
+        counter[1] = epoch;
+        counter[2] = (uint32_t)item;
+        counter[3] = (uint32_t)(item >> 32);
+    }
+
+    void refill() {
+        uint32_t c[4] = { counter[0], counter[1], counter[2], counter[3] };
+        uint32_t k0 = key[0];
+        uint32_t k1 = key[1];
+        for (int round = 0; round < 10; round++) {
+            uint64_t p0 = (uint64_t)0xD2511F53u * c[0];
+            uint64_t p1 = (uint64_t)0xCD9E8D57u * c[2];
+            uint32_t next[4] = {
+                (uint32_t)(p1 >> 32) ^ c[1] ^ k0,
+                (uint32_t)p1,
+                (uint32_t)(p0 >> 32) ^ c[3] ^ k1,
+                (uint32_t)p0
+            };
+            memcpy(c, next, sizeof(c));
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+        memcpy(block, c, sizeof(block));
+        counter[0]++;
+        used = 0;
+    }
+
+    uint32_t nextU32() {
+        if (used == 4) refill();
+        return block[used++];
+    }
+
+    // Uniform in [0, 1)
+    float uniform() {
+        return (nextU32() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // Uniform integer in [0, bound)
+    uint32_t below(uint32_t bound) {
+        return (uint32_t)(((uint64_t)nextU32() * bound) >> 32);
+    }
+
+    float normal() {
+        float u1 = 1.0f - uniform();
+        float u2 = uniform();
+        return sqrt(-2.0f * log(u1)) * cos(6.2831853f * u2);
+    }
 };
 
-// Function to trim whitespace from string
-string trim(const string& str) {
-    size_t first = str.find_first_not_of(" \t\r\n\"");
-    if (string::npos == first) {
-        return "";
+// Function to count days from 1970-01-01 to a proleptic Gregorian date
+int32_t daysFromCivil(int year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yearOfEra = (unsigned)(year - era * 400);
+    unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + (int32_t)dayOfEra - 719468;
+}
+
+// Function to turn a day count from 1970-01-01 back into a date
+void civilFromDays(int32_t days, int& year, unsigned& month, unsigned& day) {
+    days += 719468;
+    int era = (days >= 0 ? days : days - 146096) / 146097;
+    unsigned dayOfEra = (unsigned)(days - era * 146097);
+    unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    unsigned mp = (5 * dayOfYear + 2) / 153;
+    day = dayOfYear - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = (int)yearOfEra + era * 400 + (month <= 2);
+}
+
+// Function to parse a Letterboxd "YYYY-MM-DD" date into a day number (NO_DAY if malformed)
+int32_t parseDayNumber(const string& date) {
+    if (date.size() < 10 || date[4] != '-' || date[7] != '-') return NO_DAY;
+    for (size_t i : { 0, 1, 2, 3, 5, 6, 8, 9 }) {
+        if (!isdigit((unsigned char)date[i])) return NO_DAY;
+    }
+    int year = stoi(date.substr(0, 4));
+    unsigned month = (unsigned)stoi(date.substr(5, 2));
+    unsigned day = (unsigned)stoi(date.substr(8, 2));
+    if (month < 1 || month > 12 || day < 1 || day > 31) return NO_DAY;
+    return daysFromCivil(year, month, day);
+}
+
+// Function to get today's day number (UTC)
+int32_t todayDayNumber() {
+    return (int32_t)(chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count() / 86400);
+}
+
+// Function to map a diary row's comma-separated tags to a 64-bit set of hashed tag bins
+uint64_t tagBinsFor(const string& tags) {
+    uint64_t bins = 0;
+    size_t start = 0;
+    while (start < tags.size()) {
+        size_t end = tags.find(',', start);
+        if (end == string::npos) end = tags.size();
+
+        string tag = trim(tags.substr(start, end - start));
+        transform(tag.begin(), tag.end(), tag.begin(), [](unsigned char c) { return (char)tolower(c); });
+        if (!tag.empty()) bins |= 1ull << (hashBytes(tag.data(), tag.size()) & 63);
+        start = end + 1;
+    }
+    return bins;
+}
+
+uint32_t internFilm(RatingCorpus& corpus, const string& key, uint16_t year) {
+    auto it = corpus.filmIndex.find(key);
+    if (it != corpus.filmIndex.end()) return it->second;
+
+    uint32_t id = (uint32_t)corpus.filmKeys.size();
+    corpus.filmKeys.push_back(key);
+    corpus.filmYears.push_back(year);
+    corpus.filmIndex.emplace(key, id);
+    return id;
+}
+
+// Function to append one user's diary rows to the corpus
+void addUserDiary(RatingCorpus& corpus, const string& userName, const vector<Movie>& movies) {
+    appendUserDiary(corpus, userName, movies, [&](const string& key, uint16_t year) {
+        return internFilm(corpus, key, year);
+        });
+}
+
+// Function to build the film-major copy of the ratings (a stable counting sort,
+// so the order within each film is by user)
+void buildFilmMajorIndex(RatingCorpus& corpus) {
+    size_t numFilms = corpus.numFilms();
+    corpus.filmOffsets.assign(numFilms + 1, 0);
+    for (uint32_t film : corpus.userFilms) {
+        corpus.filmOffsets[film + 1]++;
+    }
+    for (size_t f = 0; f < numFilms; f++) {
+        corpus.filmOffsets[f + 1] += corpus.filmOffsets[f];
+    }
+
+    vector<uint64_t> cursor(corpus.filmOffsets.begin(), corpus.filmOffsets.end() - 1);
+    corpus.filmUsers.resize(corpus.userFilms.size());
+    corpus.filmHalfStars.resize(corpus.userFilms.size());
+    for (size_t u = 0; u < corpus.numUsers(); u++) {
+        for (uint64_t i = corpus.userOffsets[u]; i < corpus.userOffsets[u + 1]; i++) {
+            uint64_t slot = cursor[corpus.userFilms[i]]++;
+            corpus.filmUsers[slot] = (uint32_t)u;
+            corpus.filmHalfStars[slot] = corpus.userHalfStars[i];
+        }
+    }
+}
+
+// Function to fill a profile's activity fields: streaks, binge days, gaps and the
+// weekday and month heatmaps. Diaries are almost always in date order already, so
+// the days are only sorted when they aren't; the rest is a single linear pass.
+void computeActivityProfile(const RatingCorpus& corpus, size_t user, float* profile) {
+    vector<int32_t> days;
+    for (uint64_t i = corpus.userOffsets[user]; i < corpus.userOffsets[user + 1]; i++) {
+        if (corpus.userRowDays[i] != NO_DAY) days.push_back(corpus.userRowDays[i]);
+    }
+    if (days.empty()) return;
+    if (!is_sorted(days.begin(), days.end())) sort(days.begin(), days.end());
+
+    int32_t previous = NO_DAY;
+    int filmsThatDay = 0;
+    int streak = 0;
+    size_t activeDays = 0, bingeDays = 0;
+    int longestStreak = 0, mostInADay = 0, longestGap = 0;
+    int32_t heatmapDay = NO_DAY;
+    size_t weekday = 0, month = 0;
+    for (size_t i = 0; i <= days.size(); i++) {
+        if (i < days.size()) {
+            // Weekday and month only change with the day; 1970-01-01 was a Thursday
+            if (days[i] != heatmapDay) {
+                heatmapDay = days[i];
+                weekday = (size_t)((heatmapDay % 7 + 10) % 7);
+                int year;
+                unsigned civilMonth, civilDay;
+                civilFromDays(heatmapDay, year, civilMonth, civilDay);
+                month = civilMonth - 1;
+            }
+            profile[PROFILE_WEEKDAYS + weekday] += 1.0f;
+            profile[PROFILE_MONTHS + month] += 1.0f;
+        }
+        if (i < days.size() && days[i] == previous) {
+            filmsThatDay++;
+            continue;
+        }
+        if (previous != NO_DAY) {
+            if (filmsThatDay >= PROFILE_BINGE_FILMS) bingeDays++;
+            mostInADay = max(mostInADay, filmsThatDay);
+        }
+        if (i == days.size()) break;
+
+        int32_t day = days[i];
+        if (previous != NO_DAY && day == previous + 1) {
+            streak++;
+        }
+        else {
+            if (previous != NO_DAY) longestGap = max(longestGap, day - previous - 1);
+            streak = 1;
+        }
+        longestStreak = max(longestStreak, streak);
+        activeDays++;
+        filmsThatDay = 1;
+        previous = day;
+    }
+
+    profile[PROFILE_ACTIVE_DAYS] = (float)activeDays;
+    profile[PROFILE_LONGEST_STREAK] = (float)longestStreak;
+    profile[PROFILE_LAST_STREAK] = (float)streak;
+    profile[PROFILE_LAST_ACTIVE_DAY] = (float)previous;
+    profile[PROFILE_BINGE_DAYS] = (float)bingeDays;
+    profile[PROFILE_MOST_IN_A_DAY] = (float)mostInADay;
+    profile[PROFILE_LONGEST_GAP] = (float)longestGap;
+    for (size_t b = 0; b < 7; b++) profile[PROFILE_WEEKDAYS + b] /= days.size();
+    for (size_t b = 0; b < 12; b++) profile[PROFILE_MONTHS + b] /= days.size();
+}
+
+// Function to compute one user's profile row from their corpus rows
+void computeUserProfile(const RatingCorpus& corpus, size_t user, float* profile) {
+    fill(profile, profile + PROFILE_WIDTH, 0.0f);
+
+    uint64_t begin = corpus.userOffsets[user];
+    uint64_t end = corpus.userOffsets[user + 1];
+    size_t watched = (size_t)(end - begin);
+    if (watched == 0) return;
+
+    size_t rated = 0;
+    size_t rewatches = 0;
+    double sum = 0.0;
+    double sumSquares = 0.0;
+    size_t datedRows = 0;
+
+    for (uint64_t i = begin; i < end; i++) {
+        uint8_t halfStars = corpus.userHalfStars[i];
+        if (halfStars > 0) {
+            rated++;
+            sum += halfStars * 0.5;
+            sumSquares += (halfStars * 0.5) * (halfStars * 0.5);
+            profile[PROFILE_RATING_OFFSETS + halfStars - 1] += 1.0f;
+        }
+        if (corpus.userRowFlags[i] & ROW_REWATCH) rewatches++;
+
+        for (uint64_t bins = corpus.userRowTagBins[i]; bins != 0; bins &= bins - 1) {
+            profile[PROFILE_TAGS + countTrailingZeros(bins)] += 1.0f;
+        }
+
+        uint16_t year = corpus.filmYears[corpus.userFilms[i]];
+        if (year != 0) {
+            int decade = min((int)PROFILE_DECADES - 1, max(0, (year - PROFILE_FIRST_DECADE) / 10));
+            profile[PROFILE_ERAS + decade] += 1.0f;
+            datedRows++;
+        }
+    }
+
+    profile[PROFILE_WATCHED] = (float)watched;
+    profile[PROFILE_RATED] = (float)rated;
+    profile[PROFILE_REWATCH_SHARE] = (float)rewatches / watched;
+    if (rated > 0) {
+        double mean = sum / rated;
+        profile[PROFILE_MEAN_RATING] = (float)mean;
+        profile[PROFILE_RATING_STDDEV] = (float)sqrt(max(0.0, sumSquares / rated - mean * mean));
+        for (size_t b = 0; b < 10; b++) profile[PROFILE_RATING_OFFSETS + b] /= rated;
+    }
+    for (size_t b = 0; b < PROFILE_TAG_BINS; b++) profile[PROFILE_TAGS + b] /= watched;
+    for (size_t d = 0; d < PROFILE_DECADES && datedRows > 0; d++) profile[PROFILE_ERAS + d] /= datedRows;
+
+    computeActivityProfile(corpus, user, profile);
+}
+
+// Function to compute every user's profile in parallel (numUsers x PROFILE_WIDTH)
+vector<float> computeUserProfiles(const RatingCorpus& corpus, unsigned threads) {
+    vector<float> profiles(corpus.numUsers() * PROFILE_WIDTH);
+    parallelFor(corpus.numUsers(), threads, [&](size_t user) {
+        computeUserProfile(corpus, user, &profiles[user * PROFILE_WIDTH]);
+        });
+    return profiles;
+}
+
+// Function to compute the profiles of users added since the corpus's profiles were
+// last filled (all of them, for a corpus read from diaries), leaving the rest as is
+void ensureUserProfiles(RatingCorpus& corpus, unsigned threads) {
+    size_t known = corpus.userProfiles.size() / PROFILE_WIDTH;
+    if (known >= corpus.numUsers()) return;
+    corpus.userProfiles.resize(corpus.numUsers() * PROFILE_WIDTH);
+    parallelFor(corpus.numUsers() - known, threads, [&](size_t i) {
+        computeUserProfile(corpus, known + i, &corpus.userProfiles[(known + i) * PROFILE_WIDTH]);
+        });
+}
+
+// Function to print the watching streaks, binges and busiest times cached in a profile
+void printActivityStats(const float* profile) {
+    static const char* weekdayNames[] = { "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday", "Sunday" };
+    static const char* monthNames[] = { "January", "February", "March", "April", "May", "June", "July",
+        "August", "September", "October", "November", "December" };
+    if (profile[PROFILE_ACTIVE_DAYS] == 0.0f) return;
+
+    cout << "Days with a watch: " << (int)profile[PROFILE_ACTIVE_DAYS]
+        << " (longest streak " << (int)profile[PROFILE_LONGEST_STREAK] << " days)" << endl;
+    int32_t sinceLastWatch = todayDayNumber() - (int32_t)profile[PROFILE_LAST_ACTIVE_DAY];
+    if (sinceLastWatch <= 1) {
+        cout << "Current streak: " << (int)profile[PROFILE_LAST_STREAK] << " days" << endl;
+    }
+    if (profile[PROFILE_BINGE_DAYS] > 0.0f) {
+        cout << "Binge days (" << PROFILE_BINGE_FILMS << "+ films): " << (int)profile[PROFILE_BINGE_DAYS]
+            << " (most in one day: " << (int)profile[PROFILE_MOST_IN_A_DAY] << ")" << endl;
+    }
+    if (profile[PROFILE_LONGEST_GAP] > 0.0f) {
+        cout << "Longest break: " << (int)profile[PROFILE_LONGEST_GAP] << " days" << endl;
+    }
+
+    const float* weekdays = profile + PROFILE_WEEKDAYS;
+    const float* months = profile + PROFILE_MONTHS;
+    cout << "Busiest weekday: " << weekdayNames[max_element(weekdays, weekdays + 7) - weekdays]
+        << ", busiest month: " << monthNames[max_element(months, months + 12) - months] << endl;
+}
+
+// Function to get the decade a profile has the most watches in (0 if none)
+int favouriteDecade(const float* profile) {
+    const float* eras = profile + PROFILE_ERAS;
+    size_t best = max_element(eras, eras + PROFILE_DECADES) - eras;
+    if (eras[best] == 0.0f) return 0;
+    return PROFILE_FIRST_DECADE + (int)best * 10;
+}
+
+// Function to analyse one user's rewatches. Dated rows are grouped per film with a
+// counting sort and each film's events sorted by day; every statistic is then one
+// linear pass over a film's events.
+RewatchAnalytics analyzeRewatches(const RatingCorpus& corpus, size_t user) {
+    RewatchAnalytics analytics;
+    uint64_t begin = corpus.userOffsets[user];
+    uint64_t end = corpus.userOffsets[user + 1];
+
+    unordered_map<uint32_t, uint32_t> localIds;
+    vector<uint32_t> localFilms;
+    vector<uint32_t> offsets = { 0 };
+    double ratingSum = 0.0;
+    size_t rated = 0;
+    for (uint64_t i = begin; i < end; i++) {
+        if (corpus.userHalfStars[i] > 0) {
+            ratingSum += corpus.userHalfStars[i] * 0.5;
+            rated++;
+        }
+        if (corpus.userRowDays[i] == NO_DAY) continue;
+        auto inserted = localIds.emplace(corpus.userFilms[i], (uint32_t)localFilms.size());
+        if (inserted.second) {
+            localFilms.push_back(corpus.userFilms[i]);
+            offsets.push_back(0);
+        }
+        offsets[inserted.first->second + 1]++;
+    }
+    double userMean = rated > 0 ? ratingSum / rated : 0.0;
+
+    for (size_t f = 0; f < localFilms.size(); f++) offsets[f + 1] += offsets[f];
+    vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    vector<pair<int32_t, uint8_t>> events(offsets.back());     // (day, half stars)
+    for (uint64_t i = begin; i < end; i++) {
+        if (corpus.userRowDays[i] == NO_DAY) continue;
+        events[cursor[localIds[corpus.userFilms[i]]]++] = { corpus.userRowDays[i], corpus.userHalfStars[i] };
+    }
+
+    for (size_t f = 0; f < localFilms.size(); f++) {
+        uint32_t count = offsets[f + 1] - offsets[f];
+        if (count < 2) continue;
+        pair<int32_t, uint8_t>* first = events.data() + offsets[f];
+        sort(first, first + count);
+
+        FilmRewatchStats stats;
+        stats.film = localFilms[f];
+        stats.watches = count;
+        stats.firstDay = first[0].first;
+        stats.lastDay = first[count - 1].first;
+        stats.meanInterval = (float)(stats.lastDay - stats.firstDay) / (count - 1);
+
+        // Time of year as an angle, averaged on the circle so December and January are neighbours
+        double x = 0.0, y = 0.0, halfStars = 0.0;
+        size_t ratedWatches = 0;
+        for (uint32_t e = 0; e < count; e++) {
+            int year;
+            unsigned month, day;
+            civilFromDays(first[e].first, year, month, day);
+            double angle = TWO_PI * (first[e].first - daysFromCivil(year, 1, 1)) / 365.25;
+            x += cos(angle);
+            y += sin(angle);
+            if (first[e].second > 0) {
+                halfStars += first[e].second;
+                ratedWatches++;
+            }
+        }
+        stats.seasonality = (float)(sqrt(x * x + y * y) / count);
+        double meanAngle = atan2(y, x);
+        if (meanAngle < 0.0) meanAngle += TWO_PI;
+        stats.peakDayOfYear = (int32_t)(meanAngle / (TWO_PI) * 365.25);
+        stats.meanRating = ratedWatches > 0 ? (float)(halfStars * 0.5 / ratedWatches) : 0.0f;
+
+        stats.comfort = count >= COMFORT_MIN_WATCHES && (ratedWatches == 0 || stats.meanRating >= userMean);
+
+        stats.seasonal = count >= COMFORT_MIN_WATCHES && stats.seasonality >= SEASONAL_THRESHOLD
+            && stats.lastDay - stats.firstDay >= SEASONAL_MIN_SPAN_DAYS;
+        if (stats.seasonal) {
+            // The same time of year, at least half a year after the last watch
+            int year;
+            unsigned month, day;
+            civilFromDays(stats.lastDay + 182, year, month, day);
+            stats.dueDay = daysFromCivil(year, 1, 1) + stats.peakDayOfYear;
+            if (stats.dueDay < stats.lastDay + 182) stats.dueDay = daysFromCivil(year + 1, 1, 1) + stats.peakDayOfYear;
+        }
+        else {
+            stats.dueDay = stats.lastDay + max(1, (int32_t)lround(stats.meanInterval));
+        }
+        analytics.films.push_back(stats);
+    }
+
+    analytics.byDueDay.resize(analytics.films.size());
+    for (size_t i = 0; i < analytics.byDueDay.size(); i++) analytics.byDueDay[i] = (uint32_t)i;
+    sort(analytics.byDueDay.begin(), analytics.byDueDay.end(), [&](uint32_t a, uint32_t b) {
+        return analytics.films[a].dueDay != analytics.films[b].dueDay
+            ? analytics.films[a].dueDay < analytics.films[b].dueDay : a < b;
+        });
+    return analytics;
+}
+
+// Function to list the films due for a rewatch by a given day, most recently due first.
+// Comfort films come first; films that fell out of rotation long ago sink to the end.
+vector<const FilmRewatchStats*> dueForRewatch(const RewatchAnalytics& analytics, int32_t today, size_t count) {
+    auto due = upper_bound(analytics.byDueDay.begin(), analytics.byDueDay.end(), today, [&](int32_t day, uint32_t i) {
+        return day < analytics.films[i].dueDay;
+        });
+
+    vector<const FilmRewatchStats*> comfort, others;
+    for (auto it = due; it != analytics.byDueDay.begin() && comfort.size() < count;) {
+        const FilmRewatchStats& stats = analytics.films[*--it];
+        (stats.comfort ? comfort : others).push_back(&stats);
+    }
+    for (const FilmRewatchStats* stats : others) {
+        if (comfort.size() >= count) break;
+        comfort.push_back(stats);
+    }
+    return comfort;
+}
+
+// Function to print a diary's comfort films, seasonal rewatches and films due for a rewatch
+void printRewatchAnalytics(const RatingCorpus& corpus, size_t user) {
+    static const char* monthNames[] = { "January", "February", "March", "April", "May", "June", "July",
+        "August", "September", "October", "November", "December" };
+
+    RewatchAnalytics analytics = analyzeRewatches(corpus, user);
+    if (analytics.films.empty()) return;
+
+    vector<const FilmRewatchStats*> comfort;
+    for (const FilmRewatchStats& stats : analytics.films) {
+        if (stats.comfort) comfort.push_back(&stats);
+    }
+    sort(comfort.begin(), comfort.end(), [](const FilmRewatchStats* a, const FilmRewatchStats* b) {
+        return a->watches != b->watches ? a->watches > b->watches : a->film < b->film;
+        });
+    if (!comfort.empty()) {
+        cout << "Comfort films:" << endl;
+        for (size_t i = 0; i < comfort.size() && i < 5; i++) {
+            cout << "   " << corpus.filmKeys[comfort[i]->film] << ": " << comfort[i]->watches
+                << " watches, about every " << lround(comfort[i]->meanInterval) << " days" << endl;
+        }
+    }
+
+    for (const FilmRewatchStats& stats : analytics.films) {
+        if (!stats.seasonal) continue;
+        int year;
+        unsigned month, day;
+        civilFromDays(daysFromCivil(2001, 1, 1) + stats.peakDayOfYear, year, month, day);
+        cout << "Seasonal rewatch: " << corpus.filmKeys[stats.film] << " (usually in " << monthNames[month - 1] << ")" << endl;
+    }
+
+    vector<const FilmRewatchStats*> due = dueForRewatch(analytics, todayDayNumber(), 5);
+    if (!due.empty()) {
+        cout << "Due for a rewatch:" << endl;
+        for (const FilmRewatchStats* stats : due) {
+            int year;
+            unsigned month, day;
+            civilFromDays(stats->lastDay, year, month, day);
+            cout << "   " << corpus.filmKeys[stats->film] << " (last watched " << monthNames[month - 1] << " " << year << ")" << endl;
+        }
+    }
+}
+
+// Function to split ratings into global mean + user bias + film bias and a residual
+// divided by the user's scale (how widely they spread their ratings). The biases are
+// fitted with a few alternating passes; each pass is parallel over users or films,
+// with every item writing only its own bias. Residuals are stored next to the raw
+// half stars in both row orders, so training consumes normalized ratings directly.
+void normalizeRatings(RatingCorpus& corpus, unsigned threads, int passes) {
+    size_t numUsers = corpus.numUsers();
+    size_t numFilms = corpus.numFilms();
+
+    double sum = 0.0;
+    size_t rated = 0;
+    for (uint8_t halfStars : corpus.userHalfStars) {
+        if (halfStars > 0) {
+            sum += halfStars * 0.5;
+            rated++;
+        }
+    }
+    corpus.globalMean = rated > 0 ? (float)(sum / rated) : 0.0f;
+    corpus.userBias.assign(numUsers, 0.0f);
+    corpus.userScale.assign(numUsers, 1.0f);
+    corpus.filmBias.assign(numFilms, 0.0f);
+
+    for (int pass = 0; pass < passes; pass++) {
+        parallelFor(numFilms, threads, [&](size_t f) {
+            double total = 0.0;
+            size_t count = 0;
+            for (uint64_t i = corpus.filmOffsets[f]; i < corpus.filmOffsets[f + 1]; i++) {
+                if (corpus.filmHalfStars[i] == 0) continue;
+                total += corpus.filmHalfStars[i] * 0.5 - corpus.globalMean - corpus.userBias[corpus.filmUsers[i]];
+                count++;
+            }
+            corpus.filmBias[f] = (float)(total / (FILM_BIAS_SHRINKAGE + count));
+            });
+
+        parallelFor(numUsers, threads, [&](size_t u) {
+            double total = 0.0;
+            size_t count = 0;
+            for (uint64_t i = corpus.userOffsets[u]; i < corpus.userOffsets[u + 1]; i++) {
+                if (corpus.userHalfStars[i] == 0) continue;
+                total += corpus.userHalfStars[i] * 0.5 - corpus.globalMean - corpus.filmBias[corpus.userFilms[i]];
+                count++;
+            }
+            corpus.userBias[u] = (float)(total / (USER_BIAS_SHRINKAGE + count));
+            });
+    }
+
+    // Per-user scale and residuals in user order
+    corpus.userResiduals.assign(corpus.userHalfStars.size(), 0.0f);
+    parallelFor(numUsers, threads, [&](size_t u) {
+        double squares = 0.0;
+        size_t count = 0;
+        for (uint64_t i = corpus.userOffsets[u]; i < corpus.userOffsets[u + 1]; i++) {
+            if (corpus.userHalfStars[i] == 0) continue;
+            double residual = corpus.userHalfStars[i] * 0.5 - corpus.globalMean - corpus.userBias[u] -
+                corpus.filmBias[corpus.userFilms[i]];
+            corpus.userResiduals[i] = (float)residual;
+            squares += residual * residual;
+            count++;
+        }
+
+        float scale = (float)sqrt((squares + USER_SCALE_SHRINKAGE) / (count + USER_SCALE_SHRINKAGE));
+        corpus.userScale[u] = scale;
+        for (uint64_t i = corpus.userOffsets[u]; i < corpus.userOffsets[u + 1]; i++) {
+            corpus.userResiduals[i] /= scale;
+        }
+        });
+
+    // Same residuals in film order, following buildFilmMajorIndex's stable layout
+    vector<uint64_t> cursor(corpus.filmOffsets.begin(), corpus.filmOffsets.end() - 1);
+    corpus.filmResiduals.resize(corpus.userResiduals.size());
+    for (size_t u = 0; u < numUsers; u++) {
+        for (uint64_t i = corpus.userOffsets[u]; i < corpus.userOffsets[u + 1]; i++) {
+            corpus.filmResiduals[cursor[corpus.userFilms[i]]++] = corpus.userResiduals[i];
+        }
+    }
+}
+
+// Rows per work item. Fixed (not derived from the thread count) so every run
+// partitions the work identically.
+const size_t TRAINING_BLOCK_SIZE = 256;
+
+// Function to run SGD over one side of the factorization: every row's vector is
+// updated against the other side's fixed vectors, visiting its ratings in an order
+// drawn from the row's own random stream. Returns the squared error per block.
+vector<double> sgdHalfEpoch(const vector<uint64_t>& offsets, const vector<uint32_t>& others,
+    const vector<uint8_t>& halfStars, const vector<float>& targets, vector<float>& rows, const vector<float>& fixed,
+    const TrainingOptions& options, uint32_t streamEpoch) {
+    size_t numRows = offsets.size() - 1;
+    size_t numBlocks = (numRows + TRAINING_BLOCK_SIZE - 1) / TRAINING_BLOCK_SIZE;
+    size_t d = options.dims;
+    vector<double> blockError(numBlocks, 0.0);
+    auto dot = scoringKernels().dotF32;
+
+    parallelFor(numBlocks, options.threads, [&](size_t block) {
+        vector<uint64_t> order;
+        double error = 0.0;
+        size_t end = min(numRows, (block + 1) * TRAINING_BLOCK_SIZE);
+
+        for (size_t r = block * TRAINING_BLOCK_SIZE; r < end; r++) {
+            order.clear();
+            for (uint64_t i = offsets[r]; i < offsets[r + 1]; i++) {
+                if (halfStars[i] > 0) order.push_back(i);
+            }
+
+            PhiloxStream rng(options.seed, streamEpoch, r);
+            for (size_t i = order.size(); i > 1; i--) {
+                swap(order[i - 1], order[rng.below((uint32_t)i)]);
+            }
+
+            float* x = &rows[r * d];
+            for (uint64_t i : order) {
+                const float* y = &fixed[(size_t)others[i] * d];
+                float residual = targets[i] - dot(x, y, d);
+                error += (double)residual * residual;
+                for (size_t k = 0; k < d; k++) {
+                    x[k] += options.learningRate * (residual * y[k] - options.lambda * x[k]);
+                }
+            }
+        }
+        blockError[block] = error;
+        });
+
+    return blockError;
+}
+
+// Function to factorize the corpus's normalized ratings (normalizeRatings must have
+// run first). Runs with the same seed produce
+// bit-identical factors whatever the thread count: random draws come from
+// (seed, epoch, row) streams, the work partition is fixed, each phase only writes
+// its own rows, and errors are summed block by block in order.
+TrainedFactors trainFactorization(const RatingCorpus& corpus, const TrainingOptions& options) {
+    TrainedFactors factors;
+    size_t d = options.dims;
+    factors.dims = d;
+    factors.userFactors.resize(corpus.numUsers() * d);
+    factors.filmFactors.resize(corpus.numFilms() * d);
+
+    // Small random start, drawn from a stream reserved for initialization
+    const uint32_t INIT_EPOCH = 0xFFFFFFFFu;
+    float initScale = 0.1f / sqrt((float)d);
+    parallelFor(corpus.numUsers(), options.threads, [&](size_t u) {
+        PhiloxStream rng(options.seed, INIT_EPOCH, u);
+        for (size_t k = 0; k < d; k++) factors.userFactors[u * d + k] = rng.normal() * initScale;
+        });
+    parallelFor(corpus.numFilms(), options.threads, [&](size_t f) {
+        PhiloxStream rng(options.seed, INIT_EPOCH, corpus.numUsers() + f);
+        for (size_t k = 0; k < d; k++) factors.filmFactors[f * d + k] = rng.normal() * initScale;
+        });
+
+    size_t ratedCount = 0;
+    for (uint8_t halfStars : corpus.userHalfStars) {
+        if (halfStars > 0) ratedCount++;
+    }
+
+    // Epoch lines use four decimals; the caller's stream format is put back afterwards
+    ios::fmtflags savedFlags = cout.flags();
+    streamsize savedPrecision = cout.precision(4);
+    cout << fixed;
+    for (int epoch = 0; epoch < options.epochs; epoch++) {
+        auto start = chrono::steady_clock::now();
+
+        vector<double> userError = sgdHalfEpoch(corpus.userOffsets, corpus.userFilms, corpus.userHalfStars, corpus.userResiduals,
+            factors.userFactors, factors.filmFactors, options, 2 * (uint32_t)epoch);
+        sgdHalfEpoch(corpus.filmOffsets, corpus.filmUsers, corpus.filmHalfStars, corpus.filmResiduals,
+            factors.filmFactors, factors.userFactors, options, 2 * (uint32_t)epoch + 1);
+
+        double totalError = 0.0;
+        for (double blockError : userError) totalError += blockError;
+
+        auto end = chrono::steady_clock::now();
+        cout << "Epoch " << (epoch + 1) << ": normalized RMSE " << sqrt(totalError / max<size_t>(1, ratedCount))
+            << " (" << chrono::duration<double, milli>(end - start).count() << " ms)" << endl;
+    }
+    cout.flags(savedFlags);
+    cout.precision(savedPrecision);
+
+    return factors;
+}
+
+// Function to export trained factors and film keys as a model file
+bool writeTrainedModel(const string& filename, const RatingCorpus& corpus, const TrainedFactors& factors) {
+    vector<uint64_t> keyOffsets = { 0 };
+    vector<char> keyBytes;
+    for (const string& key : corpus.filmKeys) {
+        keyBytes.insert(keyBytes.end(), key.begin(), key.end());
+        keyOffsets.push_back(keyBytes.size());
+    }
+
+    vector<float> globalMean = { corpus.globalMean };
+    vector<float> userBiases(corpus.numUsers() * 2);
+    for (size_t u = 0; u < corpus.numUsers(); u++) {
+        userBiases[u * 2] = corpus.userBias[u];
+        userBiases[u * 2 + 1] = corpus.userScale[u];
+    }
+
+    return writeModelFile(filename, {
+        modelSection(SECTION_FILM_FACTORS, ModelElementType::Float32, factors.filmFactors, (uint32_t)factors.dims),
+        modelSection(SECTION_USER_FACTORS, ModelElementType::Float32, factors.userFactors, (uint32_t)factors.dims),
+        modelSection(SECTION_FILM_KEY_OFFSETS, ModelElementType::UInt64, keyOffsets),
+        modelSection(SECTION_FILM_KEY_BYTES, ModelElementType::Bytes, keyBytes),
+        modelSection(SECTION_USER_PROFILES, ModelElementType::Float32, corpus.userProfiles, (uint32_t)PROFILE_WIDTH),
+        modelSection(SECTION_GLOBAL_MEAN, ModelElementType::Float32, globalMean),
+        modelSection(SECTION_FILM_BIASES, ModelElementType::Float32, corpus.filmBias),
+        modelSection(SECTION_USER_BIASES, ModelElementType::Float32, userBiases, 2)
+        });
+}
+
+// Function to train a model from several users' diary exports, or a corpus snapshot
+// from --bulk-import:
+//   --train <model file> (<diary.csv>... | --corpus=<snapshot>) [--seed=N] [--threads=N] [--dims=N] [--epochs=N]
+int runTrainCommand(const vector<string>& args) {
+    TrainingOptions options;
+    string snapshotFile;
+    vector<string> files;
+    for (const string& arg : args) {
+        if (arg.rfind("--corpus=", 0) == 0) snapshotFile = arg.substr(9);
+        else if (arg.rfind("--seed=", 0) == 0) options.seed = stoull(arg.substr(7));
+        else if (arg.rfind("--threads=", 0) == 0) options.threads = (unsigned)stoul(arg.substr(10));
+        else if (arg.rfind("--dims=", 0) == 0) options.dims = stoul(arg.substr(7));
+        else if (arg.rfind("--epochs=", 0) == 0) options.epochs = stoi(arg.substr(9));
+        else files.push_back(arg);
+    }
+    if (files.empty() || (files.size() < 2 && snapshotFile.empty()) || options.dims == 0) {
+        cerr << "Usage: --train <model file> (<diary.csv>... | --corpus=<snapshot>) [--seed=N] [--threads=N]" << endl;
+        cerr << "       [--dims=N] [--epochs=N]" << endl;
+        return 1;
+    }
+
+    RatingCorpus corpus;
+    if (!snapshotFile.empty() && !readCorpusSnapshot(snapshotFile, corpus)) return 1;
+    for (size_t i = 1; i < files.size(); i++) {
+        addUserDiary(corpus, files[i], readLetterboxdCSV(files[i], false));
+    }
+    buildFilmMajorIndex(corpus);
+    cout << "Corpus: " << corpus.numUsers() << " users, " << corpus.numFilms() << " films, "
+        << corpus.userFilms.size() << " diary rows" << endl;
+
+    // A snapshot's users keep their stored profiles; only diaries added here are scanned
+    ensureUserProfiles(corpus, options.threads);
+
+    auto start = chrono::steady_clock::now();
+    normalizeRatings(corpus, options.threads);
+    auto end = chrono::steady_clock::now();
+    cout << "Normalized ratings (global mean " << corpus.globalMean << ") in "
+        << chrono::duration<double, milli>(end - start).count() << " ms" << endl;
+
+    TrainedFactors factors = trainFactorization(corpus, options);
+
+    // Identical seeds must give identical checksums, whatever --threads says
+    uint32_t checksum = activeKernels().crc32c(0, factors.filmFactors.data(), factors.filmFactors.size() * sizeof(float));
+    checksum = activeKernels().crc32c(checksum, factors.userFactors.data(), factors.userFactors.size() * sizeof(float));
+    cout << "Factor checksum: " << hex << checksum << dec << " (seed " << options.seed
+        << ", kernels " << scoringKernels().name << ")" << endl;
+
+    if (!writeTrainedModel(files[0], corpus, factors)) return 1;
+    cout << "Model written to " << files[0] << endl;
+    return 0;
+}
+
+// Function to list a mapped model's sections so they can be written out again,
+// leaving out the ones about to be replaced
+vector<ModelSectionData> existingModelSections(const MappedModel& model, const vector<uint32_t>& replacedIds) {
+    vector<ModelSectionData> sections;
+    for (uint32_t i = 0; i < model.header->sectionCount; i++) {
+        const ModelSectionEntry& entry = model.sections[i];
+        if (find(replacedIds.begin(), replacedIds.end(), entry.id) != replacedIds.end()) continue;
+        sections.push_back({ entry.id, (ModelElementType)entry.elementType, entry.rows, entry.cols,
+            model.base + entry.offset, entry.byteSize });
+    }
+    return sections;
+}
+
+// Function to rewrite a model's user and film factors at another precision. Training
+// always runs in float32; this is the step that exports it for serving:
+//   --export-factors <model file> <output model file> [--format=f16|bf16|f32]
+int runExportFactorsCommand(const vector<string>& args) {
+    ModelElementType type = ModelElementType::Float16;
+    vector<string> files;
+    for (const string& arg : args) {
+        if (arg == "--format=f16") type = ModelElementType::Float16;
+        else if (arg == "--format=bf16") type = ModelElementType::BFloat16;
+        else if (arg == "--format=f32") type = ModelElementType::Float32;
+        else files.push_back(arg);
+    }
+    if (files.size() != 2) {
+        cerr << "Usage: --export-factors <model file> <output model file> [--format=f16|bf16|f32]" << endl;
+        return 1;
+    }
+
+    MappedModel model;
+    ModelView view;
+    if (!openModelFile(files[0], ModelValidation::Full, model) || !loadModelView(model, view)) {
+        return 1;
+    }
+
+    // Narrowing an already half-precision model starts from a widened copy
+    widenFactors(model, view);
+    auto encode = [&](const float* values, size_t count) {
+        vector<uint16_t> packed(count);
+        for (size_t i = 0; i < count; i++) {
+            packed[i] = type == ModelElementType::Float16 ? floatToHalf(values[i]) : floatToBfloat16(values[i]);
+        }
+        return packed;
+    };
+    vector<ModelSectionData> sections = existingModelSections(model, { SECTION_FILM_FACTORS, SECTION_USER_FACTORS });
+    vector<float> films, users;
+    vector<uint16_t> filmsHalf, usersHalf;
+    if (type == ModelElementType::Float32) {
+        films.assign(view.filmFactors, view.filmFactors + view.numFilms * view.dims);
+        sections.push_back(modelSection(SECTION_FILM_FACTORS, type, films, (uint32_t)view.dims));
+        if (view.userFactors != nullptr) {
+            users.assign(view.userFactors, view.userFactors + view.numUsers * view.dims);
+            sections.push_back(modelSection(SECTION_USER_FACTORS, type, users, (uint32_t)view.dims));
+        }
+    }
+    else {
+        filmsHalf = encode(view.filmFactors, view.numFilms * view.dims);
+        sections.push_back(modelSection(SECTION_FILM_FACTORS, type, filmsHalf, (uint32_t)view.dims));
+        if (view.userFactors != nullptr) {
+            usersHalf = encode(view.userFactors, view.numUsers * view.dims);
+            sections.push_back(modelSection(SECTION_USER_FACTORS, type, usersHalf, (uint32_t)view.dims));
+        }
+    }
+    if (!writeModelFile(files[1], sections)) return 1;
+
+    size_t elementBytes = modelElementSize(type);
+    cout << "Factors written to " << files[1] << " as " << (type == ModelElementType::Float16 ? "fp16" :
+        type == ModelElementType::BFloat16 ? "bf16" : "f32") << " ("
+        << ((view.numFilms + view.numUsers) * view.dims * elementBytes >> 10) << " KB)" << endl;
+    return 0;
+}
+
+// Function to find the nearest centroid. |x - c|^2 = |x|^2 + |c|^2 - 2 x.c, and |x|^2
+// is the same for every centroid, so only |c|^2 - 2 x.c is compared.
+uint32_t nearestCentroid(const ScoringKernels& kernels, const float* x, const float* centroids,
+    const float* centroidNorms, size_t numClusters, size_t dims) {
+    uint32_t best = 0;
+    float bestDistance = INFINITY;
+    for (size_t c = 0; c < numClusters; c++) {
+        float distance = centroidNorms[c] - 2.0f * kernels.dotF32(x, centroids + c * dims, dims);
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = (uint32_t)c;
+        }
+    }
+    return best;
+}
+
+vector<float> centroidSquaredNorms(const ScoringKernels& kernels, const vector<float>& centroids, size_t numClusters, size_t dims) {
+    vector<float> norms(numClusters);
+    for (size_t c = 0; c < numClusters; c++) {
+        norms[c] = kernels.dotF32(&centroids[c * dims], &centroids[c * dims], dims);
+    }
+    return norms;
+}
+
+// Function to pick initial centroids with k-means++ on a random sample of the points
+// (seeding on all points would cost as much as the clustering itself)
+vector<float> seedCentroidsPlusPlus(const float* points, size_t numPoints, size_t dims, const ClusteringOptions& options) {
+    const ScoringKernels& kernels = scoringKernels();
+    size_t k = options.clusters;
+    size_t sampleSize = min(numPoints, max<size_t>(k * 20, 10000));
+
+    // Sample without replacement via a partial Fisher-Yates shuffle
+    PhiloxStream rng(options.seed, 0xFFFFFFFEu, 0);
+    vector<uint32_t> indices(numPoints);
+    for (size_t i = 0; i < numPoints; i++) indices[i] = (uint32_t)i;
+    for (size_t i = 0; i < sampleSize; i++) {
+        swap(indices[i], indices[i + rng.below((uint32_t)(numPoints - i))]);
+    }
+    indices.resize(sampleSize);
+
+    vector<float> centroids(k * dims);
+    vector<float> minDistance(sampleSize, INFINITY);
+    const size_t chunk = 1024;
+    size_t numChunks = (sampleSize + chunk - 1) / chunk;
+    vector<double> chunkTotals(numChunks);
+
+    size_t chosen = indices[rng.below((uint32_t)sampleSize)];
+    for (size_t c = 0; c < k; c++) {
+        memcpy(&centroids[c * dims], points + chosen * dims, dims * sizeof(float));
+        const float* centroid = &centroids[c * dims];
+        float centroidNorm = kernels.dotF32(centroid, centroid, dims);
+
+        parallelFor(numChunks, options.threads, [&](size_t block) {
+            double total = 0.0;
+            for (size_t i = block * chunk; i < min(sampleSize, (block + 1) * chunk); i++) {
+                const float* x = points + (size_t)indices[i] * dims;
+                float distance = max(0.0f, kernels.dotF32(x, x, dims) + centroidNorm - 2.0f * kernels.dotF32(x, centroid, dims));
+                minDistance[i] = min(minDistance[i], distance);
+                total += minDistance[i];
+            }
+            chunkTotals[block] = total;
+            });
+
+        // Draw the next centroid with probability proportional to squared distance
+        double total = 0.0;
+        for (double chunkTotal : chunkTotals) total += chunkTotal;
+        double target = rng.uniform() * total;
+        chosen = indices[rng.below((uint32_t)sampleSize)];
+        for (size_t i = 0; i < sampleSize && total > 0.0; i++) {
+            target -= minDistance[i];
+            if (target <= 0.0) {
+                chosen = indices[i];
+                break;
+            }
+        }
+    }
+
+    return centroids;
+}
+
+// Function to cluster vectors with mini-batch k-means. Each iteration assigns a random
+// batch in parallel, then moves each centroid toward its batch mean with a step of
+// (batch count / total count), so centroids settle as they accumulate points.
+FilmClusters clusterFilms(const float* points, size_t numPoints, size_t dims, ClusteringOptions options) {
+    const ScoringKernels& kernels = scoringKernels();
+    FilmClusters result;
+    options.clusters = min(options.clusters, numPoints);
+    size_t k = options.clusters;
+    result.numClusters = k;
+    result.dims = dims;
+    if (k == 0) return result;
+
+    result.centroids = seedCentroidsPlusPlus(points, numPoints, dims, options);
+
+    vector<double> counts(k, 0.0);
+    vector<uint32_t> batch(options.batchSize);
+    vector<uint32_t> batchAssignments(options.batchSize);
+    vector<double> sums(k * dims);
+    vector<uint32_t> batchCounts(k);
+    const size_t chunk = 256;
+
+    for (int iteration = 0; iteration < options.iterations; iteration++) {
+        PhiloxStream rng(options.seed, (uint32_t)iteration, 0);
+        for (auto& index : batch) index = rng.below((uint32_t)numPoints);
+
+        vector<float> norms = centroidSquaredNorms(kernels, result.centroids, k, dims);
+        parallelFor((batch.size() + chunk - 1) / chunk, options.threads, [&](size_t block) {
+            for (size_t i = block * chunk; i < min(batch.size(), (block + 1) * chunk); i++) {
+                batchAssignments[i] = nearestCentroid(kernels, points + (size_t)batch[i] * dims,
+                    result.centroids.data(), norms.data(), k, dims);
+            }
+            });
+
+        // Accumulate in batch order so the update is deterministic
+        fill(sums.begin(), sums.end(), 0.0);
+        fill(batchCounts.begin(), batchCounts.end(), 0);
+        for (size_t i = 0; i < batch.size(); i++) {
+            uint32_t c = batchAssignments[i];
+            const float* x = points + (size_t)batch[i] * dims;
+            for (size_t j = 0; j < dims; j++) sums[c * dims + j] += x[j];
+            batchCounts[c]++;
+        }
+
+        for (size_t c = 0; c < k; c++) {
+            if (batchCounts[c] == 0) continue;
+            counts[c] += batchCounts[c];
+            double step = batchCounts[c] / counts[c];
+            for (size_t j = 0; j < dims; j++) {
+                float& centroid = result.centroids[c * dims + j];
+                centroid = (float)((1.0 - step) * centroid + step * sums[c * dims + j] / batchCounts[c]);
+            }
+        }
     }
-    size_t last = str.find_last_not_of(" \t\r\n\"");
-    return str.substr(first, (last - first + 1));
+
+    // Final full assignment
+    vector<float> norms = centroidSquaredNorms(kernels, result.centroids, k, dims);
+    result.assignments.resize(numPoints);
+    parallelFor((numPoints + chunk - 1) / chunk, options.threads, [&](size_t block) {
+        for (size_t i = block * chunk; i < min(numPoints, (block + 1) * chunk); i++) {
+            result.assignments[i] = nearestCentroid(kernels, points + i * dims, result.centroids.data(), norms.data(), k, dims);
+        }
+        });
+
+    return result;
 }
 
-// Function to parse a CSV line (handles quoted fields with commas)
-vector<string> parseCSVLine(const string& line) {
-    vector<string> fields;
-    string field;
-    bool inQuotes = false;
+// Function to cluster a model's film vectors and store the clusters with the model:
+//   --cluster <model file> <output model file> [--clusters=N] [--iterations=N] [--batch=N] [--seed=N] [--threads=N]
+int runClusterCommand(const vector<string>& args) {
+    ClusteringOptions options;
+    vector<string> files;
+    for (const string& arg : args) {
+        if (arg.rfind("--clusters=", 0) == 0) options.clusters = stoul(arg.substr(11));
+        else if (arg.rfind("--iterations=", 0) == 0) options.iterations = stoi(arg.substr(13));
+        else if (arg.rfind("--batch=", 0) == 0) options.batchSize = stoul(arg.substr(8));
+        else if (arg.rfind("--seed=", 0) == 0) options.seed = stoull(arg.substr(7));
+        else if (arg.rfind("--threads=", 0) == 0) options.threads = (unsigned)stoul(arg.substr(10));
+        else files.push_back(arg);
+    }
+    if (files.size() != 2 || options.clusters == 0 || options.batchSize == 0) {
+        cerr << "Usage: --cluster <model file> <output model file> [--clusters=N] [--iterations=N] [--batch=N] [--seed=N] [--threads=N]" << endl;
+        return 1;
+    }
 
-    for (size_t i = 0; i < line.length(); i++) {
-        char c = line[i];
+    MappedModel model;
+    ModelView view;
+    if (!openModelFile(files[0], ModelValidation::Full, model) || !loadModelView(model, view)) {
+        return 1;
+    }
+    widenFactors(model, view);
 
-        if (c == '"') {
-            inQuotes = !inQuotes;
+    auto start = chrono::steady_clock::now();
+    FilmClusters clusters = clusterFilms(view.filmFactors, view.numFilms, view.dims, options);
+    auto end = chrono::steady_clock::now();
+
+    vector<size_t> sizes(clusters.numClusters, 0);
+    for (uint32_t c : clusters.assignments) sizes[c]++;
+    size_t empty = count(sizes.begin(), sizes.end(), (size_t)0);
+
+    cout << "Clustered " << view.numFilms << " films into " << clusters.numClusters << " clusters in "
+        << chrono::duration<double, milli>(end - start).count() << " ms ("
+        << empty << " empty, largest " << *max_element(sizes.begin(), sizes.end()) << " films)" << endl;
+
+    vector<ModelSectionData> sections = existingModelSections(model, { SECTION_CLUSTER_CENTROIDS, SECTION_FILM_CLUSTERS });
+    sections.push_back(modelSection(SECTION_CLUSTER_CENTROIDS, ModelElementType::Float32, clusters.centroids, (uint32_t)clusters.dims));
+    sections.push_back(modelSection(SECTION_FILM_CLUSTERS, ModelElementType::UInt32, clusters.assignments));
+    if (!writeModelFile(files[1], sections)) return 1;
+
+    cout << "Model with clusters written to " << files[1] << endl;
+    return 0;
+}
+
+// Function to score a contiguous range of the model's films, skipping excluded film
+// ids. Scores match recommendForFoldIn: the dot product plus the film bias, if any.
+// Reads the half-precision factors when the model has them.
+vector<ScoredFilm> topKFilmRange(const ModelView& view, const float* query, size_t begin, size_t end, size_t k,
+    const uint32_t* excluded, size_t numExcluded) {
+    vector<uint64_t> bitmap((end - begin + 63) / 64, 0);
+    for (size_t i = 0; i < numExcluded; i++) {
+        if (excluded[i] >= begin && excluded[i] < end) {
+            size_t local = excluded[i] - begin;
+            bitmap[local >> 6] |= 1ull << (local & 63);
         }
-        else if (c == ',' && !inQuotes) {
-            fields.push_back(trim(field));
-            field.clear();
+    }
+
+    const ScoringKernels& kernels = scoringKernels();
+    const uint16_t* half = view.filmFactorsHalf;
+    auto dotHalf = view.filmFactorType == ModelElementType::BFloat16 ? kernels.dotBF16 : kernels.dotF16;
+    size_t rowBytes = view.dims * (half != nullptr ? sizeof(uint16_t) : sizeof(float));
+    vector<ScoredFilm> top = selectTopK(end - begin, k, bitmap.data(), [&](size_t f) {
+        size_t film = begin + f;
+        float score;
+        if (half != nullptr) {
+            if (film + PREFETCH_DISTANCE < end) prefetchBytes(half + (film + PREFETCH_DISTANCE) * view.dims, rowBytes);
+            score = dotHalf(query, half + film * view.dims, view.dims);
         }
         else {
-            field += c;
+            if (film + PREFETCH_DISTANCE < end) prefetchBytes(view.filmFactors + (film + PREFETCH_DISTANCE) * view.dims, rowBytes);
+            score = kernels.dotF32(query, view.filmFactors + film * view.dims, view.dims);
         }
+        if (view.filmBiases != nullptr) score += view.filmBiases[film];
+        return score;
+        });
+    for (ScoredFilm& film : top) film.filmIndex += (int)begin;
+    return top;
+}
+
+// Film factors copied into a blocked layout for scoring many users at once. Each row
+// is padded to whole cache lines with the film bias in the first padding slot, so a
+// query padded with a 1 there gets the bias from the dot product. Rows are grouped
+// into tiles sized to half of L2: a block of users is scored against one tile while
+// it is cached, so the matrix streams from memory once per block instead of once per
+// user.
+struct FilmTiles {
+    size_t numFilms = 0;
+    size_t dims = 0;
+    size_t stride = 0;              // padded row length in floats
+    size_t tileFilms = 0;
+    vector<float> storage;
+    float* rows = nullptr;          // 64-byte aligned start of storage
+
+    const float* row(size_t film) const {
+        return rows + film * stride;
     }
 
-    // Add the last field
-    fields.push_back(trim(field));
+    size_t numTiles() const {
+        return (numFilms + tileFilms - 1) / tileFilms;
+    }
+};
 
-    return fields;
+// Users scored against each tile before moving to the next; their padded vectors and
+// heaps stay in L1 alongside the tile streaming through L2
+const size_t TILE_USER_BLOCK = 16;
+
+FilmTiles buildFilmTiles(const ModelView& view) {
+    FilmTiles tiles;
+    tiles.numFilms = view.numFilms;
+    tiles.dims = view.dims;
+    tiles.stride = (view.dims + 1 + 15) / 16 * 16;
+    size_t rowBytes = tiles.stride * sizeof(float);
+    tiles.tileFilms = max<size_t>(PREFETCH_DISTANCE, detectL2CacheBytes() / 2 / rowBytes);
+
+    tiles.storage.assign(tiles.numFilms * tiles.stride + 16, 0.0f);
+    tiles.rows = (float*)(((uintptr_t)tiles.storage.data() + 63) & ~(uintptr_t)63);
+    vector<float> scratch;
+    for (size_t f = 0; f < tiles.numFilms; f++) {
+        float* row = tiles.rows + f * tiles.stride;
+        memcpy(row, view.filmVector(f, scratch), view.dims * sizeof(float));
+        row[view.dims] = view.filmBiases != nullptr ? view.filmBiases[f] : 0.0f;
+    }
+    return tiles;
 }
 
-// Safe string to double conversion
-double safeStringToDouble(const string& str) {
-    if (str.empty()) return 0.0;
+// Function to find the top k films for each of a batch of queries (numQueries x dims),
+// with the same scores as topKFilmRange: dot product plus film bias
+vector<vector<ScoredFilm>> topKFilmsTiled(const FilmTiles& tiles, const float* queries, size_t numQueries, size_t k) {
+    const ScoringKernels& kernels = scoringKernels();
+    vector<vector<ScoredFilm>> heaps(numQueries);
+    vector<float> padded(TILE_USER_BLOCK * tiles.stride);
+    size_t rowBytes = tiles.stride * sizeof(float);
+
+    for (size_t first = 0; first < numQueries; first += TILE_USER_BLOCK) {
+        size_t block = min(TILE_USER_BLOCK, numQueries - first);
+        fill(padded.begin(), padded.end(), 0.0f);
+        for (size_t u = 0; u < block; u++) {
+            memcpy(&padded[u * tiles.stride], queries + (first + u) * tiles.dims, tiles.dims * sizeof(float));
+            padded[u * tiles.stride + tiles.dims] = 1.0f;
+            heaps[first + u].reserve(k);
+        }
 
-    try {
-        size_t idx;
-        double value = stod(str, &idx);
-        // Check if entire string was converted
-        if (idx != str.length()) {
-            return 0.0;
+        for (size_t begin = 0; begin < tiles.numFilms; begin += tiles.tileFilms) {
+            size_t end = min(tiles.numFilms, begin + tiles.tileFilms);
+            for (size_t u = 0; u < block; u++) {
+                const float* query = &padded[u * tiles.stride];
+                vector<ScoredFilm>& heap = heaps[first + u];
+                for (size_t f = begin; f < end; f++) {
+                    // The first user of a block pulls the tile in from memory; prefetch for it
+                    if (u == 0 && f + PREFETCH_DISTANCE < end) prefetchBytes(tiles.row(f + PREFETCH_DISTANCE), rowBytes);
+                    pushTopK(heap, k, (int)f, kernels.dotF32(query, tiles.row(f), tiles.stride));
+                }
+            }
         }
-        return value;
-    }
-    catch (...) {
-        return 0.0;
     }
+
+    for (auto& heap : heaps) sort_heap(heap.begin(), heap.end(), worseScoreFirst);
+    return heaps;
 }
 
-// Function to read and parse the Letterboxd diary CSV
-vector<Movie> readLetterboxdCSV(const string& filename) {
-    vector<Movie> movies;
+// Function to time top-k recommendations for a batch of model users, scanned one
+// user at a time and scored in tiles, and check the two agree. Memory traffic is
+// counted from the access pattern: each scan reads the whole film matrix, while
+// tiled scoring reads it once per block of users.
+// The scans are then repeated from fp16 and bf16 copies of the film factors, for
+// their throughput and recall against float32.
+//   --evaluate <model file> [--users=N] [--k=N]
+int runEvaluateCommand(const vector<string>& args) {
+    size_t numQueries = 0;
+    size_t k = 10;
+    string filename;
+    for (const string& arg : args) {
+        if (arg.rfind("--users=", 0) == 0) numQueries = stoul(arg.substr(8));
+        else if (arg.rfind("--k=", 0) == 0) k = stoul(arg.substr(4));
+        else filename = arg;
+    }
 
-    // Try to open file with different methods
-    ifstream file;
+    MappedModel model;
+    ModelView view;
+    if (!openModelFile(filename, ModelValidation::Full, model) || !loadModelView(model, view)) {
+        return 1;
+    }
+    // The float32 reference scans need whole float matrices
+    widenFactors(model, view);
+    if (view.userFactors == nullptr || view.numUsers == 0) {
+        cerr << "Error: Model has no user factors to evaluate" << endl;
+        return 1;
+    }
+    // More queries than users cycle through the users again
+    if (numQueries == 0) numQueries = view.numUsers;
+    vector<float> queries(numQueries * view.dims);
+    for (size_t q = 0; q < numQueries; q++) {
+        memcpy(&queries[q * view.dims], view.userFactors + (q % view.numUsers) * view.dims, view.dims * sizeof(float));
+    }
 
-    // Try opening as-is
-    file.open(filename);
+    // Float32 scans are the reference, even for a model stored at half precision
+    ModelView floatView = view;
+    floatView.filmFactorsHalf = nullptr;
+    auto start = chrono::steady_clock::now();
+    vector<vector<ScoredFilm>> scanned(numQueries);
+    for (size_t q = 0; q < numQueries; q++) {
+        scanned[q] = topKFilmRange(floatView, &queries[q * view.dims], 0, view.numFilms, k, nullptr, 0);
+    }
+    double scanSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    FilmTiles tiles = buildFilmTiles(view);
+    double layoutSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    vector<vector<ScoredFilm>> tiled = topKFilmsTiled(tiles, queries.data(), numQueries, k);
+    double tiledSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // Fraction of the float32 top k a set of results found. Sums taken in a different
+    // order (or at lower precision) may swap near-ties.
+    auto recallOf = [&](const vector<vector<ScoredFilm>>& results) {
+        size_t shared = 0, total = 0;
+        for (size_t q = 0; q < numQueries; q++) {
+            total += scanned[q].size();
+            for (const ScoredFilm& film : results[q]) {
+                for (const ScoredFilm& expected : scanned[q]) {
+                    if (expected.filmIndex == film.filmIndex) shared++;
+                }
+            }
+        }
+        return total == 0 ? 1.0 : (double)shared / total;
+    };
+
+    double matrixMegabytes = view.numFilms * (view.dims + (view.filmBiases != nullptr ? 1 : 0)) * sizeof(float) / 1e6;
+    double tileMegabytes = tiles.numFilms * tiles.stride * sizeof(float) / 1e6;
+    size_t blocks = (numQueries + TILE_USER_BLOCK - 1) / TILE_USER_BLOCK;
+
+    cout.precision(3);
+    cout << fixed;
+    cout << numQueries << " users x " << view.numFilms << " films x " << view.dims << " dims, top " << k << endl;
+    cout << "Tiles: " << tiles.numTiles() << " of " << tiles.tileFilms << " films (" << (tiles.tileFilms * tiles.stride * sizeof(float) >> 10)
+        << " KB), built in " << (layoutSeconds * 1000.0) << " ms" << endl;
+    cout << "Per-user scan: " << (numQueries / scanSeconds) << " users/s, " << (numQueries * matrixMegabytes)
+        << " MB read from the film matrix" << endl;
+    cout << "Tiled batches: " << (numQueries / tiledSeconds) << " users/s, " << (blocks * tileMegabytes)
+        << " MB read from the film matrix" << endl;
+    cout << "Agreement: " << recallOf(tiled) << endl;
+
+    // The same scans from film factors stored at half precision
+    cout << endl << "Storage   users/s      MB/user   recall@" << k << endl;
+    for (ModelElementType type : { ModelElementType::Float32, ModelElementType::Float16, ModelElementType::BFloat16 }) {
+        vector<uint16_t> packed;
+        ModelView formatView = floatView;
+        if (type != ModelElementType::Float32) {
+            packed.resize(view.numFilms * view.dims);
+            for (size_t i = 0; i < packed.size(); i++) {
+                packed[i] = type == ModelElementType::Float16 ? floatToHalf(view.filmFactors[i]) : floatToBfloat16(view.filmFactors[i]);
+            }
+            formatView.filmFactorType = type;
+            formatView.filmFactorsHalf = packed.data();
+        }
 
-    // If that fails, try with binary mode
-    if (!file.is_open()) {
-        file.open(filename, ios::binary);
+        vector<vector<ScoredFilm>> results(numQueries);
+        start = chrono::steady_clock::now();
+        for (size_t q = 0; q < numQueries; q++) {
+            results[q] = topKFilmRange(formatView, &queries[q * view.dims], 0, view.numFilms, k, nullptr, 0);
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        string name = type == ModelElementType::Float32 ? "f32" : type == ModelElementType::Float16 ? "f16" : "bf16";
+        double megabytes = view.numFilms * (view.dims * modelElementSize(type)
+            + (view.filmBiases != nullptr ? sizeof(float) : 0)) / 1e6;
+        string rate = to_string((long long)(numQueries / seconds));
+        cout << name << string(10 - name.size(), ' ') << rate << string(13 - min<size_t>(12, rate.size()), ' ')
+            << megabytes << "     " << recallOf(results) << endl;
     }
+    return 0;
+}
 
-    if (!file.is_open()) {
-        cerr << "Error: Could not open file '" << filename << "'" << endl;
-        cerr << "Please check that:" << endl;
-        cerr << "  - The file path is correct" << endl;
-        cerr << "  - The file exists" << endl;
-        cerr << "  - You have permission to read the file" << endl;
-        return movies;
+// Function to recommend films from a trained model, re-importing the diary on request
+// so newly logged films are reflected without retraining
+void runModelRecommendations(const string& diaryFile, vector<Movie>& movies) {
+    cout << endl << "Enter the path to a trained model file for recommendations" << endl;
+    cout << "(or press Enter to skip): ";
+
+    string modelFile;
+    getline(cin, modelFile);
+    if (!modelFile.empty() && modelFile[0] == '"') {
+        modelFile = modelFile.substr(1, modelFile.length() - 2);
     }
+    if (modelFile.empty()) return;
 
-    string line;
-    int lineNumber = 0;
-    bool isFirstLine = true;
+    MappedModel model;
+    ModelView view;
+    if (!openModelFile(modelFile, ModelValidation::Lazy, model) || !loadModelView(model, view)) {
+        return;
+    }
+    if (view.filmKeyOffsets == nullptr) {
+        cerr << "Error: Model has no film names, so diary rows can't be matched" << endl;
+        return;
+    }
 
-    while (getline(file, line)) {
-        lineNumber++;
+    unordered_map<string, uint32_t> filmIndex = buildFilmIndex(view);
+    FoldInState state;
+    initFoldIn(state, view, 0.1);
+
+    // Letterboxd exports put watchlist.csv and reviews.csv next to diary.csv
+    size_t slash = diaryFile.find_last_of("/\\");
+    string exportDirectory = slash == string::npos ? string() : diaryFile.substr(0, slash + 1);
+    string watchlistFile = exportDirectory + "watchlist.csv";
+    bool hasWatchlist = ifstream(watchlistFile).good();
+    unordered_map<uint32_t, vector<string>> reviewKeywords;
+    if (ifstream(exportDirectory + "reviews.csv").good()) {
+        reviewKeywords = userReviewKeywords(exportDirectory + "reviews.csv", filmIndex, 3);
+    }
 
-        // Remove any carriage return characters
-        if (!line.empty() && line[line.length() - 1] == '\r') {
-            line = line.substr(0, line.length() - 1);
+    size_t foldedRows = 0;
+    while (true) {
+        if (hasWatchlist) {
+            size_t listed = loadWatchlistBitmap(watchlistFile, view, filmIndex, state.watchlistBitmap);
+            cout << endl << "Boosting " << listed << " films from your watchlist." << endl;
         }
 
-        // Skip header line
-        if (isFirstLine) {
-            isFirstLine = false;
-            cout << "CSV Header: " << line << endl << endl;
-            continue;
+        auto start = chrono::steady_clock::now();
+        size_t matched = foldInDiaryRows(state, view, filmIndex, movies, foldedRows);
+        foldedRows = movies.size();
+        bool solved = solveFoldIn(state);
+        auto end = chrono::steady_clock::now();
+
+        cout << endl << "Folded in " << matched << " diary rows (" << state.ratedCount << " rated films in total) in "
+            << chrono::duration<double, micro>(end - start).count() << " us" << endl;
+
+        if (!solved) {
+            cout << "Not enough rated films in the model to recommend from yet." << endl;
+        }
+        else {
+            cout << endl << "Recommended for you:" << endl;
+            printRecommendations(view, state, 10);
+            printTasteProfile(view, state);
         }
 
-        // Skip empty lines
-        if (line.empty()) continue;
+        cout << endl << "Type W to see why these films were recommended." << endl;
+        cout << "Log more films on Letterboxd, export again over the same file," << endl;
+        cout << "then type R to refresh recommendations (or press Enter to finish): ";
+        string answer;
+        getline(cin, answer);
+        if ((answer == "W" || answer == "w") && solved) {
+            start = chrono::steady_clock::now();
+            cout << endl;
+            printRecommendations(view, state, 10, true, &reviewKeywords);
+            end = chrono::steady_clock::now();
+            cout << "(recommended and explained in " << chrono::duration<double, micro>(end - start).count() << " us)" << endl;
 
-        try {
-            vector<string> fields = parseCSVLine(line);
+            cout << endl << "Type R to refresh recommendations (or press Enter to finish): ";
+            getline(cin, answer);
+        }
+        if (answer != "R" && answer != "r") break;
 
-            // Debug: show how many fields we found
-            if (lineNumber == 2) {
-                cout << "First data line has " << fields.size() << " fields" << endl << endl;
-            }
+        size_t added = importNewDiaryRows(diaryFile, movies);
+        cout << "Imported " << added << " new diary rows." << endl;
+    }
+}
 
-            // Letterboxd diary.csv format:
-            // Date,Name,Year,Letterboxd URI,Rating,Rewatch,Tags,Watched Date
-            if (fields.size() >= 2) {  // At minimum we need date and name
-                Movie movie;
-                movie.date = fields.size() > 0 ? fields[0] : "";
-                movie.name = fields.size() > 1 ? fields[1] : "";
-                movie.year = fields.size() > 2 ? fields[2] : "";
-                movie.letterboxdURI = fields.size() > 3 ? fields[3] : "";
-                movie.rating = fields.size() > 4 ? fields[4] : "";
-                movie.rewatch = fields.size() > 5 ? fields[5] : "";
-                movie.tags = fields.size() > 6 ? fields[6] : "";
-                movie.watchedDate = fields.size() > 7 ? fields[7] : "";
+// Function to time the scoring kernels on every instruction set this host supports
+void runScoringBenchmark() {
+    const size_t numFilms = 200000;
+    const size_t dims = 64;
+    const size_t k = 20;
+    const int repeats = 5;
 
-                movies.push_back(movie);
-            }
-        }
-        catch (const exception& e) {
-            cerr << "Warning: Error parsing line " << lineNumber << ": " << e.what() << endl;
-            continue;
-        }
-        catch (...) {
-            cerr << "Warning: Unknown error parsing line " << lineNumber << endl;
-            continue;
-        }
+    cout << "Generating " << numFilms << " random films with " << dims << " dimensions..." << endl;
+
+    mt19937 rng(42);
+    normal_distribution<float> normal(0.0f, 1.0f);
+
+    vector<float> user(dims);
+    vector<float> films(numFilms * dims);
+    for (auto& v : user) v = normal(rng);
+    for (auto& v : films) v = normal(rng);
+
+    vector<uint16_t> filmsF16(films.size());
+    for (size_t i = 0; i < films.size(); i++) {
+        filmsF16[i] = floatToHalf(films[i]);
     }
 
-    file.close();
+    vector<int8_t> userI8(dims);
+    float userScale = quantizeToInt8(user.data(), dims, userI8.data());
+    vector<int8_t> filmsI8(films.size());
+    vector<float> filmScales(numFilms);
+    for (size_t f = 0; f < numFilms; f++) {
+        filmScales[f] = quantizeToInt8(&films[f * dims], dims, &filmsI8[f * dims]);
+    }
 
-    cout << "Successfully read " << movies.size() << " movies from CSV" << endl << endl;
+    vector<float> scores(numFilms);
+    vector<float> reference(numFilms);
+    scoreFilmsF32(kernelTableFor(IsaLevel::Scalar).scoring, user.data(), films.data(), numFilms, dims, reference.data());
+
+    // Best-of-N wall time in milliseconds
+    auto timeIt = [&](auto&& body) {
+        double best = 1e30;
+        for (int r = 0; r < repeats; r++) {
+            auto start = chrono::steady_clock::now();
+            body();
+            auto end = chrono::steady_clock::now();
+            best = min(best, chrono::duration<double, milli>(end - start).count());
+        }
+        return best;
+    };
+
+    cout.precision(3);
+    cout << fixed << endl;
+    cout << "ISA       kernel         ms     Mfilms/s   max error" << endl;
+
+    for (IsaLevel level : supportedIsaLevels()) {
+        const ScoringKernels kernels = kernelTableFor(level).scoring;
+        auto report = [&](const string& label, double ms, double error) {
+            cout << kernels.name << string(10 - string(kernels.name).size(), ' ')
+                << label << string(12 - label.size(), ' ')
+                << ms << "   " << (numFilms / ms / 1000.0) << "   " << error << endl;
+        };
+        auto maxError = [&]() {
+            double worst = 0.0;
+            for (size_t f = 0; f < numFilms; f++) {
+                worst = max(worst, (double)fabs(scores[f] - reference[f]));
+            }
+            return worst;
+        };
 
-    return movies;
-}
+        double ms = timeIt([&] { scoreFilmsF32(kernels, user.data(), films.data(), numFilms, dims, scores.data()); });
+        report("batch f32", ms, maxError());
 
-// Function to convert rating to stars
-string ratingToStars(const string& rating) {
-    if (rating.empty()) return "";
+        ms = timeIt([&] { scoreFilmsF16(kernels, user.data(), filmsF16.data(), numFilms, dims, scores.data()); });
+        report("batch f16", ms, maxError());
 
-    double ratingValue = safeStringToDouble(rating);
+        ms = timeIt([&] {
+            scoreFilmsI8(kernels, userI8.data(), userScale, filmsI8.data(), filmScales.data(), numFilms, dims, scores.data());
+            });
+        report("batch i8", ms, maxError());
 
-    // Convert 0-5 scale to star display
-    if (ratingValue == 0.0) return "";
+        vector<ScoredFilm> top;
+        ms = timeIt([&] { top = topKFilmsF32(kernels, user.data(), films.data(), numFilms, dims, k); });
+        report("top-k f32", ms, top.empty() ? 0.0 : fabs(top[0].score - *max_element(reference.begin(), reference.end())));
 
-    int fullStars = (int)ratingValue;
-    bool halfStar = (ratingValue - fullStars) >= 0.5;
+        ms = timeIt([&] { top = topKFilmsF16(kernels, user.data(), filmsF16.data(), numFilms, dims, k); });
+        report("top-k f16", ms, top.empty() ? 0.0 : fabs(top[0].score - *max_element(reference.begin(), reference.end())));
 
-    string stars;
-    for (int i = 0; i < fullStars; i++) {
-        stars += "*";
+        ms = timeIt([&] {
+            top = topKFilmsI8(kernels, userI8.data(), userScale, filmsI8.data(), filmScales.data(), numFilms, dims, k);
+            });
+        report("top-k i8", ms, top.empty() ? 0.0 : fabs(top[0].score - *max_element(reference.begin(), reference.end())));
     }
-    if (halfStar) {
-        stars += "½";
+
+    // Random row lookups over a matrix far beyond TLB reach, as user lookups and ANN
+    // reranking do, from normal pages and from large pages. There's no portable TLB
+    // counter, so misses are estimated from the page count: nearly every lookup
+    // misses when the pages needed to cover the matrix outnumber the TLB entries.
+    {
+        const size_t gatherRows = (256u << 20) / (dims * sizeof(float));
+        const size_t gatherBytes = gatherRows * dims * sizeof(float);
+        const size_t lookups = 2000000;
+        const size_t smallPage = 4096;
+        const size_t largePage = GetLargePageMinimum() != 0 ? GetLargePageMinimum() : (2u << 20);
+        const size_t tlbEntries = 1536;     // typical second-level TLB
+        const ScoringKernels& kernels = scoringKernels();
+
+        vector<uint32_t> rows(lookups);
+        for (auto& row : rows) row = (uint32_t)(rng() % gatherRows);
+
+        cout << endl << "Random row lookups over " << (gatherBytes >> 20) << " MB (" << lookups << " rows)" << endl;
+        cout << "pages     ns/row   pages to cover   est. TLB misses/row" << endl;
+        double normalNs = 0.0;
+        for (int large = 0; large < 2; large++) {
+            bool gotLarge = false;
+            float* matrix = (float*)allocateOnNode(gatherBytes, 0, large == 1, &gotLarge);
+            if (matrix == nullptr) continue;
+            if (large == 1 && !gotLarge) {
+                cout << "large     unavailable (needs the lock pages in memory right), skipped" << endl;
+                VirtualFree(matrix, 0, MEM_RELEASE);
+                continue;
+            }
+            for (size_t i = 0; i < gatherRows * dims; i++) matrix[i] = (float)(i % 97) * 0.01f;
+
+            volatile float sink = 0.0f;
+            double ms = timeIt([&] {
+                float sum = 0.0f;
+                for (size_t i = 0; i < lookups; i++) {
+                    sum += kernels.dotF32(user.data(), matrix + (size_t)rows[i] * dims, dims);
+                }
+                sink = sum;
+                });
+            (void)sink;
+            VirtualFree(matrix, 0, MEM_RELEASE);
+
+            size_t page = large == 1 ? largePage : smallPage;
+            size_t pages = (gatherBytes + page - 1) / page;
+            double missRate = pages <= tlbEntries ? 0.0 : 1.0 - (double)tlbEntries / pages;
+            double ns = ms * 1e6 / lookups;
+            cout << (large == 1 ? "large     " : "normal    ") << ns << "    " << pages
+                << string(17 - min<size_t>(16, to_string(pages).size()), ' ') << missRate;
+            if (large == 1 && normalNs > 0.0) cout << "   (" << (normalNs / ns) << "x faster)";
+            cout << endl;
+            if (large == 0) normalNs = ns;
+        }
     }
 
-    return stars + " (" + rating + "/5)";
-}
+    // Interning film keys from several threads at once: one lock around an
+    // unordered_map against the sharded InternTable, then lookups once frozen
+    {
+        const size_t distinctKeys = 200000;
+        const size_t internsPerThread = 500000;
+        vector<string> keys(distinctKeys);
+        for (size_t i = 0; i < distinctKeys; i++) {
+            keys[i] = "Film " + to_string(i) + " (" + to_string(1900 + i % 125) + ")";
+        }
+        // Skewed, as diaries are: most rows name a popular film
+        uniform_real_distribution<double> uniform(0.0, 1.0);
+        vector<uint32_t> stream(internsPerThread);
+        for (auto& key : stream) {
+            double u = uniform(rng);
+            key = (uint32_t)(distinctKeys * u * u * u);
+        }
 
-// Function to open file dialog (Windows only)
-string openFileDialog() {
-    char filename[MAX_PATH] = "";
+        unsigned maxThreads = max(1u, thread::hardware_concurrency());
+        vector<unsigned> threadCounts;
+        for (unsigned t = 1; t < maxThreads; t *= 2) threadCounts.push_back(t);
+        threadCounts.push_back(maxThreads);
+
+        // Each thread walks the stream from its own starting point
+        auto runThreads = [&](unsigned threads, const function<void(const string&)>& intern) {
+            auto start = chrono::steady_clock::now();
+            vector<thread> pool;
+            for (unsigned t = 0; t < threads; t++) {
+                pool.emplace_back([&, t] {
+                    size_t offset = t * internsPerThread / threads;
+                    for (size_t i = 0; i < internsPerThread; i++) {
+                        intern(keys[stream[(i + offset) % internsPerThread]]);
+                    }
+                    });
+            }
+            for (auto& worker : pool) worker.join();
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            return threads * internsPerThread / seconds / 1e6;
+        };
+
+        cout << endl << "threads   locked map Mops/s   intern table Mops/s" << endl;
+        unordered_map<string, uint32_t> lockedMap;
+        InternTable table;
+        for (unsigned threads : threadCounts) {
+            mutex mapLock;
+            unordered_map<string, uint32_t> map;
+            double locked = runThreads(threads, [&](const string& key) {
+                lock_guard<mutex> guard(mapLock);
+                map.emplace(key, (uint32_t)map.size());
+                });
+            InternTable fresh;
+            double sharded = runThreads(threads, [&](const string& key) { fresh.intern(key); });
+            string count = to_string(threads);
+            cout << count << string(10 - min<size_t>(9, count.size()), ' ') << locked << "               " << sharded << endl;
+            if (threads == threadCounts.back()) {
+                lockedMap.swap(map);
+                for (const string& key : keys) table.intern(key);
+            }
+        }
 
-    OPENFILENAMEA ofn;
-    ZeroMemory(&ofn, sizeof(ofn));
-    ofn.lStructSize = sizeof(ofn);
-    ofn.hwndOwner = NULL;
-    ofn.lpstrFilter = "CSV Files (*.csv)\0*.csv\0All Files (*.*)\0*.*\0";
-    ofn.lpstrFile = filename;
-    ofn.nMaxFile = MAX_PATH;
-    ofn.Flags = OFN_EXPLORER | OFN_FILEMUSTEXIST | OFN_HIDEREADONLY;
-    ofn.lpstrDefExt = "csv";
-    ofn.lpstrTitle = "Select Letterboxd diary.csv file";
+        table.freeze();
+        size_t found = 0;
+        double ms = timeIt([&] {
+            found = 0;
+            for (uint32_t key : stream) found += table.find(keys[key]) != InternTable::NOT_FOUND;
+            });
+        double frozenRate = internsPerThread / ms / 1000.0;
+        ms = timeIt([&] {
+            found = 0;
+            for (uint32_t key : stream) found += lockedMap.count(keys[key]);
+            });
+        cout << "Frozen lookups: " << frozenRate << " Mops/s (unordered_map " << (internsPerThread / ms / 1000.0)
+            << " Mops/s, " << found << " found)" << endl;
+    }
 
-    if (GetOpenFileNameA(&ofn)) {
-        return string(filename);
+    // Parsing, filtering and hashing paths over a synthetic diary-like buffer
+    string csvText;
+    while (csvText.size() < (8u << 20)) {
+        csvText += "2024-01-05,\"The Good, the Bad and the Ugly\",1966,https://boxd.it/2bfA,4.5,Yes,western,2024-01-04\n";
+    }
+    vector<uint32_t> selected(numFilms);
+    double megabytes = csvText.size() / (1024.0 * 1024.0);
+
+    cout << endl << "ISA       path           ms     throughput" << endl;
+    for (IsaLevel level : supportedIsaLevels()) {
+        KernelTable table = kernelTableFor(level);
+        string name = isaLevelName(level);
+
+        size_t specials = 0;
+        double ms = timeIt([&] {
+            specials = 0;
+            for (size_t i = table.findCsvSpecial(csvText.data(), 0, csvText.size()); i < csvText.size();
+                i = table.findCsvSpecial(csvText.data(), i + 1, csvText.size())) {
+                specials++;
+            }
+            });
+        cout << name << string(10 - name.size(), ' ') << "csv scan    " << ms << "   "
+            << (megabytes / ms * 1000.0) << " MB/s (" << specials << " delimiters)" << endl;
+
+        size_t kept = 0;
+        ms = timeIt([&] { kept = table.filterAtLeast(reference.data(), numFilms, 1.0f, selected.data()); });
+        cout << name << string(10 - name.size(), ' ') << "filter      " << ms << "   "
+            << (numFilms / ms / 1000.0) << " Mvalues/s (" << kept << " kept)" << endl;
+
+        uint32_t crc = 0;
+        ms = timeIt([&] { crc = table.crc32c(0, csvText.data(), csvText.size()); });
+        cout << name << string(10 - name.size(), ' ') << "crc32c      " << ms << "   "
+            << (megabytes / ms * 1000.0) << " MB/s (" << hex << crc << dec << ")" << endl;
     }
 
-    return "";
+    cout << endl;
+    printKernelReport();
 }
 
-int main() {
+// Tests.cpp supplies its own main
+#ifndef MOVIEREC_TESTS
+int main(int argc, char* argv[]) {
     // Wrap everything in try-catch to prevent crashes
     try {
+        bool runBenchmark = false;
+        bool showCpuInfo = false;
+        vector<string> trainArgs;
+        vector<string> clusterArgs;
+        vector<string> ivfPqArgs;
+        vector<string> ivfPqBenchmarkArgs;
+        vector<string> evaluateArgs;
+        vector<string> exportFactorsArgs;
+        vector<string> bulkImportArgs;
+        vector<string> searchReviewsArgs;
+        vector<string> shardWorkerArgs;
+        vector<string> shardBenchmarkArgs;
+        vector<string> serveArgs;
+        vector<string> loadTestArgs;
+        vector<string> numaBenchmarkArgs;
+        string modelInfoFile;
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "--benchmark") {
+                runBenchmark = true;
+            }
+            else if (arg == "--cpu-info") {
+                showCpuInfo = true;
+            }
+            else if (arg.rfind("--isa=", 0) == 0) {
+                isaOverride = arg.substr(6);
+            }
+            else if (arg == "--model-info" && i + 1 < argc) {
+                modelInfoFile = argv[++i];
+            }
+            else if (arg == "--train") {
+                trainArgs.assign(argv + i + 1, argv + argc);
+                break;
+            }
+            else if (arg == "--cluster") {
+                clusterArgs.assign(argv + i + 1, argv + argc);
+                break;
+            }
+            else if (arg == "--build-ivfpq") {
+                ivfPqArgs.assign(argv + i + 1, argv + argc);
+                break;
+            }
+            else if (arg == "--ivfpq-benchmark") {
+                ivfPqBenchmarkArgs.assign(argv + i + 1, argv + argc);
+                break;
+            }
+            else if (arg == "--evaluate") {
+                evaluateArgs.assign(argv + i + 1, argv + argc);
+                break;
+            }
+            else if (arg == "--export-factors") {
+                exportFactorsArgs.assign(argv + i + 1, argv + argc);
+                break;
+            }
+            else if (arg == "--bulk-import") {
+                bulkImportArgs.assign(argv + i + 1, argv + argc);
+                break;
+            }
+            else if (arg == "--search-reviews") {
+                searchReviewsArgs.assign(argv + i + 1, argv + argc);
+                break;
+            }
+            else if (arg == "--serve-shard") {
+                shardWorkerArgs.assign(argv + i + 1, argv + argc);
+                break;
+            }
+            else if (arg == "--shard-benchmark") {
+                shardBenchmarkArgs.assign(argv + i + 1, argv + argc);
+                break;
+            }
+            else if (arg == "--serve") {
+                serveArgs.assign(argv + i + 1, argv + argc);
+                break;
+            }
+            else if (arg == "--load-test") {
+                loadTestArgs.assign(argv + i + 1, argv + argc);
+                break;
+            }
+            else if (arg == "--numa-benchmark") {
+                numaBenchmarkArgs.assign(argv + i + 1, argv + argc);
+                break;
+            }
+        }
+
+        if (showCpuInfo) {
+            printKernelReport();
+            return 0;
+        }
+        if (!trainArgs.empty()) {
+            return runTrainCommand(trainArgs);
+        }
+        if (!clusterArgs.empty()) {
+            return runClusterCommand(clusterArgs);
+        }
+        if (!ivfPqArgs.empty()) {
+            return runBuildIvfPqCommand(ivfPqArgs);
+        }
+        if (!ivfPqBenchmarkArgs.empty()) {
+            return runIvfPqBenchmark(ivfPqBenchmarkArgs);
+        }
+        if (!evaluateArgs.empty()) {
+            return runEvaluateCommand(evaluateArgs);
+        }
+        if (!exportFactorsArgs.empty()) {
+            return runExportFactorsCommand(exportFactorsArgs);
+        }
+        if (!bulkImportArgs.empty()) {
+            return runBulkImportCommand(bulkImportArgs);
+        }
+        if (!searchReviewsArgs.empty()) {
+            return runSearchReviewsCommand(searchReviewsArgs);
+        }
+        if (!shardWorkerArgs.empty()) {
+            return runShardWorker(shardWorkerArgs);
+        }
+        if (!shardBenchmarkArgs.empty()) {
+            return runShardBenchmark(shardBenchmarkArgs);
+        }
+        if (!serveArgs.empty()) {
+            return runServeCommand(serveArgs);
+        }
+        if (!loadTestArgs.empty()) {
+            return runLoadTest(loadTestArgs);
+        }
+        if (!numaBenchmarkArgs.empty()) {
+            return runNumaBenchmark(numaBenchmarkArgs);
+        }
+        if (!modelInfoFile.empty()) {
+            printModelInfo(modelInfoFile);
+            return 0;
+        }
+        if (runBenchmark) {
+            runScoringBenchmark();
+            return 0;
+        }
+
         cout << "========================================" << endl;
         cout << "  Letterboxd CSV Export Reader" << endl;
         cout << "========================================" << endl;
@@ -227,8 +3594,9 @@ int main() {
         cout << "Choose an option:" << endl;
         cout << "1. Browse for diary.csv file" << endl;
         cout << "2. Enter file path manually" << endl;
+        cout << "3. No diary yet - rate a few films to get started" << endl;
         cout << endl;
-        cout << "Enter choice (1 or 2): ";
+        cout << "Enter choice (1, 2 or 3): ";
 
         string choice;
         getline(cin, choice);
@@ -246,6 +3614,12 @@ int main() {
                 return 0;
             }
         }
+        else if (choice == "3") {
+            runOnboarding();
+            cout << endl << "Press Enter to exit...";
+            cin.get();
+            return 0;
+        }
         else if (choice == "2") {
             cout << endl << "Enter the full path to diary.csv" << endl;
             cout << "(Tip: You can drag and drop the file into this window)" << endl;
@@ -357,26 +3731,16 @@ int main() {
         cout << "========================================" << endl;
         cout << "Total movies watched: " << movies.size() << endl;
 
-        // Calculate some statistics
-        int ratedMovies = 0;
-        double totalRating = 0.0;
-        int rewatchCount = 0;
-
-        for (const auto& movie : movies) {
-            if (!movie.rating.empty()) {
-                double rating = safeStringToDouble(movie.rating);
-                if (rating > 0.0) {
-                    ratedMovies++;
-                    totalRating += rating;
-                }
-            }
-            if (!movie.rewatch.empty() && movie.rewatch != "No") {
-                rewatchCount++;
-            }
-        }
+        // Statistics come from the diary's profile row
+        RatingCorpus diaryCorpus;
+        addUserDiary(diaryCorpus, filename, movies);
+        vector<float> profile = computeUserProfiles(diaryCorpus, 1);
+
+        int ratedMovies = (int)profile[PROFILE_RATED];
+        int rewatchCount = (int)lround(profile[PROFILE_REWATCH_SHARE] * profile[PROFILE_WATCHED]);
 
         if (ratedMovies > 0) {
-            double avgRating = totalRating / ratedMovies;
+            double avgRating = profile[PROFILE_MEAN_RATING];
             cout << "Average rating: ";
             cout.precision(2);
             cout << fixed << avgRating << "/5 (based on " << ratedMovies << " rated films)" << endl;
@@ -386,6 +3750,14 @@ int main() {
             cout << "Rewatches: " << rewatchCount << endl;
         }
 
+        if (favouriteDecade(profile.data()) != 0) {
+            cout << "Most watched decade: " << favouriteDecade(profile.data()) << "s" << endl;
+        }
+        printActivityStats(profile.data());
+        printRewatchAnalytics(diaryCorpus, 0);
+
+        runModelRecommendations(filename, movies);
+
         cout << endl << "Press Enter to exit...";
         cin.get();
 
@@ -404,4 +3776,5 @@ int main() {
     }
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,639 @@
+﻿#pragma once
+
+// Types and functions shared by the recommender's source files. Program.cpp holds
+// the core (diaries, training, model files, recommendations) and main; bulk import,
+// the IVF-PQ index, review search, sharding and the server each have their own file.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <immintrin.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#include <windows.h>
+
+// C++20 builds serve connections from coroutines on per-core event loops; older
+// language modes fall back to a thread per connection
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#define HAVE_COROUTINES 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#pragma comment(lib, "Ws2_32.lib")
+#define TARGET_SSE4
+#define TARGET_AVX2
+#define TARGET_AVX512
+#else
+#include <cpuid.h>
+#define TARGET_SSE4 __attribute__((target("sse4.2")))
+#define TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl,fma,f16c")))
+#endif
+
+using namespace std;
+
+// A film index together with its score against a user vector
+struct ScoredFilm {
+    int filmIndex;
+    float score;
+};
+
+// Functions to convert between float and the half-precision factor formats
+float halfToFloat(uint16_t h);
+uint16_t floatToHalf(float value);
+uint16_t floatToBfloat16(float value);
+
+// Function to convert a bfloat16 value (the top half of a float) to float
+inline float bfloat16ToFloat(uint16_t b) {
+    uint32_t bits = (uint32_t)b << 16;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// One set of scoring kernels for a particular instruction set
+struct ScoringKernels {
+    const char* name;
+    float (*dotF32)(const float*, const float*, size_t);
+    float (*dotF16)(const float*, const uint16_t*, size_t);
+    float (*dotBF16)(const float*, const uint16_t*, size_t);
+    int32_t (*dotI8)(const int8_t*, const int8_t*, size_t);
+};
+
+// Instruction set tiers for the kernel tables, lowest first
+enum class IsaLevel {
+    Scalar,
+    SSE4,
+    AVX2,
+    AVX512
+};
+
+// Every vectorized path in the program, resolved for one instruction set tier
+struct KernelTable {
+    IsaLevel level;
+    ScoringKernels scoring;
+    size_t (*findCsvSpecial)(const char* text, size_t start, size_t length);
+    const char* parseVariant;
+    size_t (*filterAtLeast)(const float* values, size_t n, float threshold, uint32_t* outIndices);
+    const char* filterVariant;
+    uint32_t (*crc32c)(uint32_t crc, const void* data, size_t length);
+    const char* hashVariant;
+    void (*pqScanBlock)(const uint8_t* block, const uint8_t* lut, size_t numPairs, uint16_t* out);
+    const char* pqScanVariant;
+};
+
+const KernelTable& activeKernels();
+const ScoringKernels& scoringKernels();
+uint64_t hashBytes(const void* data, size_t length);
+float l2Norm(const ScoringKernels& kernels, const float* a, size_t n);
+
+// Function to check a film against an optional bitmap (one bit per film index)
+inline bool isFilmInBitmap(const uint64_t* bitmap, size_t filmIndex) {
+    return bitmap != nullptr && ((bitmap[filmIndex >> 6] >> (filmIndex & 63)) & 1) != 0;
+}
+
+// Rows ahead of the one being scored that scans prefetch, far enough to hide a miss
+// to DRAM (or the far socket) behind the scoring of the rows in between
+const size_t PREFETCH_DISTANCE = 8;
+
+// Function to prefetch every cache line of a small array into L1
+inline void prefetchBytes(const void* data, size_t bytes) {
+    const char* p = (const char*)data;
+    for (size_t offset = 0; offset < bytes; offset += 64) {
+        _mm_prefetch(p + offset, _MM_HINT_T0);
+    }
+}
+
+// Min-heap order for top-k selection: the worst kept film sits at the front
+inline bool worseScoreFirst(const ScoredFilm& a, const ScoredFilm& b) {
+    return a.score > b.score;
+}
+
+// Function to offer a candidate to a top-k heap of at most k films
+inline void pushTopK(vector<ScoredFilm>& heap, size_t k, int filmIndex, float score) {
+    if (heap.size() < k) {
+        heap.push_back({ filmIndex, score });
+        push_heap(heap.begin(), heap.end(), worseScoreFirst);
+    }
+    else if (k > 0 && score > heap.front().score) {
+        pop_heap(heap.begin(), heap.end(), worseScoreFirst);
+        heap.back() = { filmIndex, score };
+        push_heap(heap.begin(), heap.end(), worseScoreFirst);
+    }
+}
+
+// Function to turn a top-k heap into a list, best first
+inline vector<ScoredFilm> finishTopK(vector<ScoredFilm>& heap) {
+    sort_heap(heap.begin(), heap.end(), worseScoreFirst);
+    return move(heap);
+}
+
+// Function to score films one at a time while keeping only the best k in a min-heap,
+// so the full score array is never materialized. Films set in 'excluded' are skipped.
+template <typename RowScorer>
+vector<ScoredFilm> selectTopK(size_t numFilms, size_t k, const uint64_t* excluded, RowScorer scoreRow) {
+    vector<ScoredFilm> heap;
+    heap.reserve(min(k, numFilms));
+
+    for (size_t f = 0; f < numFilms && k > 0; f++) {
+        if (isFilmInBitmap(excluded, f)) continue;
+        pushTopK(heap, k, (int)f, scoreRow(f));
+    }
+
+    return finishTopK(heap);
+}
+
+vector<ScoredFilm> topKFilmsF32(const ScoringKernels& kernels, const float* user, const float* films,
+    size_t numFilms, size_t dims, size_t k, const uint64_t* excluded = nullptr);
+
+// Structure to hold movie information
+struct Movie {
+    string date;
+    string name;
+    string year;
+    string letterboxdURI;
+    string rating;
+    string rewatch;
+    string tags;
+    string watchedDate;
+};
+
+string trim(const string& str);
+vector<string> parseCSVLine(const string& line);
+double safeStringToDouble(const string& str);
+vector<Movie> readLetterboxdCSV(const string& filename, bool verbose = true);
+string filmKeyFor(const Movie& movie);
+
+// Model file layout (little-endian, all sections 64-byte aligned so arrays can be
+// used in place after mapping):
+//   ModelFileHeader | ModelSectionEntry[sectionCount] | padding | section data...
+const char MODEL_MAGIC[8] = { 'L', 'B', 'X', 'M', 'O', 'D', 'E', 'L' };
+const uint32_t MODEL_VERSION = 1;
+const uint64_t MODEL_ALIGNMENT = 64;
+
+// Section identifiers; readers skip sections they don't know about
+enum ModelSectionId : uint32_t {
+    SECTION_FILM_FACTORS = 1,
+    SECTION_USER_FACTORS = 2,
+    SECTION_FILM_KEY_OFFSETS = 3,
+    SECTION_FILM_KEY_BYTES = 4,
+    SECTION_NEIGHBOR_OFFSETS = 16,
+    SECTION_NEIGHBOR_FILMS = 17,
+    SECTION_NEIGHBOR_SCORES = 18,
+    SECTION_ANN_GRAPH_OFFSETS = 32,
+    SECTION_ANN_GRAPH_EDGES = 33,
+    SECTION_CLUSTER_CENTROIDS = 48,
+    SECTION_FILM_CLUSTERS = 49,
+    SECTION_IVF_CENTROIDS = 64,
+    SECTION_PQ_CODEBOOKS = 65,
+    SECTION_IVF_LIST_OFFSETS = 66,
+    SECTION_IVF_IDS = 67,
+    SECTION_IVF_CODES = 68,
+    SECTION_USER_PROFILES = 80,
+    SECTION_GLOBAL_MEAN = 81,
+    SECTION_FILM_BIASES = 82,
+    SECTION_USER_BIASES = 83,
+    // Corpus snapshots (--bulk-import) reuse the film key sections above
+    SECTION_CORPUS_USER_NAME_OFFSETS = 96,
+    SECTION_CORPUS_USER_NAME_BYTES = 97,
+    SECTION_CORPUS_FILM_YEARS = 98,
+    SECTION_CORPUS_USER_OFFSETS = 99,
+    SECTION_CORPUS_USER_FILMS = 100,
+    SECTION_CORPUS_HALF_STARS = 101,
+    SECTION_CORPUS_ROW_FLAGS = 102,
+    SECTION_CORPUS_ROW_TAG_BINS = 103,
+    SECTION_CORPUS_ROW_DAYS = 104
+};
+
+enum class ModelElementType : uint32_t {
+    Bytes = 0,
+    Float32 = 1,
+    Float16 = 2,
+    Int8 = 3,
+    UInt32 = 4,
+    UInt64 = 5,
+    UInt8 = 6,
+    BFloat16 = 7
+};
+
+inline size_t modelElementSize(ModelElementType type) {
+    switch (type) {
+    case ModelElementType::Float32: return 4;
+    case ModelElementType::Float16: return 2;
+    case ModelElementType::BFloat16: return 2;
+    case ModelElementType::UInt32: return 4;
+    case ModelElementType::UInt64: return 8;
+    default: return 1;
+    }
+}
+
+#pragma pack(push, 1)
+struct ModelFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t sectionCount;
+    uint32_t alignment;
+    uint64_t fileSize;
+    uint32_t sectionTableCrc;
+    uint32_t headerCrc;         // CRC-32C of this header with headerCrc set to 0
+    uint8_t reserved[24];
+};
+
+struct ModelSectionEntry {
+    uint32_t id;
+    uint32_t elementType;
+    uint64_t offset;
+    uint64_t byteSize;
+    uint64_t rows;
+    uint32_t cols;
+    uint32_t crc;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(ModelFileHeader) == 64, "model header must stay 64 bytes");
+static_assert(sizeof(ModelSectionEntry) == 40, "model section entry must stay 40 bytes");
+
+// One array to be written into a model file
+struct ModelSectionData {
+    uint32_t id;
+    ModelElementType type;
+    uint64_t rows;
+    uint32_t cols;
+    const void* data;
+    uint64_t byteSize;
+};
+
+// Function to describe a contiguous array as a model section
+template <typename T>
+ModelSectionData modelSection(uint32_t id, ModelElementType type, const vector<T>& values, uint32_t cols = 1) {
+    uint64_t rows = cols > 0 ? values.size() / cols : 0;
+    return { id, type, rows, cols, values.data(), (uint64_t)(values.size() * sizeof(T)) };
+}
+
+bool writeModelFile(const string& filename, const vector<ModelSectionData>& sections);
+
+// How much of a model file to check when it is opened
+enum class ModelValidation {
+    HeaderOnly,     // header and section table only
+    Lazy,           // also each section's checksum, the first time it is accessed
+    Full            // every section checksum up front
+};
+
+// A model file mapped read-only into memory. Opening costs O(sections), not
+// O(file size): array data is only paged in when it is touched.
+struct MappedModel {
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+    const unsigned char* base = nullptr;
+    uint64_t size = 0;
+    const ModelFileHeader* header = nullptr;
+    const ModelSectionEntry* sections = nullptr;
+    ModelValidation validation = ModelValidation::Lazy;
+    // Per section: 0 = not yet checked, 1 = checksum ok, 2 = corrupt
+    unique_ptr<atomic<int>[]> sectionState;
+    // Float copies of half-precision factor sections, made by widenFactors
+    mutable vector<unique_ptr<float[]>> widened;
+
+    MappedModel() = default;
+    MappedModel(const MappedModel&) = delete;
+    MappedModel& operator=(const MappedModel&) = delete;
+
+    ~MappedModel() {
+        close();
+    }
+
+    void close() {
+        if (base != nullptr) UnmapViewOfFile(base);
+        if (mapping != NULL) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        base = nullptr;
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+        header = nullptr;
+        sections = nullptr;
+        size = 0;
+        widened.clear();
+    }
+
+    bool isOpen() const {
+        return base != nullptr;
+    }
+
+    const ModelSectionEntry* findSection(uint32_t id) const {
+        for (uint32_t i = 0; header != nullptr && i < header->sectionCount; i++) {
+            if (sections[i].id == id) return &sections[i];
+        }
+        return nullptr;
+    }
+
+    // Function to check one section's checksum (cached, so each section is hashed once)
+    bool verifySection(const ModelSectionEntry* entry) const {
+        size_t index = entry - sections;
+        int state = sectionState[index].load(memory_order_acquire);
+        if (state == 0) {
+            uint32_t crc = activeKernels().crc32c(0, base + entry->offset, (size_t)entry->byteSize);
+            state = crc == entry->crc ? 1 : 2;
+            sectionState[index].store(state, memory_order_release);
+        }
+        return state == 1;
+    }
+
+    // Function to get a section as a typed array, or nullptr if it is missing,
+    // has the wrong type or fails its checksum
+    template <typename T>
+    const T* sectionArray(uint32_t id, ModelElementType type, uint64_t* rows = nullptr, uint32_t* cols = nullptr) const {
+        const ModelSectionEntry* entry = findSection(id);
+        if (entry == nullptr || entry->elementType != (uint32_t)type) return nullptr;
+        if (validation != ModelValidation::HeaderOnly && !verifySection(entry)) {
+            cerr << "Error: Model section " << id << " failed its checksum" << endl;
+            return nullptr;
+        }
+        if (rows != nullptr) *rows = entry->rows;
+        if (cols != nullptr) *cols = entry->cols;
+        return (const T*)(base + entry->offset);
+    }
+};
+
+bool openModelFile(const string& filename, ModelValidation validation, MappedModel& model);
+
+// Per-user taste profiles, computed once per corpus load and stored with the model.
+// Each user gets one dense row of PROFILE_WIDTH floats laid out as below.
+const size_t PROFILE_TAG_BINS = 64;
+const size_t PROFILE_DECADES = 16;          // 1870s through 2020s
+const int PROFILE_FIRST_DECADE = 1870;
+
+const size_t PROFILE_WATCHED = 0;           // diary rows
+const size_t PROFILE_RATED = 1;             // rows with a rating
+const size_t PROFILE_MEAN_RATING = 2;       // stars
+const size_t PROFILE_RATING_STDDEV = 3;
+const size_t PROFILE_REWATCH_SHARE = 4;
+const size_t PROFILE_RATING_OFFSETS = 5;    // 10 bins: share of ratings at each half star
+const size_t PROFILE_TAGS = PROFILE_RATING_OFFSETS + 10;    // share of rows per tag bin
+const size_t PROFILE_ERAS = PROFILE_TAGS + PROFILE_TAG_BINS;   // share of rows per release decade
+// Watch-date activity, from one pass over the user's watch days in date order
+const size_t PROFILE_ACTIVE_DAYS = PROFILE_ERAS + PROFILE_DECADES;   // distinct days with a watch
+const size_t PROFILE_LONGEST_STREAK = PROFILE_ACTIVE_DAYS + 1;      // consecutive days with a watch
+const size_t PROFILE_LAST_STREAK = PROFILE_ACTIVE_DAYS + 2;         // streak ending on the last active day
+const size_t PROFILE_LAST_ACTIVE_DAY = PROFILE_ACTIVE_DAYS + 3;     // day number
+const size_t PROFILE_BINGE_DAYS = PROFILE_ACTIVE_DAYS + 4;          // days with PROFILE_BINGE_FILMS or more
+const size_t PROFILE_MOST_IN_A_DAY = PROFILE_ACTIVE_DAYS + 5;
+const size_t PROFILE_LONGEST_GAP = PROFILE_ACTIVE_DAYS + 6;         // days without a watch between two watches
+const size_t PROFILE_WEEKDAYS = PROFILE_ACTIVE_DAYS + 7;            // 7 bins, Monday first: share of dated rows
+const size_t PROFILE_MONTHS = PROFILE_WEEKDAYS + 7;                 // 12 bins: share of dated rows
+const size_t PROFILE_WIDTH = PROFILE_MONTHS + 12;
+
+const int PROFILE_BINGE_FILMS = 3;
+
+const float* widenFactorRow(const uint16_t* row, ModelElementType type, size_t dims, vector<float>& scratch);
+
+// Read-only view of a trained model's arrays, pointing into a mapped file
+struct ModelView {
+    size_t numFilms = 0;
+    size_t numUsers = 0;
+    size_t dims = 0;
+    const float* filmFactors = nullptr;     // numFilms x dims
+    const float* userFactors = nullptr;     // numUsers x dims (optional)
+    const uint64_t* filmKeyOffsets = nullptr;   // numFilms + 1 offsets into filmKeyBytes ("Name (Year)")
+    const char* filmKeyBytes = nullptr;
+    size_t numClusters = 0;
+    const float* clusterCentroids = nullptr;    // numClusters x dims (optional)
+    const uint32_t* filmClusters = nullptr;     // numFilms cluster ids (optional)
+    size_t profileWidth = 0;
+    const float* userProfiles = nullptr;        // numUsers x profileWidth (optional)
+    // Rating normalization (optional): rating = globalMean + user bias + film bias + scale * (u . v)
+    float globalMean = 0.0f;
+    const float* filmBiases = nullptr;          // numFilms
+    const float* userBiases = nullptr;          // numUsers x 2: bias, scale
+    // Factors as stored when the model was exported at half precision. filmFactors and
+    // userFactors are then null until widenFactors makes float copies, and the scoring
+    // paths read these rows directly for half the memory.
+    ModelElementType filmFactorType = ModelElementType::Float32;
+    const uint16_t* filmFactorsHalf = nullptr;  // numFilms x dims, fp16 or bf16
+    ModelElementType userFactorType = ModelElementType::Float32;
+    const uint16_t* userFactorsHalf = nullptr;  // numUsers x dims, fp16 or bf16
+
+    // Function to get one film's factors as floats; a half-precision row is widened into 'scratch'
+    const float* filmVector(size_t film, vector<float>& scratch) const {
+        if (filmFactors != nullptr) return filmFactors + film * dims;
+        return widenFactorRow(filmFactorsHalf + film * dims, filmFactorType, dims, scratch);
+    }
+
+    const float* userVector(size_t user, vector<float>& scratch) const {
+        if (userFactors != nullptr) return userFactors + user * dims;
+        return widenFactorRow(userFactorsHalf + user * dims, userFactorType, dims, scratch);
+    }
+
+    // Function to score a query against one film's factors as stored
+    float filmDot(const ScoringKernels& kernels, const float* query, size_t film) const {
+        if (filmFactors != nullptr) return kernels.dotF32(query, filmFactors + film * dims, dims);
+        auto dotHalf = filmFactorType == ModelElementType::BFloat16 ? kernels.dotBF16 : kernels.dotF16;
+        return dotHalf(query, filmFactorsHalf + film * dims, dims);
+    }
+
+    string filmKey(size_t film) const {
+        if (filmKeyOffsets == nullptr) return "";
+        return string(filmKeyBytes + filmKeyOffsets[film], (size_t)(filmKeyOffsets[film + 1] - filmKeyOffsets[film]));
+    }
+};
+
+void widenFactors(const MappedModel& model, ModelView& view);
+bool loadModelView(const MappedModel& model, ModelView& view);
+
+void parallelFor(size_t count, unsigned threads, const function<void(size_t)>& body);
+
+// Marks a diary row without a usable date
+const int32_t NO_DAY = INT32_MIN;
+int32_t parseDayNumber(const string& date);
+
+// Diary row flags
+const uint8_t ROW_REWATCH = 1;
+uint64_t tagBinsFor(const string& tags);
+
+// Ratings from many users' diaries, as compressed rows by user and by film.
+// Ratings are stored in half stars (1-10); 0 marks a watch without a rating.
+struct RatingCorpus {
+    vector<string> userNames;
+    vector<string> filmKeys;
+    vector<uint16_t> filmYears;             // 0 if unknown
+    unordered_map<string, uint32_t> filmIndex;
+
+    vector<uint64_t> userOffsets = { 0 };   // numUsers + 1
+    vector<uint32_t> userFilms;
+    vector<uint8_t> userHalfStars;
+    vector<uint8_t> userRowFlags;           // ROW_* flags
+    vector<uint64_t> userRowTagBins;        // tagBinsFor() of each row's tags
+    vector<int32_t> userRowDays;            // watched date as a day number, NO_DAY if missing
+
+    vector<uint64_t> filmOffsets;           // numFilms + 1, built by buildFilmMajorIndex
+    vector<uint32_t> filmUsers;
+    vector<uint8_t> filmHalfStars;
+
+    // Filled by normalizeRatings: rating = globalMean + userBias + filmBias + userScale * residual
+    float globalMean = 0.0f;
+    vector<float> userBias;
+    vector<float> userScale;
+    vector<float> filmBias;
+    vector<float> userResiduals;            // parallel to userHalfStars (0 where unrated)
+    vector<float> filmResiduals;            // parallel to filmHalfStars
+
+    // PROFILE_WIDTH floats per user, filled by ensureUserProfiles or from a snapshot;
+    // may cover only the first users until ensureUserProfiles runs
+    vector<float> userProfiles;
+
+    size_t numUsers() const { return userNames.size(); }
+    size_t numFilms() const { return filmKeys.size(); }
+};
+
+uint32_t internFilm(RatingCorpus& corpus, const string& key, uint16_t year);
+
+// Function to append one user's diary rows to the corpus, with film ids from
+// intern(key, year)
+template <typename Interner>
+void appendUserDiary(RatingCorpus& corpus, const string& userName, const vector<Movie>& movies, Interner intern) {
+    corpus.userNames.push_back(userName);
+    for (const Movie& movie : movies) {
+        double rating = safeStringToDouble(movie.rating);
+        uint16_t year = (uint16_t)min(9999.0, max(0.0, safeStringToDouble(movie.year)));
+        bool rewatch = !movie.rewatch.empty() && movie.rewatch != "No";
+
+        corpus.userFilms.push_back(intern(filmKeyFor(movie), year));
+        corpus.userHalfStars.push_back((uint8_t)min(10L, max(0L, lround(rating * 2.0))));
+        corpus.userRowFlags.push_back(rewatch ? ROW_REWATCH : 0);
+        corpus.userRowTagBins.push_back(tagBinsFor(movie.tags));
+        // Older exports leave Watched Date empty; the logged date is the best substitute
+        int32_t day = parseDayNumber(movie.watchedDate);
+        corpus.userRowDays.push_back(day != NO_DAY ? day : parseDayNumber(movie.date));
+    }
+    corpus.userOffsets.push_back(corpus.userFilms.size());
+}
+
+void addUserDiary(RatingCorpus& corpus, const string& userName, const vector<Movie>& movies);
+void buildFilmMajorIndex(RatingCorpus& corpus);
+vector<float> computeUserProfiles(const RatingCorpus& corpus, unsigned threads);
+void ensureUserProfiles(RatingCorpus& corpus, unsigned threads);
+void normalizeRatings(RatingCorpus& corpus, unsigned threads, int passes = 4);
+
+struct TrainingOptions {
+    size_t dims = 32;
+    int epochs = 20;
+    float learningRate = 0.01f;
+    float lambda = 0.05f;
+    uint64_t seed = 1;
+    unsigned threads = 0;       // 0 = all cores; never changes the result
+};
+
+struct TrainedFactors {
+    size_t dims = 0;
+    vector<float> userFactors;
+    vector<float> filmFactors;
+};
+
+TrainedFactors trainFactorization(const RatingCorpus& corpus, const TrainingOptions& options);
+bool writeTrainedModel(const string& filename, const RatingCorpus& corpus, const TrainedFactors& factors);
+vector<ModelSectionData> existingModelSections(const MappedModel& model, const vector<uint32_t>& replacedIds);
+
+struct ClusteringOptions {
+    size_t clusters = 256;
+    int iterations = 100;
+    size_t batchSize = 4096;
+    uint64_t seed = 1;
+    unsigned threads = 0;
+};
+
+struct FilmClusters {
+    size_t numClusters = 0;
+    size_t dims = 0;
+    vector<float> centroids;        // numClusters x dims
+    vector<uint32_t> assignments;   // one cluster per film
+};
+
+FilmClusters clusterFilms(const float* points, size_t numPoints, size_t dims, ClusteringOptions options);
+vector<ScoredFilm> topKFilmRange(const ModelView& view, const float* query, size_t begin, size_t end, size_t k,
+    const uint32_t* excluded, size_t numExcluded);
+
+// A user's vector computed against fixed film factors. The normal equations are
+// kept so new diary rows fold in with a rank-1 update and a small re-solve.
+// With a normalized model the target is the rating minus the global mean, the film's
+// bias and the user's own bias; the user bias is refitted on every solve from running
+// sums, so it still costs one rank-1 update per row.
+struct FoldInState {
+    size_t dims = 0;
+    double lambda = 0.1;
+    bool normalized = false;
+    vector<double> gram;            // dims x dims: sum of v v^T over rated films
+    vector<double> rhs;             // dims: sum of target * v (before the user bias)
+    vector<double> vectorSum;       // dims: sum of v, to take the user bias out of rhs
+    double targetSum = 0.0;
+    double userBias = 0.0;
+    size_t ratedCount = 0;
+    vector<uint32_t> ratedFilms;    // per rated row, kept for explanations
+    vector<float> ratedTargets;
+    vector<double> lower;           // Cholesky factor of gram + lambda I from the last solve
+    vector<float> userVector;
+    vector<float> filmScratch;      // a widened film row, for half-precision models
+    vector<uint64_t> watchedBitmap; // one bit per model film, excluded from recommendations
+    vector<uint64_t> watchlistBitmap; // one bit per model film, boosted in recommendations (optional)
+};
+
+void initFoldIn(FoldInState& state, const ModelView& view, double lambda);
+void addFoldInRow(FoldInState& state, const ModelView& view, size_t film, double rating);
+bool solveFoldIn(FoldInState& state);
+vector<ScoredFilm> recommendForFoldIn(const ModelView& view, const FoldInState& state, size_t count);
+
+// One film's watch history within a single diary
+struct FilmRewatchStats {
+    uint32_t film = 0;
+    uint32_t watches = 0;
+    int32_t firstDay = NO_DAY;
+    int32_t lastDay = NO_DAY;
+    float meanInterval = 0.0f;      // days between consecutive watches
+    float seasonality = 0.0f;       // 0-1: how tightly the watches cluster at one time of year
+    int32_t peakDayOfYear = 0;      // average time of year, for seasonal films
+    float meanRating = 0.0f;        // in stars, 0 if never rated
+    bool comfort = false;
+    bool seasonal = false;
+    int32_t dueDay = NO_DAY;        // when the next rewatch is expected
+};
+
+// A user's rewatched films, plus their order by due day so "due for a rewatch"
+// is a binary search rather than a scan
+struct RewatchAnalytics {
+    vector<FilmRewatchStats> films;
+    vector<uint32_t> byDueDay;
+};
+
+// Watches needed before a film can count as a comfort film or a seasonal rewatch
+const uint32_t COMFORT_MIN_WATCHES = 3;
+// Seasonality (mean resultant length of the watches' times of year) above which a
+// film counts as a seasonal rewatch; 0.9 is roughly all watches within a month or so
+const float SEASONAL_THRESHOLD = 0.9f;
+// Days from first to last watch before a film counts as seasonal, so that watches
+// bunched within one season of one year don't
+const int32_t SEASONAL_MIN_SPAN_DAYS = 300;
+const double TWO_PI = 6.283185307179586;
+
+RewatchAnalytics analyzeRewatches(const RatingCorpus& corpus, size_t user);
+vector<const FilmRewatchStats*> dueForRewatch(const RewatchAnalytics& analytics, int32_t today, size_t count);
@@ -0,0 +1,321 @@
+﻿#include "Reviews.h"
+
+// Function to read reviews.csv (Date,Name,Year,Letterboxd URI,Rating,Rewatch,Review,Tags,Watched Date).
+// Review text may span lines inside quotes, so lines are joined until the quotes balance.
+vector<Review> readReviewsCSV(const string& filename) {
+    vector<Review> reviews;
+    ifstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Error: Could not open file '" << filename << "'" << endl;
+        return reviews;
+    }
+
+    string line;
+    size_t reviewColumn = 6;
+    bool isFirstLine = true;
+    while (getline(file, line)) {
+        size_t quotes = count(line.begin(), line.end(), '"');
+        string next;
+        while (quotes % 2 == 1 && getline(file, next)) {
+            line += '\n';
+            line += next;
+            quotes += count(next.begin(), next.end(), '"');
+        }
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+
+        vector<string> fields = parseCSVLine(line);
+        if (isFirstLine) {
+            isFirstLine = false;
+            auto it = find(fields.begin(), fields.end(), "Review");
+            if (it != fields.end()) reviewColumn = it - fields.begin();
+            continue;
+        }
+        if (fields.size() <= reviewColumn || fields[reviewColumn].empty()) continue;
+        reviews.push_back({ fields[1], fields[2], fields[reviewColumn] });
+    }
+    return reviews;
+}
+
+// Function to split text into lowercase word tokens, dropping one-letter words and
+// common English stopwords. Bytes outside ASCII are kept as word characters, so
+// accented and non-Latin words survive as whole tokens.
+void tokenizeReviewText(const string& text, vector<string>& tokens) {
+    static const unordered_set<string> stopwords = {
+        "a", "an", "and", "are", "as", "at", "be", "but", "by", "for", "from", "has", "have", "he",
+        "her", "his", "i", "in", "is", "it", "its", "me", "my", "of", "on", "or", "so", "that", "the",
+        "this", "to", "was", "were", "with", "you", "she", "they", "we", "not", "just", "all", "than",
+        "there", "their", "what", "when", "who", "which", "been", "had", "into", "also", "very", "can",
+        "about", "out", "up", "if", "how", "one", "more", "some", "do", "did", "no", "him", "them"
+    };
+
+    tokens.clear();
+    string token;
+    for (size_t i = 0; i <= text.size(); i++) {
+        unsigned char c = i < text.size() ? (unsigned char)text[i] : ' ';
+        if (isalnum(c) || c >= 0x80) {
+            token += (char)tolower(c);
+            continue;
+        }
+        if (token.size() > 1 && stopwords.count(token) == 0) {
+            tokens.push_back(token);
+        }
+        token.clear();
+    }
+}
+
+// Function to add one user's reviews as documents
+void addUserReviews(ReviewIndex& index, const string& userName, const vector<Review>& reviews) {
+    uint32_t user = (uint32_t)index.userNames.size();
+    index.userNames.push_back(userName);
+    for (const Review& review : reviews) {
+        uint32_t doc = (uint32_t)index.docTexts.size();
+        Movie movie;
+        movie.name = review.name;
+        movie.year = review.year;
+        index.docUsers.push_back(user);
+        index.docFilms.push_back(filmKeyFor(movie));
+        index.docTexts.push_back(review.text);
+        index.filmDocs[index.docFilms.back()].push_back(doc);
+    }
+}
+
+// Function to build the postings for every added document. Shards of consecutive
+// documents are inverted in parallel; since shards are merged in order, each term's
+// document ids stay increasing and delta-encode without a sort.
+void buildReviewIndex(ReviewIndex& index, unsigned threads) {
+    size_t numDocs = index.numDocs();
+    size_t numShards = (numDocs + REVIEW_SHARD_DOCS - 1) / REVIEW_SHARD_DOCS;
+    index.docLengths.assign(numDocs, 0);
+
+    typedef vector<pair<uint32_t, uint32_t>> RawPostings;   // (document, term frequency)
+    vector<unordered_map<string, RawPostings>> shardPostings(numShards);
+    parallelFor(numShards, threads, [&](size_t shard) {
+        size_t first = shard * REVIEW_SHARD_DOCS;
+        size_t last = min(numDocs, first + REVIEW_SHARD_DOCS);
+        unordered_map<string, RawPostings>& postings = shardPostings[shard];
+        vector<string> tokens;
+        unordered_map<string, uint32_t> frequencies;
+        for (size_t doc = first; doc < last; doc++) {
+            tokenizeReviewText(index.docTexts[doc], tokens);
+            index.docLengths[doc] = (uint32_t)tokens.size();
+            frequencies.clear();
+            for (const string& token : tokens) frequencies[token]++;
+            for (const auto& entry : frequencies) {
+                postings[entry.first].push_back({ (uint32_t)doc, entry.second });
+            }
+        }
+        });
+
+    // Gather each term's shard lists in shard order
+    vector<vector<const RawPostings*>> termShards;
+    for (size_t shard = 0; shard < numShards; shard++) {
+        for (const auto& entry : shardPostings[shard]) {
+            auto inserted = index.termIds.emplace(entry.first, (uint32_t)termShards.size());
+            if (inserted.second) termShards.emplace_back();
+            termShards[inserted.first->second].push_back(&entry.second);
+        }
+    }
+
+    size_t numTerms = termShards.size();
+    index.terms.assign(numTerms, string());
+    for (const auto& entry : index.termIds) index.terms[entry.second] = entry.first;
+
+    vector<vector<uint8_t>> encoded(numTerms);
+    index.documentFrequency.assign(numTerms, 0);
+    parallelFor(numTerms, threads, [&](size_t term) {
+        uint32_t previous = 0;
+        for (const RawPostings* postings : termShards[term]) {
+            for (const auto& posting : *postings) {
+                writeVarint(encoded[term], posting.first - previous);
+                writeVarint(encoded[term], posting.second);
+                previous = posting.first;
+            }
+            index.documentFrequency[term] += (uint32_t)postings->size();
+        }
+        });
+
+    index.postingOffsets.assign(1, 0);
+    index.postingBytes.clear();
+    for (size_t term = 0; term < numTerms; term++) {
+        index.postingBytes.insert(index.postingBytes.end(), encoded[term].begin(), encoded[term].end());
+        index.postingOffsets.push_back(index.postingBytes.size());
+    }
+
+    // Transpose the postings into per-document term lists with a counting sort
+    index.docTermOffsets.assign(numDocs + 1, 0);
+    for (size_t term = 0; term < numTerms; term++) {
+        for (const RawPostings* postings : termShards[term]) {
+            for (const auto& posting : *postings) index.docTermOffsets[posting.first + 1]++;
+        }
+    }
+    for (size_t doc = 0; doc < numDocs; doc++) index.docTermOffsets[doc + 1] += index.docTermOffsets[doc];
+    index.docTerms.resize((size_t)index.docTermOffsets[numDocs]);
+    index.docTermFrequencies.resize(index.docTerms.size());
+    vector<uint64_t> next(index.docTermOffsets.begin(), index.docTermOffsets.end() - 1);
+    for (size_t term = 0; term < numTerms; term++) {
+        for (const RawPostings* postings : termShards[term]) {
+            for (const auto& posting : *postings) {
+                uint64_t slot = next[posting.first]++;
+                index.docTerms[slot] = (uint32_t)term;
+                index.docTermFrequencies[slot] = posting.second;
+            }
+        }
+    }
+
+    uint64_t totalLength = 0;
+    for (uint32_t length : index.docLengths) totalLength += length;
+    index.averageLength = numDocs > 0 ? (double)totalLength / numDocs : 0.0;
+}
+
+// Function to rank reviews against a query with BM25, optionally only one user's.
+// Postings are decoded straight into a dense score array, so a query costs one pass
+// over the postings of its terms.
+vector<ReviewHit> searchReviews(const ReviewIndex& index, const string& query, size_t count, int user) {
+    vector<string> tokens;
+    tokenizeReviewText(query, tokens);
+    sort(tokens.begin(), tokens.end());
+    tokens.erase(unique(tokens.begin(), tokens.end()), tokens.end());
+
+    vector<float> scores(index.numDocs(), 0.0f);
+    vector<uint32_t> touched;
+    float averageLength = (float)max(1.0, index.averageLength);
+    for (const string& token : tokens) {
+        auto it = index.termIds.find(token);
+        if (it == index.termIds.end()) continue;
+        uint32_t term = it->second;
+        float idf = index.idf(term);
+
+        const uint8_t* p = index.postingBytes.data() + index.postingOffsets[term];
+        const uint8_t* end = index.postingBytes.data() + index.postingOffsets[term + 1];
+        uint32_t doc = 0;
+        while (p < end) {
+            doc += readVarint(p);
+            float tf = (float)readVarint(p);
+            if (user >= 0 && index.docUsers[doc] != (uint32_t)user) continue;
+
+            float norm = BM25_K1 * (1.0f - BM25_B + BM25_B * index.docLengths[doc] / averageLength);
+            if (scores[doc] == 0.0f) touched.push_back(doc);
+            scores[doc] += idf * tf * (BM25_K1 + 1.0f) / (tf + norm);
+        }
+    }
+
+    vector<ReviewHit> hits;
+    hits.reserve(touched.size());
+    for (uint32_t doc : touched) hits.push_back({ doc, scores[doc] });
+    size_t kept = min(count, hits.size());
+    partial_sort(hits.begin(), hits.begin() + kept, hits.end(), [](const ReviewHit& a, const ReviewHit& b) {
+        return a.score != b.score ? a.score > b.score : a.doc < b.doc;
+        });
+    hits.resize(kept);
+    return hits;
+}
+
+// Function to extract a film's keyword features from its reviews: the terms with the
+// highest summed tf-idf over every review of the film, read from the index's
+// per-document term lists. Ratings are never looked at, so the keywords describe
+// what reviewers talk about rather than how they felt.
+vector<pair<string, float>> filmReviewKeywords(const ReviewIndex& index, const string& filmKey, size_t count) {
+    auto docs = index.filmDocs.find(filmKey);
+    if (docs == index.filmDocs.end()) return {};
+
+    unordered_map<uint32_t, float> weights;
+    for (uint32_t doc : docs->second) {
+        for (uint64_t i = index.docTermOffsets[doc]; i < index.docTermOffsets[doc + 1]; i++) {
+            uint32_t term = index.docTerms[i];
+            weights[term] += index.docTermFrequencies[i] * index.idf(term);
+        }
+    }
+
+    vector<pair<string, float>> keywords;
+    keywords.reserve(weights.size());
+    for (const auto& weight : weights) keywords.push_back({ index.terms[weight.first], weight.second });
+    size_t kept = min(count, keywords.size());
+    partial_sort(keywords.begin(), keywords.begin() + kept, keywords.end(),
+        [](const pair<string, float>& a, const pair<string, float>& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+    keywords.resize(kept);
+    return keywords;
+}
+
+// Function to get keyword features for each model film a user has reviewed, from
+// their own reviews.csv, for recommendation explanations
+unordered_map<uint32_t, vector<string>> userReviewKeywords(const string& reviewsFile,
+    const unordered_map<string, uint32_t>& filmIndex, size_t count) {
+    ReviewIndex index;
+    addUserReviews(index, reviewsFile, readReviewsCSV(reviewsFile));
+    buildReviewIndex(index, 0);
+
+    unordered_map<uint32_t, vector<string>> keywords;
+    for (const auto& film : index.filmDocs) {
+        auto row = filmIndex.find(film.first);
+        if (row == filmIndex.end()) continue;
+        vector<string>& words = keywords[row->second];
+        for (const auto& keyword : filmReviewKeywords(index, film.first, count)) {
+            words.push_back(keyword.first);
+        }
+    }
+    return keywords;
+}
+
+// Function to index review exports and search them:
+//   --search-reviews "<query>" <reviews.csv>... [--user=<reviews.csv>] [--threads=N]
+int runSearchReviewsCommand(const vector<string>& args) {
+    unsigned threads = 0;
+    string userFile;
+    vector<string> files;
+    for (const string& arg : args) {
+        if (arg.rfind("--threads=", 0) == 0) threads = (unsigned)stoul(arg.substr(10));
+        else if (arg.rfind("--user=", 0) == 0) userFile = arg.substr(7);
+        else files.push_back(arg);
+    }
+    if (files.size() < 2) {
+        cerr << "Usage: --search-reviews \"<query>\" <reviews.csv>... [--user=<reviews.csv>] [--threads=N]" << endl;
+        return 1;
+    }
+
+    ReviewIndex index;
+    for (size_t i = 1; i < files.size(); i++) {
+        addUserReviews(index, files[i], readReviewsCSV(files[i]));
+    }
+
+    int user = -1;
+    if (!userFile.empty()) {
+        auto it = find(index.userNames.begin(), index.userNames.end(), userFile);
+        if (it == index.userNames.end()) {
+            cerr << "Error: " << userFile << " is not one of the indexed review files" << endl;
+            return 1;
+        }
+        user = (int)(it - index.userNames.begin());
+    }
+
+    auto start = chrono::steady_clock::now();
+    buildReviewIndex(index, threads);
+    auto end = chrono::steady_clock::now();
+    cout << "Indexed " << index.numDocs() << " reviews (" << index.termIds.size() << " terms, "
+        << index.postingBytes.size() << " posting bytes) in "
+        << chrono::duration<double, milli>(end - start).count() << " ms" << endl;
+
+    start = chrono::steady_clock::now();
+    vector<ReviewHit> hits = searchReviews(index, files[0], 10, user);
+    end = chrono::steady_clock::now();
+    cout << hits.size() << " results for \"" << files[0] << "\" in "
+        << chrono::duration<double, milli>(end - start).count() << " ms" << endl;
+
+    for (size_t i = 0; i < hits.size(); i++) {
+        uint32_t doc = hits[i].doc;
+        string snippet = index.docTexts[doc].substr(0, 100);
+        replace(snippet.begin(), snippet.end(), '\n', ' ');
+        cout << endl << (i + 1) << ". " << index.docFilms[doc] << " (score " << hits[i].score << ")" << endl;
+        cout << "   " << index.userNames[index.docUsers[doc]] << ": " << snippet
+            << (index.docTexts[doc].size() > 100 ? "..." : "") << endl;
+
+        cout << "   Keywords:";
+        for (const auto& keyword : filmReviewKeywords(index, index.docFilms[doc], 5)) {
+            cout << " " << keyword.first;
+        }
+        cout << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+﻿#pragma once
+
+#include "Recommender.h"
+
+// A review from a Letterboxd reviews.csv export
+struct Review {
+    string name;
+    string year;
+    string text;
+};
+
+vector<Review> readReviewsCSV(const string& filename);
+void tokenizeReviewText(const string& text, vector<string>& tokens);
+
+// Function to append an unsigned LEB128 varint
+inline void writeVarint(vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+// Function to read an unsigned LEB128 varint, advancing the pointer past it
+inline uint32_t readVarint(const uint8_t*& p) {
+    uint32_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = *p++;
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if (byte < 0x80) return value;
+    }
+}
+
+// Documents per index-build shard; each shard is tokenized and inverted on its own thread
+const size_t REVIEW_SHARD_DOCS = 2048;
+const float BM25_K1 = 1.2f;
+const float BM25_B = 0.75f;
+
+// Inverted index over review text. Each term's postings are (document delta, term
+// frequency) varint pairs in increasing document order.
+struct ReviewIndex {
+    vector<string> userNames;
+    vector<uint32_t> docUsers;
+    vector<string> docFilms;            // film key, "Name (Year)"
+    vector<string> docTexts;
+    vector<uint32_t> docLengths;        // tokens per document
+    double averageLength = 0.0;
+    unordered_map<string, vector<uint32_t>> filmDocs;
+
+    unordered_map<string, uint32_t> termIds;
+    vector<string> terms;                   // by term id
+    vector<uint32_t> documentFrequency;
+    vector<uint64_t> postingOffsets = { 0 };
+    vector<uint8_t> postingBytes;
+
+    // The postings transposed: each document's distinct terms and their frequencies
+    vector<uint64_t> docTermOffsets = { 0 };    // numDocs + 1
+    vector<uint32_t> docTerms;
+    vector<uint32_t> docTermFrequencies;
+
+    size_t numDocs() const { return docTexts.size(); }
+
+    float idf(uint32_t term) const {
+        double df = documentFrequency[term];
+        return (float)log(1.0 + (numDocs() - df + 0.5) / (df + 0.5));
+    }
+};
+
+void addUserReviews(ReviewIndex& index, const string& userName, const vector<Review>& reviews);
+void buildReviewIndex(ReviewIndex& index, unsigned threads);
+
+struct ReviewHit {
+    uint32_t doc;
+    float score;
+};
+
+vector<ReviewHit> searchReviews(const ReviewIndex& index, const string& query, size_t count, int user = -1);
+vector<pair<string, float>> filmReviewKeywords(const ReviewIndex& index, const string& filmKey, size_t count);
+unordered_map<uint32_t, vector<string>> userReviewKeywords(const string& reviewsFile,
+    const unordered_map<string, uint32_t>& filmIndex, size_t count);
+int runSearchReviewsCommand(const vector<string>& args);
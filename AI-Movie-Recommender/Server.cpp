@@ -0,0 +1,1205 @@
+﻿#include "Server.h"
+
+// Function to start Winsock once per process
+bool initSockets() {
+    static bool started = false;
+    if (!started) {
+        WSADATA data;
+        started = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+        if (!started) cerr << "Error: Could not start Winsock" << endl;
+    }
+    return started;
+}
+
+// Function to send a whole buffer, looping over partial sends
+bool sendAll(SOCKET socket, const void* data, size_t length) {
+    const char* p = (const char*)data;
+    while (length > 0) {
+        int sent = send(socket, p, (int)min<size_t>(length, 1 << 30), 0);
+        if (sent <= 0) return false;
+        p += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// Function to receive exactly 'length' bytes (false on error or a closed connection)
+bool recvAll(SOCKET socket, void* data, size_t length) {
+    char* p = (char*)data;
+    while (length > 0) {
+        int received = recv(socket, p, (int)min<size_t>(length, 1 << 30), 0);
+        if (received <= 0) return false;
+        p += received;
+        length -= received;
+    }
+    return true;
+}
+
+// Function to open a TCP listener on the loopback or any interface
+SOCKET listenOnPort(uint16_t port, bool loopbackOnly) {
+    if (!initSockets()) return INVALID_SOCKET;
+    SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET) return INVALID_SOCKET;
+
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY);
+    if (::bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        closesocket(listener);
+        return INVALID_SOCKET;
+    }
+    return listener;
+}
+
+// Function to connect to "host:port", with Nagle's algorithm off since every
+// message is written in one piece and waited on
+SOCKET connectTo(const string& hostPort) {
+    if (!initSockets()) return INVALID_SOCKET;
+    size_t colon = hostPort.rfind(':');
+    if (colon == string::npos) return INVALID_SOCKET;
+
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(hostPort.substr(0, colon).c_str(), hostPort.substr(colon + 1).c_str(), &hints, &result) != 0) {
+        return INVALID_SOCKET;
+    }
+
+    SOCKET connection = INVALID_SOCKET;
+    for (addrinfo* a = result; a != nullptr && connection == INVALID_SOCKET; a = a->ai_next) {
+        connection = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (connection == INVALID_SOCKET) continue;
+        if (connect(connection, a->ai_addr, (int)a->ai_addrlen) != 0) {
+            closesocket(connection);
+            connection = INVALID_SOCKET;
+        }
+    }
+    freeaddrinfo(result);
+
+    if (connection != INVALID_SOCKET) {
+        int noDelay = 1;
+        setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+    }
+    return connection;
+}
+
+// Function to find the next complete frame in a receive buffer. Returns the frame's
+// total size, 0 if more bytes are needed, or SIZE_MAX if the stream is malformed.
+size_t nextFrame(const char* data, size_t available, FrameHeader& header) {
+    if (available < sizeof(uint32_t)) return 0;
+    memcpy(&header.length, data, sizeof(uint32_t));
+    size_t total = sizeof(uint32_t) + header.length;
+    if (total < PROTOCOL_HEADER_SIZE || total > PROTOCOL_MAX_FRAME || total % 4 != 0) return SIZE_MAX;
+    if (available < total) return 0;
+    memcpy(&header, data, sizeof(header));
+    return total;
+}
+
+// Function to append a response frame
+void appendResponse(vector<char>& out, uint32_t requestId, uint16_t status, const vector<ScoredFilm>& films) {
+    FrameHeader header = { (uint32_t)(PROTOCOL_HEADER_SIZE - sizeof(uint32_t) + films.size() * 8), requestId,
+        status, (uint16_t)films.size() };
+    appendPod(out, &header, 1);
+    for (const ScoredFilm& film : films) {
+        uint32_t id = (uint32_t)film.filmIndex;
+        appendPod(out, &id, 1);
+        appendPod(out, &film.score, 1);
+    }
+}
+
+// Function to check a request's payload and ids against a model without scoring it.
+// Returns STATUS_OK, or the status the request must get whether or not it is served.
+uint16_t checkRequest(const ModelView& view, const RequestView& request) {
+    switch (request.type) {
+    case REQUEST_PING:
+        return STATUS_OK;
+    case REQUEST_RECOMMEND_USER:
+        if (request.payloadWords != 1) return STATUS_BAD_REQUEST;
+        return request.payload[0] < view.numUsers ? STATUS_OK : STATUS_NOT_FOUND;
+    case REQUEST_RECOMMEND_VECTOR:
+        return request.payloadWords >= view.dims ? STATUS_OK : STATUS_BAD_REQUEST;
+    case REQUEST_SIMILAR_FILMS:
+        if (request.payloadWords != 1) return STATUS_BAD_REQUEST;
+        return request.payload[0] < view.numFilms ? STATUS_OK : STATUS_NOT_FOUND;
+    default:
+        return STATUS_BAD_REQUEST;
+    }
+}
+
+// Function to answer one request against a model
+uint16_t handleRequest(const ModelView& view, const RequestView& request, vector<ScoredFilm>& films) {
+    films.clear();
+    uint16_t status = checkRequest(view, request);
+    if (status != STATUS_OK) return status;
+
+    size_t k = request.k;
+    vector<float> scratch;
+    switch (request.type) {
+    case REQUEST_RECOMMEND_USER:
+        films = topKFilmRange(view, view.userVector(request.payload[0], scratch), 0, view.numFilms, k, nullptr, 0);
+        break;
+    case REQUEST_RECOMMEND_VECTOR:
+        films = topKFilmRange(view, (const float*)request.payload, 0, view.numFilms, k,
+            request.payload + view.dims, request.payloadWords - view.dims);
+        break;
+    case REQUEST_SIMILAR_FILMS:
+        films = topKFilmRange(view, view.filmVector(request.payload[0], scratch), 0, view.numFilms, k,
+            request.payload, 1);
+        break;
+    }
+    return STATUS_OK;
+}
+
+// Function to enable the "lock pages in memory" privilege that large-page allocations
+// need. Tried once per process; fails unless an administrator granted the account
+// that right.
+bool enableLargePages() {
+    static const bool enabled = [] {
+        if (GetLargePageMinimum() == 0) return false;
+        HANDLE token;
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return false;
+        TOKEN_PRIVILEGES privileges = {};
+        privileges.PrivilegeCount = 1;
+        privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        // AdjustTokenPrivileges succeeds even when the right is missing; GetLastError tells
+        bool granted = LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid)
+            && AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+            && GetLastError() == ERROR_SUCCESS;
+        CloseHandle(token);
+        return granted;
+        }();
+    return enabled;
+}
+
+// Function to allocate committed memory preferring one NUMA node. With largePages,
+// tries large (2MB) pages first, so one TLB entry covers 512 times as much of a
+// randomly read array; falls back to normal pages when they can't be had (no
+// privilege, or physical memory too fragmented). Free with VirtualFree.
+void* allocateOnNode(size_t bytes, USHORT node, bool largePages, bool* usedLargePages) {
+    void* memory = nullptr;
+    if (largePages && enableLargePages()) {
+        size_t page = GetLargePageMinimum();
+        size_t rounded = (bytes + page - 1) / page * page;
+        memory = VirtualAllocExNuma(GetCurrentProcess(), nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+            PAGE_READWRITE, node);
+    }
+    if (usedLargePages != nullptr) *usedLargePages = memory != nullptr;
+    if (memory == nullptr) {
+        memory = VirtualAllocExNuma(GetCurrentProcess(), nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+    }
+    return memory;
+}
+
+// NUMA nodes that have processors, with each node's processor mask
+struct NumaTopology {
+    vector<USHORT> nodes;
+    vector<GROUP_AFFINITY> affinities;
+
+    size_t size() const { return nodes.size(); }
+};
+
+NumaTopology detectNumaTopology() {
+    NumaTopology topology;
+    ULONG highest = 0;
+    if (GetNumaHighestNodeNumber(&highest)) {
+        for (ULONG node = 0; node <= highest; node++) {
+            GROUP_AFFINITY affinity = {};
+            if (GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) && affinity.Mask != 0) {
+                topology.nodes.push_back((USHORT)node);
+                topology.affinities.push_back(affinity);
+            }
+        }
+    }
+    if (topology.nodes.empty()) {
+        // Not NUMA-aware (or the query failed): one node that can run anywhere
+        topology.nodes.push_back(0);
+        topology.affinities.push_back(GROUP_AFFINITY());
+    }
+    return topology;
+}
+
+// Function to keep the calling thread on one node's processors
+void pinThreadToNode(const NumaTopology& topology, size_t index) {
+    if (topology.affinities[index].Mask != 0) {
+        SetThreadGroupAffinity(GetCurrentThread(), &topology.affinities[index], nullptr);
+    }
+}
+
+// Per-node copies of the arrays every request streams through (film factors and
+// biases), so scoring threads never read them across the socket interconnect. The
+// other arrays are small or rarely read and stay in the single mapped copy. With
+// large pages the user arrays are copied too: requests look up single rows of them
+// at random, which is where TLB misses hurt most. (A file mapping can't be backed by
+// large pages, so copying out of the mapped model is the only way to get them.)
+struct NumaReplicas {
+    vector<ModelView> views;        // one per topology node
+    vector<void*> allocations;
+    size_t largePageBytes = 0;      // how much of the copies landed on large pages
+    size_t copiedBytes = 0;
+
+    NumaReplicas() = default;
+    NumaReplicas(const NumaReplicas&) = delete;
+    NumaReplicas& operator=(const NumaReplicas&) = delete;
+
+    ~NumaReplicas() {
+        for (void* allocation : allocations) VirtualFree(allocation, 0, MEM_RELEASE);
+    }
+
+    // Function to copy an array into memory preferring one node (nullptr on failure)
+    template <typename T>
+    const T* copyToNode(const T* source, size_t count, USHORT node, bool largePages) {
+        size_t bytes = count * sizeof(T);
+        bool large = false;
+        void* copy = allocateOnNode(bytes, node, largePages, &large);
+        if (copy == nullptr) return nullptr;
+        memcpy(copy, source, bytes);
+        allocations.push_back(copy);
+        copiedBytes += bytes;
+        if (large) largePageBytes += bytes;
+        return (const T*)copy;
+    }
+
+    // Function to build one view per node; a node whose copy can't be allocated reads
+    // the original arrays instead
+    void build(const ModelView& view, const NumaTopology& topology, bool replicate, bool largePages = false) {
+        views.assign(topology.size(), view);
+        if (!replicate) return;
+        for (size_t n = 0; n < topology.size(); n++) {
+            USHORT node = topology.nodes[n];
+            // Scans read the half-precision factors when there are any, so only they are copied
+            if (view.filmFactorsHalf != nullptr) {
+                const uint16_t* half = copyToNode(view.filmFactorsHalf, view.numFilms * view.dims, node, largePages);
+                if (half == nullptr) continue;
+                views[n].filmFactorsHalf = half;
+            }
+            else {
+                const float* factors = copyToNode(view.filmFactors, view.numFilms * view.dims, node, largePages);
+                if (factors == nullptr) continue;
+                views[n].filmFactors = factors;
+            }
+            if (view.filmBiases != nullptr) {
+                const float* biases = copyToNode(view.filmBiases, view.numFilms, node, largePages);
+                if (biases != nullptr) views[n].filmBiases = biases;
+            }
+            if (largePages && view.userFactorsHalf != nullptr) {
+                const uint16_t* users = copyToNode(view.userFactorsHalf, view.numUsers * view.dims, node, true);
+                if (users != nullptr) views[n].userFactorsHalf = users;
+            }
+            else if (largePages && view.userFactors != nullptr) {
+                const float* users = copyToNode(view.userFactors, view.numUsers * view.dims, node, true);
+                if (users != nullptr) views[n].userFactors = users;
+            }
+            if (largePages && view.userBiases != nullptr) {
+                const float* biases = copyToNode(view.userBiases, view.numUsers * 2, node, true);
+                if (biases != nullptr) views[n].userBiases = biases;
+            }
+        }
+    }
+};
+
+// Admission control settings for server mode
+struct AdmissionOptions {
+    unsigned workers = 0;               // scoring threads (0 = one per core), spread over NUMA nodes
+    bool numaReplicas = true;           // give each NUMA node its own copy of the film arrays
+    bool largePages = false;            // copy the model arrays into large-page memory
+    double maxQueueDelayUs = 2000.0;    // predicted queueing delay above which requests are degraded
+    size_t maxQueueDepth = 4096;        // queued requests above which requests are shed outright
+    size_t perClientLimit = 64;         // requests one connection may have queued at once
+};
+
+// Recently computed answers, kept for degraded responses. Direct-mapped: a slot
+// holds whichever request hashed to it last.
+struct ResultCache {
+    static const size_t SLOTS = 4096;
+    struct Slot {
+        uint64_t key = 0;
+        vector<ScoredFilm> films;
+    };
+    vector<Slot> slots = vector<Slot>(SLOTS);
+    vector<mutex> locks = vector<mutex>(64);
+
+    static uint64_t keyFor(uint16_t type, uint32_t id) {
+        return ((uint64_t)type << 32 | id) + 1;     // never 0, which marks an empty slot
+    }
+
+    void store(uint64_t key, const vector<ScoredFilm>& films) {
+        size_t slot = (size_t)(hashBytes(&key, sizeof(key)) % SLOTS);
+        lock_guard<mutex> lock(locks[slot % locks.size()]);
+        slots[slot].key = key;
+        slots[slot].films = films;
+    }
+
+    bool find(uint64_t key, size_t k, vector<ScoredFilm>& films) {
+        size_t slot = (size_t)(hashBytes(&key, sizeof(key)) % SLOTS);
+        lock_guard<mutex> lock(locks[slot % locks.size()]);
+        if (slots[slot].key != key || slots[slot].films.size() < k) return false;
+        films.assign(slots[slot].films.begin(), slots[slot].films.begin() + k);
+        return true;
+    }
+};
+
+// A request waiting for a scoring thread. It points into its connection's receive
+// buffer, which stays put until the whole batch has been answered.
+struct ServerJob {
+    RequestView request;
+    chrono::steady_clock::time_point deadline;
+    uint16_t status = STATUS_OK;
+    vector<ScoredFilm> films;
+    struct BatchCompletion* batch = nullptr;
+};
+
+// Counts down the jobs of one receive batch. A blocking connection thread waits on
+// it; a coroutine instead sets onFinished, which whichever thread finishes the batch runs.
+struct BatchCompletion {
+    mutex lock;
+    condition_variable finished;
+    size_t remaining = 0;
+    function<void()> onFinished;
+
+    void complete() {
+        function<void()> callback;
+        {
+            lock_guard<mutex> guard(lock);
+            if (--remaining != 0) return;
+            finished.notify_all();
+            callback = move(onFinished);
+            onFinished = nullptr;
+        }
+        if (callback) callback();
+    }
+
+    void wait() {
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [&] { return remaining == 0; });
+    }
+};
+
+// The server's scoring side: a bounded queue in front of a pool of scoring threads.
+// Each request is admitted, degraded to a fallback answer or shed depending on the
+// queue depth, the measured service time and its own deadline, so queueing delay -
+// and with it tail latency - stays bounded however bursty the load gets.
+struct RecommendationService {
+    const ModelView& view;
+    AdmissionOptions options;
+    ResultCache cache;
+    vector<ScoredFilm> popular;         // fallback: films by bias (or vector norm), best first
+
+    NumaTopology numa;
+    NumaReplicas replicas;
+
+    mutex queueLock;
+    condition_variable queueReady;
+    deque<ServerJob*> queue;
+    bool stopping = false;
+    vector<thread> workers;
+    atomic<double> serviceUs;           // moving average of scoring time per request
+
+    atomic<uint64_t> admitted, degraded, shed, expired;
+
+    RecommendationService(const ModelView& modelView, const AdmissionOptions& admission)
+        : view(modelView), options(admission), serviceUs(50.0), admitted(0), degraded(0), shed(0), expired(0) {
+        size_t count = min<size_t>(view.numFilms, 1000);
+        vector<float> scratch;
+        popular = selectTopK(view.numFilms, count, nullptr, [&](size_t f) {
+            if (view.filmBiases != nullptr) return view.filmBiases[f];
+            return l2Norm(scoringKernels(), view.filmVector(f, scratch), view.dims);
+            });
+
+        numa = detectNumaTopology();
+        replicas.build(view, numa, (options.numaReplicas && numa.size() > 1) || options.largePages, options.largePages);
+        if (options.largePages) {
+            cout << "Large pages: " << (replicas.largePageBytes / 1048576.0) << " of " << (replicas.copiedBytes / 1048576.0)
+                << " MB of model arrays" << (replicas.largePageBytes < replicas.copiedBytes ? " (rest on normal pages)" : "")
+                << endl;
+        }
+
+        unsigned threads = options.workers != 0 ? options.workers : max(1u, thread::hardware_concurrency());
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([this, t] { workerLoop(t % numa.size()); });
+        }
+    }
+
+    ~RecommendationService() {
+        {
+            lock_guard<mutex> lock(queueLock);
+            stopping = true;
+        }
+        queueReady.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    // Queueing delay a new request would see, from the queue depth and service time
+    double predictedWaitUs(size_t depth) const {
+        return depth * serviceUs.load() / workers.size();
+    }
+
+    // Function to answer from the cache, or failing that the popularity list. A request
+    // the model would reject gets the same status as it would from a worker.
+    void fallback(ServerJob& job) {
+        const RequestView& request = job.request;
+        job.films.clear();
+        uint16_t type = request.type & ~REQUEST_FLAG_DEADLINE;
+        job.status = checkRequest(view, request);
+        if (job.status != STATUS_OK || type == REQUEST_PING) return;
+        job.status = STATUS_DEGRADED;
+        if ((type == REQUEST_RECOMMEND_USER || type == REQUEST_SIMILAR_FILMS) && request.payloadWords == 1
+            && cache.find(ResultCache::keyFor(type, request.payload[0]), request.k, job.films)) {
+            return;
+        }
+
+        unordered_set<uint32_t> excluded;
+        if (type == REQUEST_SIMILAR_FILMS && request.payloadWords == 1) excluded.insert(request.payload[0]);
+        if (type == REQUEST_RECOMMEND_VECTOR && request.payloadWords > view.dims) {
+            excluded.insert(request.payload + view.dims, request.payload + request.payloadWords);
+        }
+        for (const ScoredFilm& film : popular) {
+            if (job.films.size() >= request.k) break;
+            if (excluded.count((uint32_t)film.filmIndex) == 0) job.films.push_back(film);
+        }
+    }
+
+    void run(ServerJob& job, const ModelView& localView) {
+        if (chrono::steady_clock::now() > job.deadline) {
+            expired++;
+            degraded++;
+            fallback(job);
+            return;
+        }
+
+        auto start = chrono::steady_clock::now();
+        job.status = handleRequest(localView, job.request, job.films);
+        double us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        // Racy read-modify-write is fine for a moving average
+        serviceUs = serviceUs.load() * 0.99 + us * 0.01;
+
+        uint16_t type = job.request.type;
+        if (job.status == STATUS_OK && (type == REQUEST_RECOMMEND_USER || type == REQUEST_SIMILAR_FILMS)) {
+            cache.store(ResultCache::keyFor(type, job.request.payload[0]), job.films);
+        }
+    }
+
+    void workerLoop(size_t node) {
+        if (numa.size() > 1) pinThreadToNode(numa, node);
+        const ModelView& localView = replicas.views[node];
+        while (true) {
+            ServerJob* job;
+            {
+                unique_lock<mutex> lock(queueLock);
+                queueReady.wait(lock, [&] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                job = queue.front();
+                queue.pop_front();
+            }
+            run(*job, localView);
+            job->batch->complete();
+        }
+    }
+
+    // Function to admit, degrade or shed one request; 'inFlight' is how many of the
+    // client's requests are already queued. Returns true if the job was queued.
+    bool submit(ServerJob& job, size_t inFlight) {
+        // Strip the deadline word, so handlers see the plain request
+        job.deadline = chrono::steady_clock::time_point::max();
+        if (job.request.type & REQUEST_FLAG_DEADLINE) {
+            if (job.request.payloadWords == 0) {
+                job.status = STATUS_BAD_REQUEST;
+                return false;
+            }
+            job.deadline = chrono::steady_clock::now() + chrono::microseconds(job.request.payload[0]);
+            job.request.type &= ~REQUEST_FLAG_DEADLINE;
+            job.request.payload++;
+            job.request.payloadWords--;
+        }
+        if (job.request.type == REQUEST_PING) return false;
+
+        unique_lock<mutex> lock(queueLock);
+        size_t depth = queue.size();
+        if (depth >= options.maxQueueDepth) {
+            lock.unlock();
+            shed++;
+            job.status = STATUS_OVERLOADED;
+            return false;
+        }
+
+        double waitUs = predictedWaitUs(depth);
+        bool late = job.deadline != chrono::steady_clock::time_point::max()
+            && chrono::steady_clock::now() + chrono::microseconds((int64_t)(waitUs + serviceUs.load())) > job.deadline;
+        if (late || waitUs > options.maxQueueDelayUs || inFlight >= options.perClientLimit) {
+            lock.unlock();
+            degraded++;
+            fallback(job);
+            return false;
+        }
+
+        queue.push_back(&job);
+        lock.unlock();
+        queueReady.notify_one();
+        admitted++;
+        return true;
+    }
+};
+
+// Function to decode every complete frame in a receive buffer into jobs, advancing
+// 'position' past them. Returns false if the stream is malformed.
+bool decodeBatch(const char* data, size_t filled, size_t& position, vector<ServerJob>& jobs, BatchCompletion& batch) {
+    FrameHeader header;
+    jobs.clear();
+    while (true) {
+        size_t frame = nextFrame(data + position, filled - position, header);
+        if (frame == 0) return true;
+        if (frame == SIZE_MAX) return false;
+        ServerJob job;
+        job.request = { header.requestId, header.code, header.count,
+            (const uint32_t*)(data + position + PROTOCOL_HEADER_SIZE), (frame - PROTOCOL_HEADER_SIZE) / 4 };
+        job.batch = &batch;
+        jobs.push_back(job);
+        position += frame;
+    }
+}
+
+// Function to hand a decoded batch to the service. Jobs are only submitted once the
+// vector has stopped growing, as the queue holds pointers; the extra count keeps the
+// batch open until the caller completes it, after it is ready to be told the batch is done.
+void submitBatch(RecommendationService& service, vector<ServerJob>& jobs, BatchCompletion& batch) {
+    batch.remaining = jobs.size() + 1;
+    size_t queued = 0;
+    for (ServerJob& job : jobs) {
+        if (service.submit(job, queued)) queued++;
+        else batch.complete();
+    }
+}
+
+void appendBatchResponses(vector<char>& output, const vector<ServerJob>& jobs) {
+    for (const ServerJob& job : jobs) {
+        appendResponse(output, job.request.requestId, job.status, job.films);
+    }
+}
+
+// Thread-per-connection clients of a --serve process. Shutdown ends their reads and
+// waits until every thread has exited before the service they use is destroyed.
+struct ClientConnections {
+    mutex lock;
+    condition_variable drained;
+    unordered_set<SOCKET> open;
+    size_t running = 0;
+
+    // Called from the accept thread before the connection's thread starts
+    void add(SOCKET connection) {
+        lock_guard<mutex> guard(lock);
+        open.insert(connection);
+        running++;
+    }
+
+    // Called last on a connection's thread; the notification waits for thread exit
+    void finish(SOCKET connection) {
+        unique_lock<mutex> guard(lock);
+        open.erase(connection);
+        closesocket(connection);
+        running--;
+        notify_all_at_thread_exit(drained, move(guard));
+    }
+
+    void closeAll() {
+        unique_lock<mutex> guard(lock);
+        for (SOCKET connection : open) shutdown(connection, SD_BOTH);
+        drained.wait(guard, [this] { return running == 0; });
+    }
+};
+
+// Function to serve one client connection on its own thread. Every complete frame in
+// a receive is decoded, handed to the service (which may answer at once with a
+// fallback), and once the batch is done all of its responses go back in a single send.
+void serveClientConnection(SOCKET connection, RecommendationService& service, ClientConnections& clients) {
+    vector<char> input(64 * 1024);
+    vector<char> output;
+    vector<ServerJob> jobs;
+    BatchCompletion batch;
+    size_t filled = 0;
+
+    while (true) {
+        if (filled == input.size()) input.resize(input.size() * 2);
+        int received = recv(connection, input.data() + filled, (int)(input.size() - filled), 0);
+        if (received <= 0) break;
+        filled += received;
+
+        size_t position = 0;
+        bool malformed = !decodeBatch(input.data(), filled, position, jobs, batch);
+        submitBatch(service, jobs, batch);
+        batch.complete();
+        batch.wait();
+
+        appendBatchResponses(output, jobs);
+        if (!output.empty() && !sendAll(connection, output.data(), output.size())) break;
+        output.clear();
+        if (malformed) break;
+        memmove(input.data(), input.data() + position, filled - position);
+        filled -= position;
+    }
+    clients.finish(connection);
+}
+
+#ifdef HAVE_COROUTINES
+// Coroutine that starts running at once and frees itself when it returns
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return {}; }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+// One event loop per core. Connection coroutines suspend on socket readiness (polled
+// with WSAPoll) and on batch scoring; a finished batch is posted back to the loop
+// from the scoring thread, which wakes it with a datagram to a loopback UDP socket.
+// Everything a coroutine does between suspensions runs on its loop's thread.
+struct EventLoop {
+    struct Waiter {
+        SOCKET socket;
+        short events;
+        coroutine_handle<> handle;
+    };
+
+    RecommendationService& service;
+    vector<Waiter> waiters;
+    vector<WSAPOLLFD> pollSet;
+    unordered_set<SOCKET> connections;      // open connections, touched only on the loop's thread
+    SOCKET wakeReceiver = INVALID_SOCKET;
+    SOCKET wakeSender = INVALID_SOCKET;
+
+    mutex inboxLock;
+    vector<coroutine_handle<>> inbox;
+    vector<SOCKET> newConnections;
+    bool wakePending = false;
+    bool stopping = false;
+
+    explicit EventLoop(RecommendationService& recommendationService) : service(recommendationService) {}
+
+    ~EventLoop() {
+        if (wakeReceiver != INVALID_SOCKET) closesocket(wakeReceiver);
+        if (wakeSender != INVALID_SOCKET) closesocket(wakeSender);
+    }
+
+    bool open() {
+        if (!initSockets()) return false;
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+
+        wakeReceiver = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        wakeSender = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (wakeReceiver == INVALID_SOCKET || wakeSender == INVALID_SOCKET
+            || ::bind(wakeReceiver, (const sockaddr*)&address, sizeof(address)) != 0
+            || getsockname(wakeReceiver, (sockaddr*)&address, &length) != 0
+            || connect(wakeSender, (const sockaddr*)&address, sizeof(address)) != 0) {
+            return false;
+        }
+        unsigned long nonBlocking = 1;
+        return ioctlsocket(wakeReceiver, FIONBIO, &nonBlocking) == 0;
+    }
+
+    void wake(unique_lock<mutex>& lock) {
+        bool send = !wakePending;
+        wakePending = true;
+        lock.unlock();
+        char byte = 0;
+        if (send) ::send(wakeSender, &byte, 1, 0);
+    }
+
+    // Called from any thread: resume 'handle' on this loop
+    void post(coroutine_handle<> handle) {
+        unique_lock<mutex> lock(inboxLock);
+        inbox.push_back(handle);
+        wake(lock);
+    }
+
+    // Called from the accept thread: serve a new connection on this loop
+    void adopt(SOCKET connection) {
+        unique_lock<mutex> lock(inboxLock);
+        newConnections.push_back(connection);
+        wake(lock);
+    }
+
+    // Called from the accept thread once it has stopped: shut every connection down
+    // and make run() return when their coroutines have finished
+    void stop() {
+        unique_lock<mutex> lock(inboxLock);
+        stopping = true;
+        wake(lock);
+    }
+
+    void run();
+};
+
+struct SocketReady {
+    EventLoop& loop;
+    SOCKET socket;
+    short events;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(coroutine_handle<> handle) { loop.waiters.push_back({ socket, events, handle }); }
+    void await_resume() const noexcept {}
+};
+
+// Awaits the batch after submitBatch; a batch nobody else holds finishes without suspending
+struct BatchFinished {
+    EventLoop& loop;
+    BatchCompletion& batch;
+
+    bool await_ready() {
+        lock_guard<mutex> guard(batch.lock);
+        if (batch.remaining != 1) return false;
+        batch.remaining = 0;
+        return true;
+    }
+
+    void await_suspend(coroutine_handle<> handle) {
+        EventLoop* target = &loop;
+        batch.onFinished = [target, handle] { target->post(handle); };
+        batch.complete();
+    }
+
+    void await_resume() const noexcept {}
+};
+
+// Function to serve one client connection as a coroutine on an event loop
+DetachedTask serveConnectionAsync(EventLoop& loop, SOCKET connection) {
+    loop.connections.insert(connection);
+    vector<char> input(64 * 1024);
+    vector<char> output;
+    vector<ServerJob> jobs;
+    BatchCompletion batch;
+    size_t filled = 0;
+
+    while (true) {
+        if (filled == input.size()) input.resize(input.size() * 2);
+        int received = recv(connection, input.data() + filled, (int)(input.size() - filled), 0);
+        if (received < 0 && WSAGetLastError() == WSAEWOULDBLOCK) {
+            co_await SocketReady{ loop, connection, POLLIN };
+            continue;
+        }
+        if (received <= 0) break;
+        filled += received;
+
+        size_t position = 0;
+        bool malformed = !decodeBatch(input.data(), filled, position, jobs, batch);
+        submitBatch(loop.service, jobs, batch);
+        co_await BatchFinished{ loop, batch };
+
+        appendBatchResponses(output, jobs);
+        size_t sent = 0;
+        while (sent < output.size()) {
+            int written = send(connection, output.data() + sent, (int)(output.size() - sent), 0);
+            if (written < 0 && WSAGetLastError() == WSAEWOULDBLOCK) {
+                co_await SocketReady{ loop, connection, POLLOUT };
+                continue;
+            }
+            if (written <= 0) break;
+            sent += written;
+        }
+        if (sent < output.size() || malformed) break;
+        output.clear();
+        memmove(input.data(), input.data() + position, filled - position);
+        filled -= position;
+    }
+    loop.connections.erase(connection);
+    closesocket(connection);
+}
+
+void EventLoop::run() {
+    vector<coroutine_handle<>> ready;
+    vector<SOCKET> adopted;
+    bool closing = false;
+    while (true) {
+        pollSet.clear();
+        pollSet.push_back({ wakeReceiver, POLLIN, 0 });
+        for (const Waiter& waiter : waiters) {
+            pollSet.push_back({ waiter.socket, waiter.events, 0 });
+        }
+        if (WSAPoll(pollSet.data(), (unsigned long)pollSet.size(), -1) < 0) continue;
+
+        if (pollSet[0].revents != 0) {
+            char bytes[64];
+            while (recv(wakeReceiver, bytes, sizeof(bytes), 0) > 0) {}
+        }
+        {
+            lock_guard<mutex> lock(inboxLock);
+            ready.swap(inbox);
+            adopted.swap(newConnections);
+            wakePending = false;
+            closing = stopping;
+        }
+
+        // Errors and hang-ups count as ready too; the coroutine's next call sees them
+        size_t kept = 0;
+        for (size_t i = 0; i < waiters.size(); i++) {
+            if (pollSet[i + 1].revents != 0) ready.push_back(waiters[i].handle);
+            else waiters[kept++] = waiters[i];
+        }
+        waiters.resize(kept);
+
+        for (SOCKET connection : adopted) serveConnectionAsync(*this, connection);
+        for (coroutine_handle<> handle : ready) handle.resume();
+        ready.clear();
+        adopted.clear();
+
+        // Shut down connections end their reads; coroutines waiting on a batch finish it first
+        if (closing) {
+            for (SOCKET connection : connections) shutdown(connection, SD_BOTH);
+            if (connections.empty()) return;
+        }
+    }
+}
+#endif
+
+// Function to listen on a Unix domain socket (supported on Windows 10 1803 and later)
+SOCKET listenOnUnixSocket(const string& path) {
+    if (!initSockets()) return INVALID_SOCKET;
+    sockaddr_un address = {};
+    if (path.size() >= sizeof(address.sun_path)) return INVALID_SOCKET;
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    SOCKET listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET) return INVALID_SOCKET;
+    remove(path.c_str());
+    if (::bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        closesocket(listener);
+        return INVALID_SOCKET;
+    }
+    return listener;
+}
+
+// Function to connect to "unix:<path>" or "host:port"
+SOCKET connectToServer(const string& address) {
+    if (address.rfind("unix:", 0) != 0) return connectTo(address);
+    if (!initSockets()) return INVALID_SOCKET;
+
+    string path = address.substr(5);
+    sockaddr_un unixAddress = {};
+    if (path.size() >= sizeof(unixAddress.sun_path)) return INVALID_SOCKET;
+    unixAddress.sun_family = AF_UNIX;
+    memcpy(unixAddress.sun_path, path.c_str(), path.size() + 1);
+
+    SOCKET connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection != INVALID_SOCKET && connect(connection, (const sockaddr*)&unixAddress, sizeof(unixAddress)) != 0) {
+        closesocket(connection);
+        connection = INVALID_SOCKET;
+    }
+    return connection;
+}
+
+// Listener of the running --serve command. The console control handler closes it, so
+// Ctrl+C ends the accept loop and the server shuts down in order.
+atomic<SOCKET> serveListener(INVALID_SOCKET);
+
+void closeServeListener() {
+    SOCKET listener = serveListener.exchange(INVALID_SOCKET);
+    if (listener == INVALID_SOCKET) return;
+    shutdown(listener, SD_BOTH);
+    closesocket(listener);
+}
+
+BOOL WINAPI serveConsoleHandler(DWORD event) {
+    if (event != CTRL_C_EVENT && event != CTRL_BREAK_EVENT) return FALSE;
+    closeServeListener();
+    return TRUE;
+}
+
+// Function to run the recommendation server in front of a pool of scoring threads.
+// Connections are served by coroutines on event loops (one per core unless
+// --event-loops says otherwise), or a thread each with --event-loops=0 or before C++20:
+//   --serve <model file> [--port=N | --socket=<path>] [--listen-all] [--workers=N]
+//           [--max-queue-delay-us=N] [--max-queue=N] [--client-limit=N] [--event-loops=N] [--no-numa-replicas]
+//           [--large-pages]
+int runServeCommand(const vector<string>& args) {
+    uint16_t port = 47100;
+    string socketPath;
+    bool loopbackOnly = true;
+    AdmissionOptions admission;
+    unsigned eventLoops = max(1u, thread::hardware_concurrency());
+    vector<string> files;
+    for (const string& arg : args) {
+        if (arg.rfind("--port=", 0) == 0) port = (uint16_t)stoul(arg.substr(7));
+        else if (arg.rfind("--event-loops=", 0) == 0) eventLoops = (unsigned)stoul(arg.substr(14));
+        else if (arg.rfind("--socket=", 0) == 0) socketPath = arg.substr(9);
+        else if (arg == "--listen-all") loopbackOnly = false;
+        else if (arg.rfind("--workers=", 0) == 0) admission.workers = (unsigned)stoul(arg.substr(10));
+        else if (arg.rfind("--max-queue-delay-us=", 0) == 0) admission.maxQueueDelayUs = stod(arg.substr(21));
+        else if (arg.rfind("--max-queue=", 0) == 0) admission.maxQueueDepth = stoul(arg.substr(12));
+        else if (arg.rfind("--client-limit=", 0) == 0) admission.perClientLimit = stoul(arg.substr(15));
+        else if (arg == "--no-numa-replicas") admission.numaReplicas = false;
+        else if (arg == "--large-pages") admission.largePages = true;
+        else files.push_back(arg);
+    }
+    if (files.size() != 1) {
+        cerr << "Usage: --serve <model file> [--port=N | --socket=<path>] [--listen-all] [--workers=N]" << endl;
+        cerr << "       [--max-queue-delay-us=N] [--max-queue=N] [--client-limit=N] [--event-loops=N] [--no-numa-replicas]" << endl;
+        cerr << "       [--large-pages]" << endl;
+        return 1;
+    }
+
+    MappedModel model;
+    ModelView view;
+    if (!openModelFile(files[0], ModelValidation::Full, model) || !loadModelView(model, view)) {
+        return 1;
+    }
+
+    SOCKET listener = socketPath.empty() ? listenOnPort(port, loopbackOnly) : listenOnUnixSocket(socketPath);
+    if (listener == INVALID_SOCKET) {
+        cerr << "Error: Could not listen on " << (socketPath.empty() ? "port " + to_string(port) : socketPath) << endl;
+        return 1;
+    }
+    cout << "Serving " << view.numFilms << " films and " << view.numUsers << " users on "
+        << (socketPath.empty() ? "port " + to_string(port) : socketPath) << endl;
+
+    RecommendationService service(view, admission);
+    ClientConnections clients;
+
+#ifdef HAVE_COROUTINES
+    vector<unique_ptr<EventLoop>> loops;
+    for (unsigned l = 0; l < eventLoops; l++) {
+        loops.emplace_back(new EventLoop(service));
+        if (!loops.back()->open()) {
+            cerr << "Error: Could not set up an event loop" << endl;
+            closesocket(listener);
+            return 1;
+        }
+    }
+    vector<thread> loopThreads;
+    for (auto& loop : loops) {
+        loopThreads.emplace_back([loop = loop.get()] { loop->run(); });
+    }
+#else
+    (void)eventLoops;
+#endif
+
+    // Admission counters, reported every few seconds while they are changing
+    mutex statsLock;
+    condition_variable statsWake;
+    bool statsStop = false;
+    thread stats([&] {
+        uint64_t lastTotal = 0;
+        unique_lock<mutex> lock(statsLock);
+        while (!statsWake.wait_for(lock, chrono::seconds(5), [&] { return statsStop; })) {
+            uint64_t total = service.admitted + service.degraded + service.shed;
+            if (total == lastTotal) continue;
+            lastTotal = total;
+            cout << "Requests: " << service.admitted << " admitted, " << service.degraded << " degraded ("
+                << service.expired << " past their deadline), " << service.shed << " shed; service time "
+                << service.serviceUs.load() << " us" << endl;
+        }
+        });
+
+    // Ctrl+C closes the listener, so accept fails and every thread using the service
+    // is wound down before it goes out of scope
+    serveListener = listener;
+    SetConsoleCtrlHandler(serveConsoleHandler, TRUE);
+    for (size_t next = 0;; next++) {
+        SOCKET connection = accept(listener, nullptr, nullptr);
+        if (connection == INVALID_SOCKET) break;
+        if (socketPath.empty()) {
+            int noDelay = 1;
+            setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+        }
+#ifdef HAVE_COROUTINES
+        if (!loops.empty()) {
+            unsigned long nonBlocking = 1;
+            ioctlsocket(connection, FIONBIO, &nonBlocking);
+            loops[next % loops.size()]->adopt(connection);
+            continue;
+        }
+#endif
+        clients.add(connection);
+        thread(serveClientConnection, connection, ref(service), ref(clients)).detach();
+    }
+    SetConsoleCtrlHandler(serveConsoleHandler, FALSE);
+    closeServeListener();
+    cout << "Shutting down" << endl;
+
+#ifdef HAVE_COROUTINES
+    for (auto& loop : loops) loop->stop();
+    for (thread& loopThread : loopThreads) loopThread.join();
+#endif
+    clients.closeAll();
+    {
+        lock_guard<mutex> lock(statsLock);
+        statsStop = true;
+    }
+    statsWake.notify_all();
+    stats.join();
+    return 0;
+}
+
+// Function to drive a server with pipelined requests and report throughput and latency:
+//   --load-test <unix:path | host:port> [--connections=N] [--pipeline=N] [--seconds=N] [--k=N] [--users=N]
+//               [--deadline-us=N]
+int runLoadTest(const vector<string>& args) {
+    size_t connections = 4;
+    size_t pipeline = 32;
+    double seconds = 5.0;
+    uint16_t k = 10;
+    uint32_t users = 1;
+    uint32_t deadlineUs = 0;
+    vector<string> addresses;
+    for (const string& arg : args) {
+        if (arg.rfind("--connections=", 0) == 0) connections = stoul(arg.substr(14));
+        else if (arg.rfind("--pipeline=", 0) == 0) pipeline = stoul(arg.substr(11));
+        else if (arg.rfind("--seconds=", 0) == 0) seconds = stod(arg.substr(10));
+        else if (arg.rfind("--k=", 0) == 0) k = (uint16_t)stoul(arg.substr(4));
+        else if (arg.rfind("--users=", 0) == 0) users = (uint32_t)stoul(arg.substr(8));
+        else if (arg.rfind("--deadline-us=", 0) == 0) deadlineUs = (uint32_t)stoul(arg.substr(14));
+        else addresses.push_back(arg);
+    }
+    if (addresses.size() != 1 || connections == 0 || pipeline == 0 || users == 0) {
+        cerr << "Usage: --load-test <unix:path | host:port> [--connections=N] [--pipeline=N] [--seconds=N] [--k=N] [--users=N]" << endl;
+        cerr << "                   [--deadline-us=N]" << endl;
+        return 1;
+    }
+
+    typedef chrono::steady_clock Clock;
+    Clock::time_point deadline = Clock::now() + chrono::duration_cast<Clock::duration>(chrono::duration<double>(seconds));
+    vector<vector<float>> latencies(connections);   // microseconds
+    vector<size_t> errors(connections, 0);
+    vector<size_t> degraded(connections, 0);
+    vector<size_t> shed(connections, 0);
+    atomic<bool> failed(false);
+
+    auto worker = [&](size_t c) {
+        RecommendClient client;
+        client.deadlineUs = deadlineUs;
+        if (!client.connect(addresses[0])) {
+            failed = true;
+            return;
+        }
+        // Requests are answered in order, so request id modulo the window finds the send time
+        vector<Clock::time_point> sentAt(pipeline);
+        uint32_t user = (uint32_t)c;
+        for (size_t i = 0; i < pipeline; i++) {
+            sentAt[client.sendRecommendUser(user++ % users, k) % pipeline] = Clock::now();
+        }
+        size_t inFlight = pipeline;
+        client.flush();
+
+        ResponseView response;
+        while (inFlight > 0 && client.readResponse(response)) {
+            Clock::time_point now = Clock::now();
+            latencies[c].push_back(chrono::duration<float, micro>(now - sentAt[response.requestId % pipeline]).count());
+            if (response.status == STATUS_DEGRADED) degraded[c]++;
+            else if (response.status == STATUS_OVERLOADED) shed[c]++;
+            else if (response.status != STATUS_OK) errors[c]++;
+            inFlight--;
+
+            if (now < deadline) {
+                sentAt[client.sendRecommendUser(user++ % users, k) % pipeline] = now;
+                inFlight++;
+            }
+            // Send the refills once every response already received has been handled
+            if (client.consumed == client.filled && !client.flush()) break;
+        }
+        if (inFlight > 0) failed = true;
+        client.close();
+    };
+
+    Clock::time_point start = Clock::now();
+    vector<thread> threads;
+    for (size_t c = 0; c < connections; c++) threads.emplace_back(worker, c);
+    for (auto& t : threads) t.join();
+    double elapsed = chrono::duration<double>(Clock::now() - start).count();
+
+    if (failed) {
+        cerr << "Error: Lost the connection to " << addresses[0] << endl;
+        return 1;
+    }
+
+    vector<float> all;
+    size_t errorCount = 0, degradedCount = 0, shedCount = 0;
+    for (size_t c = 0; c < connections; c++) {
+        all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+        errorCount += errors[c];
+        degradedCount += degraded[c];
+        shedCount += shed[c];
+    }
+    if (all.empty()) return 1;
+    sort(all.begin(), all.end());
+    auto percentile = [&](double p) { return all[min(all.size() - 1, (size_t)(p * all.size()))]; };
+
+    cout << all.size() << " requests in " << elapsed << " s over " << connections << " connections, "
+        << pipeline << " in flight each" << endl;
+    cout << "Throughput: " << (all.size() / elapsed) << " requests/s (" << degradedCount << " degraded, "
+        << shedCount << " shed, " << errorCount << " errors)" << endl;
+    cout << "Latency: p50 " << percentile(0.50) << " us, p99 " << percentile(0.99) << " us, p99.9 "
+        << percentile(0.999) << " us" << endl;
+    return 0;
+}
+
+// Function to compare scoring from one shared copy of the film factors with scoring
+// from per-node replicas, with threads spread over the NUMA nodes. Cross-node traffic
+// is counted from placement: every byte a thread scans from a copy on another node.
+//   --numa-benchmark <model file> [--threads=N] [--queries=N]
+int runNumaBenchmark(const vector<string>& args) {
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    size_t numQueries = 2000;
+    vector<string> files;
+    for (const string& arg : args) {
+        if (arg.rfind("--threads=", 0) == 0) threads = max(1u, (unsigned)stoul(arg.substr(10)));
+        else if (arg.rfind("--queries=", 0) == 0) numQueries = stoul(arg.substr(10));
+        else files.push_back(arg);
+    }
+    if (files.size() != 1) {
+        cerr << "Usage: --numa-benchmark <model file> [--threads=N] [--queries=N]" << endl;
+        return 1;
+    }
+
+    MappedModel model;
+    ModelView view;
+    if (!openModelFile(files[0], ModelValidation::Full, model) || !loadModelView(model, view)) {
+        return 1;
+    }
+    NumaTopology topology = detectNumaTopology();
+    cout << topology.size() << " NUMA node(s), " << threads << " scoring threads, " << view.numFilms
+        << " films x " << view.dims << " dims" << endl;
+
+    // The shared layout puts its single copy on the first node, as the first thread to
+    // touch a mapped model would, and every node's threads read that one copy
+    NumaReplicas shared, replicated;
+    shared.build(view, NumaTopology{ { topology.nodes[0] }, { topology.affinities[0] } }, true);
+    shared.views.resize(topology.size(), shared.views[0]);
+    replicated.build(view, topology, true);
+
+    size_t factorBytes = view.filmFactorsHalf != nullptr ? sizeof(uint16_t) : sizeof(float);
+    const double scanMegabytes = view.numFilms * (view.dims * factorBytes + (view.filmBiases != nullptr ? sizeof(float) : 0)) / 1e6;
+    for (int layout = 0; layout < 2; layout++) {
+        NumaReplicas& replicas = layout == 0 ? shared : replicated;
+        atomic<size_t> next(0);
+        atomic<size_t> remoteQueries(0);
+        auto start = chrono::steady_clock::now();
+        vector<thread> pool;
+        for (unsigned t = 0; t < threads; t++) {
+            pool.emplace_back([&, t] {
+                size_t node = t % topology.size();
+                if (topology.size() > 1) pinThreadToNode(topology, node);
+                const ModelView& local = replicas.views[node];
+                bool remote = layout == 0 && node != 0;
+                vector<float> scratch;
+                for (size_t q = next.fetch_add(1); q < numQueries; q = next.fetch_add(1)) {
+                    const float* query = local.filmVector(q % local.numFilms, scratch);
+                    topKFilmRange(local, query, 0, local.numFilms, 10, nullptr, 0);
+                    if (remote) remoteQueries++;
+                }
+                });
+        }
+        for (auto& t : pool) t.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        cout << (layout == 0 ? "Shared copy:      " : "Per-node replicas: ") << (numQueries / seconds) << " queries/s, "
+            << (remoteQueries * scanMegabytes / numQueries) << " MB/query read across nodes" << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+﻿#pragma once
+
+#include "Recommender.h"
+
+bool initSockets();
+bool sendAll(SOCKET socket, const void* data, size_t length);
+bool recvAll(SOCKET socket, void* data, size_t length);
+SOCKET listenOnPort(uint16_t port, bool loopbackOnly);
+SOCKET connectTo(const string& hostPort);
+
+template <typename T>
+void appendPod(vector<char>& out, const T* values, size_t count) {
+    out.insert(out.end(), (const char*)values, (const char*)(values + count));
+}
+
+// Binary recommendation protocol. Every frame is a little-endian header followed by
+// a payload; frames are multiples of 4 bytes so payload fields stay aligned when
+// decoded in place from the receive buffer.
+//   request:  length (bytes after this field), request id, type (uint16), k (uint16), payload
+//   response: length, request id, status (uint16), count (uint16), then count x (film id, score)
+// Clients may pipeline any number of requests; responses come back in request order.
+// A type with REQUEST_FLAG_DEADLINE set carries a time budget in microseconds as the
+// first payload word; a late request gets a cheaper fallback answer instead.
+enum RequestType : uint16_t {
+    REQUEST_PING = 0,               // no payload
+    REQUEST_RECOMMEND_USER = 1,     // payload: model user id
+    REQUEST_RECOMMEND_VECTOR = 2,   // payload: dims floats, then any number of film ids to exclude
+    REQUEST_SIMILAR_FILMS = 3       // payload: film id
+};
+const uint16_t REQUEST_FLAG_DEADLINE = 0x8000;
+
+enum ResponseStatus : uint16_t {
+    STATUS_OK = 0,
+    STATUS_BAD_REQUEST = 1,
+    STATUS_NOT_FOUND = 2,
+    STATUS_DEGRADED = 3,            // a cached or popularity-based answer, given under overload
+    STATUS_OVERLOADED = 4           // shed without an answer
+};
+
+const size_t PROTOCOL_HEADER_SIZE = 12;
+const size_t PROTOCOL_MAX_FRAME = 1 << 20;
+
+#pragma pack(push, 1)
+struct FrameHeader {
+    uint32_t length;
+    uint32_t requestId;
+    uint16_t code;      // request type or response status
+    uint16_t count;     // k in requests, result count in responses
+};
+#pragma pack(pop)
+static_assert(sizeof(FrameHeader) == PROTOCOL_HEADER_SIZE, "frame header must be 12 bytes");
+
+// A decoded request pointing into the connection's receive buffer (nothing is copied)
+struct RequestView {
+    uint32_t requestId;
+    uint16_t type;
+    uint16_t k;
+    const uint32_t* payload;
+    size_t payloadWords;
+};
+
+size_t nextFrame(const char* data, size_t available, FrameHeader& header);
+void appendResponse(vector<char>& out, uint32_t requestId, uint16_t status, const vector<ScoredFilm>& films);
+uint16_t checkRequest(const ModelView& view, const RequestView& request);
+uint16_t handleRequest(const ModelView& view, const RequestView& request, vector<ScoredFilm>& films);
+SOCKET connectToServer(const string& address);
+
+bool enableLargePages();
+void* allocateOnNode(size_t bytes, USHORT node, bool largePages, bool* usedLargePages = nullptr);
+
+// A decoded response; 'films' points into the client's receive buffer and is valid
+// until the next read
+struct ResponseView {
+    uint32_t requestId;
+    uint16_t status;
+    uint16_t count;
+    const char* films;      // count x (uint32 film id, float score)
+
+    ScoredFilm film(size_t i) const {
+        ScoredFilm result;
+        uint32_t id;
+        memcpy(&id, films + i * 8, sizeof(id));
+        memcpy(&result.score, films + i * 8 + 4, sizeof(result.score));
+        result.filmIndex = (int)id;
+        return result;
+    }
+};
+
+// Client side of the binary protocol. Requests are queued with the send* methods and
+// go out together on flush(), so a caller can keep many in flight on one connection.
+struct RecommendClient {
+    SOCKET connection = INVALID_SOCKET;
+    uint32_t nextRequestId = 1;
+    uint32_t deadlineUs = 0;        // time budget sent with every request (0 = none)
+    vector<char> output;
+    vector<char> input = vector<char>(64 * 1024);
+    size_t filled = 0;
+    size_t consumed = 0;
+
+    bool connect(const string& address) {
+        connection = connectToServer(address);
+        return connection != INVALID_SOCKET;
+    }
+
+    void close() {
+        if (connection != INVALID_SOCKET) closesocket(connection);
+        connection = INVALID_SOCKET;
+    }
+
+    uint32_t queueRequest(uint16_t type, uint16_t k, const uint32_t* payload, size_t payloadWords) {
+        size_t deadlineWords = deadlineUs != 0 ? 1 : 0;
+        FrameHeader header = { (uint32_t)(PROTOCOL_HEADER_SIZE - sizeof(uint32_t) + (deadlineWords + payloadWords) * 4),
+            nextRequestId, (uint16_t)(deadlineWords != 0 ? type | REQUEST_FLAG_DEADLINE : type), k };
+        appendPod(output, &header, 1);
+        appendPod(output, &deadlineUs, deadlineWords);
+        appendPod(output, payload, payloadWords);
+        return nextRequestId++;
+    }
+
+    uint32_t sendRecommendUser(uint32_t user, uint16_t k) {
+        return queueRequest(REQUEST_RECOMMEND_USER, k, &user, 1);
+    }
+
+    uint32_t sendRecommendVector(const float* query, size_t dims, const vector<uint32_t>& excluded, uint16_t k) {
+        vector<uint32_t> payload(dims + excluded.size());
+        memcpy(payload.data(), query, dims * sizeof(float));
+        copy(excluded.begin(), excluded.end(), payload.begin() + dims);
+        return queueRequest(REQUEST_RECOMMEND_VECTOR, k, payload.data(), payload.size());
+    }
+
+    uint32_t sendSimilarFilms(uint32_t film, uint16_t k) {
+        return queueRequest(REQUEST_SIMILAR_FILMS, k, &film, 1);
+    }
+
+    bool flush() {
+        bool sent = output.empty() || sendAll(connection, output.data(), output.size());
+        output.clear();
+        return sent;
+    }
+
+    // Blocks until the next response has arrived
+    bool readResponse(ResponseView& response) {
+        while (true) {
+            FrameHeader header;
+            size_t frame = nextFrame(input.data() + consumed, filled - consumed, header);
+            if (frame == SIZE_MAX) return false;
+            if (frame != 0) {
+                response = { header.requestId, header.code, header.count, input.data() + consumed + PROTOCOL_HEADER_SIZE };
+                if (frame < PROTOCOL_HEADER_SIZE + header.count * 8) return false;
+                consumed += frame;
+                return true;
+            }
+
+            memmove(input.data(), input.data() + consumed, filled - consumed);
+            filled -= consumed;
+            consumed = 0;
+            if (filled == input.size()) input.resize(input.size() * 2);
+            int received = recv(connection, input.data() + filled, (int)(input.size() - filled), 0);
+            if (received <= 0) return false;
+            filled += received;
+        }
+    }
+
+    // Convenience call for one request at a time
+    bool recommendUser(uint32_t user, uint16_t k, vector<ScoredFilm>& films) {
+        sendRecommendUser(user, k);
+        ResponseView response;
+        if (!flush() || !readResponse(response) || response.status != STATUS_OK) return false;
+        films.clear();
+        for (size_t i = 0; i < response.count; i++) films.push_back(response.film(i));
+        return true;
+    }
+};
+
+int runServeCommand(const vector<string>& args);
+int runLoadTest(const vector<string>& args);
+int runNumaBenchmark(const vector<string>& args);
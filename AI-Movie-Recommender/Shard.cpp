@@ -0,0 +1,318 @@
+﻿#include "Shard.h"
+
+bool writeShardMessage(SOCKET socket, const vector<char>& payload) {
+    uint32_t length = (uint32_t)payload.size();
+    return sendAll(socket, &length, sizeof(length)) && sendAll(socket, payload.data(), payload.size());
+}
+
+// Function to read one message; a length over maxLength (longer than any valid
+// message) fails without allocating, so the caller drops the connection
+bool readShardMessage(SOCKET socket, vector<char>& payload, size_t maxLength) {
+    uint32_t length = 0;
+    if (!recvAll(socket, &length, sizeof(length)) || length > maxLength) return false;
+    payload.resize(length);
+    return recvAll(socket, payload.data(), length);
+}
+
+// Function to merge best-first lists into one best-first top k, popping the best
+// list head from a heap of heads (a k-way merge)
+vector<ScoredFilm> mergeTopK(const vector<vector<ScoredFilm>>& lists, size_t k) {
+    typedef pair<size_t, size_t> Head;      // (list, position)
+    auto worseHead = [&](const Head& a, const Head& b) {
+        const ScoredFilm& x = lists[a.first][a.second];
+        const ScoredFilm& y = lists[b.first][b.second];
+        return x.score != y.score ? x.score < y.score : x.filmIndex > y.filmIndex;
+    };
+
+    vector<Head> heads;
+    size_t total = 0;
+    for (size_t l = 0; l < lists.size(); l++) {
+        if (!lists[l].empty()) heads.push_back({ l, 0 });
+        total += lists[l].size();
+    }
+    make_heap(heads.begin(), heads.end(), worseHead);
+
+    vector<ScoredFilm> merged;
+    merged.reserve(min(k, total));
+    while (!heads.empty() && merged.size() < k) {
+        pop_heap(heads.begin(), heads.end(), worseHead);
+        Head head = heads.back();
+        heads.pop_back();
+        merged.push_back(lists[head.first][head.second]);
+        if (++head.second < lists[head.first].size()) {
+            heads.push_back(head);
+            push_heap(heads.begin(), heads.end(), worseHead);
+        }
+    }
+    return merged;
+}
+
+// Films owned by shard 'index' of 'count': a contiguous slice of the film rows
+pair<size_t, size_t> shardFilmRange(size_t numFilms, size_t index, size_t count) {
+    return { numFilms * index / count, numFilms * (index + 1) / count };
+}
+
+// State shared by a shard worker's accept loop and its connection threads
+struct ShardWorkerState {
+    const ModelView& view;
+    size_t begin, end;
+    SOCKET listener;
+    atomic<bool> stop;
+    mutex connectionsLock;
+    unordered_set<SOCKET> connections;      // open coordinator connections
+    vector<thread::id> finished;            // connection threads that are returning, not yet joined
+
+    ShardWorkerState(const ModelView& modelView, size_t first, size_t last, SOCKET listening)
+        : view(modelView), begin(first), end(last), listener(listening), stop(false) {}
+
+    // Function to end the worker: closing the listener makes accept fail at once, and
+    // shutting the other connections down ends their reads so their threads return
+    void requestStop() {
+        if (stop.exchange(true)) return;
+        shutdown(listener, SD_BOTH);
+        closesocket(listener);
+        lock_guard<mutex> guard(connectionsLock);
+        for (SOCKET connection : connections) shutdown(connection, SD_BOTH);
+    }
+};
+
+// Function to answer one coordinator connection's requests until it closes
+void serveShardConnection(SOCKET connection, ShardWorkerState& worker) {
+    int noDelay = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+    {
+        lock_guard<mutex> guard(worker.connectionsLock);
+        worker.connections.insert(connection);
+    }
+    if (worker.stop) shutdown(connection, SD_BOTH);
+
+    const ModelView& view = worker.view;
+    // The largest valid request: a header, a query and every film excluded
+    size_t maxRequest = (4 + view.dims + view.numFilms) * sizeof(uint32_t);
+    vector<char> request, reply;
+    while (readShardMessage(connection, request, maxRequest) && request.size() >= sizeof(uint32_t)) {
+        const uint32_t* header = (const uint32_t*)request.data();
+        if (header[0] == SHARD_SHUTDOWN) {
+            worker.requestStop();
+            break;
+        }
+        if (header[0] != SHARD_TOPK || request.size() < 4 * sizeof(uint32_t)) break;
+
+        uint32_t dims = header[2], numExcluded = header[3];
+        if (dims != view.dims || request.size() != (4 + dims + (size_t)numExcluded) * sizeof(uint32_t)) break;
+        // k comes off the wire; a slice never has more than its own films to return
+        size_t k = min<size_t>(header[1], worker.end - worker.begin);
+        const float* query = (const float*)(header + 4);
+        const uint32_t* excluded = header + 4 + dims;
+
+        vector<ScoredFilm> top = topKFilmRange(view, query, worker.begin, worker.end, k, excluded, numExcluded);
+        reply.clear();
+        uint32_t count = (uint32_t)top.size();
+        appendPod(reply, &count, 1);
+        for (const ScoredFilm& film : top) {
+            uint32_t id = (uint32_t)film.filmIndex;
+            appendPod(reply, &id, 1);
+            appendPod(reply, &film.score, 1);
+        }
+        if (!writeShardMessage(connection, reply)) break;
+    }
+
+    {
+        lock_guard<mutex> guard(worker.connectionsLock);
+        worker.connections.erase(connection);
+        worker.finished.push_back(this_thread::get_id());
+    }
+    closesocket(connection);
+}
+
+// Function to run a shard worker: maps the model, owns one slice of its films and
+// answers top-k requests from any number of coordinators, one thread per connection:
+//   --serve-shard <model file> --shard=I/N [--port=N] [--listen-all]
+int runShardWorker(const vector<string>& args) {
+    size_t shardIndex = 0, shardCount = 1;
+    uint16_t port = 47000;
+    bool loopbackOnly = true;
+    vector<string> files;
+    for (const string& arg : args) {
+        if (arg.rfind("--shard=", 0) == 0) {
+            size_t slash = arg.find('/');
+            shardIndex = stoul(arg.substr(8, slash - 8));
+            shardCount = slash == string::npos ? 1 : stoul(arg.substr(slash + 1));
+        }
+        else if (arg.rfind("--port=", 0) == 0) port = (uint16_t)stoul(arg.substr(7));
+        else if (arg == "--listen-all") loopbackOnly = false;
+        else files.push_back(arg);
+    }
+    if (files.size() != 1 || shardCount == 0 || shardIndex >= shardCount) {
+        cerr << "Usage: --serve-shard <model file> --shard=I/N [--port=N] [--listen-all]" << endl;
+        return 1;
+    }
+
+    MappedModel model;
+    ModelView view;
+    if (!openModelFile(files[0], ModelValidation::Full, model) || !loadModelView(model, view)) {
+        return 1;
+    }
+    pair<size_t, size_t> range = shardFilmRange(view.numFilms, shardIndex, shardCount);
+
+    SOCKET listener = listenOnPort(port, loopbackOnly);
+    if (listener == INVALID_SOCKET) {
+        cerr << "Error: Could not listen on port " << port << endl;
+        return 1;
+    }
+    cout << "Shard " << shardIndex << "/" << shardCount << " serving films " << range.first << "-" << range.second
+        << " on port " << port << endl;
+
+    // A shutdown message closes the listener, which ends this loop; the model stays
+    // mapped until every connection thread has been joined
+    ShardWorkerState worker(view, range.first, range.second, listener);
+    vector<thread> connections;
+    while (!worker.stop) {
+        SOCKET connection = accept(listener, nullptr, nullptr);
+        if (connection == INVALID_SOCKET) break;
+        connections.emplace_back(serveShardConnection, connection, ref(worker));
+
+        // Join the threads of coordinators that have gone, so reconnects don't pile up
+        vector<thread::id> finished;
+        {
+            lock_guard<mutex> guard(worker.connectionsLock);
+            finished.swap(worker.finished);
+        }
+        for (thread::id id : finished) {
+            auto done = find_if(connections.begin(), connections.end(), [&](const thread& t) { return t.get_id() == id; });
+            if (done == connections.end()) continue;
+            done->join();
+            connections.erase(done);
+        }
+    }
+    worker.requestStop();
+    for (auto& connection : connections) connection.join();
+    return 0;
+}
+
+// Function to start this executable again as a shard worker
+bool spawnShardWorker(const string& modelFile, size_t index, size_t count, uint16_t port, PROCESS_INFORMATION& process) {
+    char executable[MAX_PATH];
+    if (GetModuleFileNameA(nullptr, executable, MAX_PATH) == 0) return false;
+
+    string commandLine = string("\"") + executable + "\" --serve-shard \"" + modelFile + "\" --shard="
+        + to_string(index) + "/" + to_string(count) + " --port=" + to_string(port);
+    vector<char> mutableCommandLine(commandLine.begin(), commandLine.end());
+    mutableCommandLine.push_back('\0');
+
+    STARTUPINFOA startup = {};
+    startup.cb = sizeof(startup);
+    process = {};
+    return CreateProcessA(nullptr, mutableCommandLine.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr,
+        &startup, &process) != 0;
+}
+
+// Function to benchmark a sharded deployment against single-process scoring. Starts N
+// local worker processes on loopback unless --workers lists running ones:
+//   --shard-benchmark <model file> [--shards=N] [--port=N] [--workers=host:port,...] [--queries=N] [--k=N]
+int runShardBenchmark(const vector<string>& args) {
+    size_t numShards = 2;
+    uint16_t basePort = 47000;
+    size_t numQueries = 2000;
+    size_t k = 10;
+    vector<string> workers;
+    vector<string> files;
+    for (const string& arg : args) {
+        if (arg.rfind("--shards=", 0) == 0) numShards = stoul(arg.substr(9));
+        else if (arg.rfind("--port=", 0) == 0) basePort = (uint16_t)stoul(arg.substr(7));
+        else if (arg.rfind("--queries=", 0) == 0) numQueries = stoul(arg.substr(10));
+        else if (arg.rfind("--k=", 0) == 0) k = stoul(arg.substr(4));
+        else if (arg.rfind("--workers=", 0) == 0) {
+            stringstream list(arg.substr(10));
+            string address;
+            while (getline(list, address, ',')) workers.push_back(address);
+        }
+        else files.push_back(arg);
+    }
+    if (files.size() != 1 || numShards == 0 || k == 0) {
+        cerr << "Usage: --shard-benchmark <model file> [--shards=N] [--port=N] [--workers=host:port,...] [--queries=N] [--k=N]" << endl;
+        return 1;
+    }
+
+    MappedModel model;
+    ModelView view;
+    if (!openModelFile(files[0], ModelValidation::Full, model) || !loadModelView(model, view)) {
+        return 1;
+    }
+
+    vector<PROCESS_INFORMATION> processes;
+    if (workers.empty()) {
+        for (size_t s = 0; s < numShards; s++) {
+            PROCESS_INFORMATION process;
+            if (!spawnShardWorker(files[0], s, numShards, (uint16_t)(basePort + s), process)) {
+                cerr << "Error: Could not start shard worker " << s << endl;
+                for (PROCESS_INFORMATION& started : processes) TerminateProcess(started.hProcess, 1);
+                return 1;
+            }
+            processes.push_back(process);
+            workers.push_back("127.0.0.1:" + to_string(basePort + s));
+        }
+    }
+
+    ShardedRecommender coordinator;
+    if (!coordinator.connect(workers, view.dims)) {
+        for (PROCESS_INFORMATION& process : processes) TerminateProcess(process.hProcess, 1);
+        return 1;
+    }
+
+    // Queries are the model's own users when it has them, otherwise random vectors
+    vector<float> queries(numQueries * view.dims);
+    mt19937 generator(7);
+    normal_distribution<float> normal(0.0f, 1.0f);
+    vector<float> scratch;
+    for (size_t q = 0; q < numQueries; q++) {
+        const float* user = view.numUsers != 0 ? view.userVector(q % view.numUsers, scratch) : nullptr;
+        for (size_t d = 0; d < view.dims; d++) {
+            queries[q * view.dims + d] = user != nullptr ? user[d] : normal(generator);
+        }
+    }
+    vector<uint32_t> excluded;
+
+    auto start = chrono::steady_clock::now();
+    vector<vector<ScoredFilm>> local(numQueries);
+    for (size_t q = 0; q < numQueries; q++) {
+        local[q] = topKFilmRange(view, &queries[q * view.dims], 0, view.numFilms, k, nullptr, 0);
+    }
+    double localSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    size_t mismatches = 0;
+    bool failed = false;
+    vector<ScoredFilm> result;
+    for (size_t q = 0; q < numQueries && !failed; q++) {
+        failed = !coordinator.topK(&queries[q * view.dims], k, excluded, result);
+        // Compare scores rather than ids, so ties broken differently don't count
+        for (size_t i = 0; i < result.size() && !failed; i++) {
+            if (i >= local[q].size() || result[i].score != local[q][i].score) {
+                mismatches++;
+                break;
+            }
+        }
+    }
+    double shardedSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (!processes.empty()) {
+        coordinator.shutdownWorkers();
+        for (PROCESS_INFORMATION& process : processes) {
+            WaitForSingleObject(process.hProcess, 5000);
+            CloseHandle(process.hProcess);
+            CloseHandle(process.hThread);
+        }
+    }
+    coordinator.close();
+
+    if (failed) {
+        cerr << "Error: Lost the connection to a shard worker" << endl;
+        return 1;
+    }
+    cout << view.numFilms << " films, " << view.dims << " dims, top " << k << ", " << numQueries << " queries" << endl;
+    cout << "Single process: " << (numQueries / localSeconds) << " queries/s" << endl;
+    cout << workers.size() << " shards:       " << (numQueries / shardedSeconds) << " queries/s ("
+        << mismatches << " queries differ from single process)" << endl;
+    return mismatches == 0 ? 0 : 1;
+}
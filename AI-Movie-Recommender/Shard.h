@@ -0,0 +1,92 @@
+﻿#pragma once
+
+#include "Server.h"
+
+// Shard messages are a uint32 byte length followed by the payload. All fields are
+// little-endian, as on every host this program targets.
+//   top-k request:  type, k, dims, excluded count, query[dims] floats, excluded[count] film ids
+//   top-k reply:    count, then (film id, score) pairs, best first
+//   shutdown:       type only
+enum ShardMessageType : uint32_t {
+    SHARD_TOPK = 1,
+    SHARD_SHUTDOWN = 2
+};
+
+bool writeShardMessage(SOCKET socket, const vector<char>& payload);
+bool readShardMessage(SOCKET socket, vector<char>& payload, size_t maxLength);
+vector<ScoredFilm> mergeTopK(const vector<vector<ScoredFilm>>& lists, size_t k);
+pair<size_t, size_t> shardFilmRange(size_t numFilms, size_t index, size_t count);
+
+// Coordinator side of a sharded deployment: one connection per shard worker.
+// A request is scattered to every shard before any reply is read, so the shards
+// score their slices concurrently; the partial top-k lists are then k-way merged.
+struct ShardedRecommender {
+    vector<SOCKET> shards;
+    size_t dims = 0;
+
+    bool connect(const vector<string>& addresses, size_t modelDims, int retryMs = 10000) {
+        dims = modelDims;
+        for (const string& address : addresses) {
+            SOCKET connection = INVALID_SOCKET;
+            // Freshly started workers may still be mapping the model
+            for (int waited = 0; connection == INVALID_SOCKET && waited <= retryMs; waited += 50) {
+                connection = connectTo(address);
+                if (connection == INVALID_SOCKET) this_thread::sleep_for(chrono::milliseconds(50));
+            }
+            if (connection == INVALID_SOCKET) {
+                cerr << "Error: Could not connect to shard " << address << endl;
+                close();
+                return false;
+            }
+            shards.push_back(connection);
+        }
+        return true;
+    }
+
+    bool topK(const float* query, size_t k, const vector<uint32_t>& excluded, vector<ScoredFilm>& result) {
+        vector<char> request;
+        uint32_t header[4] = { SHARD_TOPK, (uint32_t)k, (uint32_t)dims, (uint32_t)excluded.size() };
+        appendPod(request, header, 4);
+        appendPod(request, query, dims);
+        appendPod(request, excluded.data(), excluded.size());
+        for (SOCKET shard : shards) {
+            if (!writeShardMessage(shard, request)) return false;
+        }
+
+        vector<vector<ScoredFilm>> partial(shards.size());
+        vector<char> reply;
+        for (size_t s = 0; s < shards.size(); s++) {
+            if (!readShardMessage(shards[s], reply, (1 + 2 * k) * sizeof(uint32_t)) || reply.size() < sizeof(uint32_t)) {
+                return false;
+            }
+            uint32_t count = *(const uint32_t*)reply.data();
+            if (reply.size() != sizeof(uint32_t) + count * 2 * sizeof(uint32_t)) return false;
+            const char* p = reply.data() + sizeof(uint32_t);
+            for (uint32_t i = 0; i < count; i++, p += 2 * sizeof(uint32_t)) {
+                ScoredFilm film;
+                uint32_t id;
+                memcpy(&id, p, sizeof(id));
+                memcpy(&film.score, p + sizeof(id), sizeof(film.score));
+                film.filmIndex = (int)id;
+                partial[s].push_back(film);
+            }
+        }
+        result = mergeTopK(partial, k);
+        return true;
+    }
+
+    void shutdownWorkers() {
+        uint32_t type = SHARD_SHUTDOWN;
+        vector<char> request;
+        appendPod(request, &type, 1);
+        for (SOCKET shard : shards) writeShardMessage(shard, request);
+    }
+
+    void close() {
+        for (SOCKET shard : shards) closesocket(shard);
+        shards.clear();
+    }
+};
+
+int runShardWorker(const vector<string>& args);
+int runShardBenchmark(const vector<string>& args);
@@ -0,0 +1,888 @@
+﻿// Tests for the recommender, built from the same sources as the program with
+// MOVIEREC_TESTS defined (which leaves out Program.cpp's main). Scratch files are
+// written to the current directory and removed afterwards; the sharding test
+// listens on loopback ports 47390-47392.
+#include "Import.h"
+#include "Index.h"
+#include "Reviews.h"
+#include "Shard.h"
+
+int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            cout << "  FAILED: " << #condition << " (line " << __LINE__ << ")" << endl; \
+            failures++; \
+        } \
+    } while (0)
+
+const char* TEST_MODEL_FILE = "movierec_tests_model.bin";
+const char* TEST_SNAPSHOT_FILE = "movierec_tests_corpus.bin";
+
+// Function to make a deterministic diary for a synthetic user: a few dozen films out
+// of 300, a rating on most rows, and some rewatches, tags and missing dates
+vector<Movie> syntheticDiary(size_t user) {
+    mt19937 rng((unsigned)user + 1);
+    vector<Movie> movies;
+    size_t rows = 20 + rng() % 40;
+    for (size_t i = 0; i < rows; i++) {
+        size_t film = (user * 7 + rng() % 120) % 300;
+        Movie movie;
+        movie.name = film % 10 == 0 ? "Film " + to_string(film) + ", Part 2" : "Film " + to_string(film);
+        movie.year = to_string(1950 + film % 70);
+        movie.rating = rng() % 5 == 0 ? "" : to_string(0.5 * (1 + (film + user) % 10)).substr(0, 3);
+        movie.rewatch = rng() % 8 == 0 ? "Yes" : "";
+        movie.tags = rng() % 4 == 0 ? "cinema, friends" : "";
+        movie.watchedDate = rng() % 6 == 0 ? "" : "2023-" + to_string(10 + rng() % 3) + "-" + to_string(10 + rng() % 18);
+        movie.date = "2024-01-01";
+        movies.push_back(movie);
+    }
+    return movies;
+}
+
+// Function to write a diary in the Letterboxd export format
+void writeDiaryFile(const string& filename, const vector<Movie>& movies) {
+    ofstream out(filename);
+    out << "Date,Name,Year,Letterboxd URI,Rating,Rewatch,Tags,Watched Date\n";
+    for (const Movie& movie : movies) {
+        out << movie.date << ",\"" << movie.name << "\"," << movie.year << ",https://boxd.it/x," << movie.rating << ","
+            << movie.rewatch << ",\"" << movie.tags << "\"," << movie.watchedDate << "\n";
+    }
+}
+
+// Function to build a normalized corpus of synthetic users, ready for training
+RatingCorpus syntheticCorpus(size_t numUsers) {
+    RatingCorpus corpus;
+    for (size_t u = 0; u < numUsers; u++) {
+        addUserDiary(corpus, "user" + to_string(u), syntheticDiary(u));
+    }
+    buildFilmMajorIndex(corpus);
+    ensureUserProfiles(corpus, 2);
+    normalizeRatings(corpus, 2);
+    return corpus;
+}
+
+// Function to compare two corpora's users, films and diary rows
+bool sameRows(const RatingCorpus& a, const RatingCorpus& b) {
+    return a.userNames == b.userNames && a.filmKeys == b.filmKeys && a.filmYears == b.filmYears
+        && a.userOffsets == b.userOffsets && a.userFilms == b.userFilms && a.userHalfStars == b.userHalfStars
+        && a.userRowFlags == b.userRowFlags && a.userRowTagBins == b.userRowTagBins && a.userRowDays == b.userRowDays;
+}
+
+// A folded-in user vector solves its normal equations, doesn't depend on how the rows
+// were split between solves, and watched films never come back as recommendations
+void testFoldIn(const ModelView& view) {
+    cout << "fold-in solve" << endl;
+    const double lambda = 0.1;
+    mt19937 rng(7);
+    vector<pair<size_t, double>> rows;
+    for (size_t i = 0; i < 40; i++) {
+        rows.emplace_back(rng() % view.numFilms, i % 7 == 0 ? 0.0 : 0.5 * (1 + rng() % 10));
+    }
+
+    FoldInState whole;
+    initFoldIn(whole, view, lambda);
+    for (const auto& row : rows) addFoldInRow(whole, view, row.first, row.second);
+    CHECK(solveFoldIn(whole));
+
+    // (gram + lambda I) u = rhs - userBias * vectorSum, with gram's upper triangle mirrored
+    size_t d = whole.dims;
+    double worst = 0.0;
+    for (size_t i = 0; i < d; i++) {
+        double sum = lambda * whole.userVector[i];
+        for (size_t j = 0; j < d; j++) {
+            sum += whole.gram[max(i, j) * d + min(i, j)] * whole.userVector[j];
+        }
+        worst = max(worst, fabs(sum - (whole.rhs[i] - whole.userBias * whole.vectorSum[i])));
+    }
+    CHECK(worst < 1e-4);
+    CHECK(whole.normalized == (view.filmBiases != nullptr));
+
+    FoldInState split;
+    initFoldIn(split, view, lambda);
+    for (size_t i = 0; i < rows.size() / 2; i++) addFoldInRow(split, view, rows[i].first, rows[i].second);
+    CHECK(solveFoldIn(split));
+    for (size_t i = rows.size() / 2; i < rows.size(); i++) addFoldInRow(split, view, rows[i].first, rows[i].second);
+    CHECK(solveFoldIn(split));
+    CHECK(split.userVector == whole.userVector);
+    CHECK(split.userBias == whole.userBias);
+
+    size_t watched = 0;
+    for (size_t f = 0; f < view.numFilms; f++) watched += isFilmInBitmap(whole.watchedBitmap.data(), f) ? 1 : 0;
+    vector<ScoredFilm> top = recommendForFoldIn(view, whole, view.numFilms);
+    CHECK(top.size() == view.numFilms - watched);
+    size_t watchedReturned = 0, outOfOrder = 0;
+    for (size_t i = 0; i < top.size(); i++) {
+        if (isFilmInBitmap(whole.watchedBitmap.data(), top[i].filmIndex)) watchedReturned++;
+        if (i > 0 && top[i].score > top[i - 1].score) outOfOrder++;
+    }
+    CHECK(watchedReturned == 0);
+    CHECK(outOfOrder == 0);
+}
+
+// Training draws from counter-based (Philox) streams, so the factors are identical
+// bit for bit whatever the thread count
+void testTrainingThreads(const RatingCorpus& corpus) {
+    cout << "training thread counts" << endl;
+    TrainingOptions options;
+    options.dims = 16;
+    options.epochs = 3;
+    options.threads = 1;
+    TrainedFactors serial = trainFactorization(corpus, options);
+    CHECK(serial.filmFactors.size() == corpus.numFilms() * options.dims);
+
+    for (unsigned threads : { 3u, 8u }) {
+        options.threads = threads;
+        TrainedFactors parallel = trainFactorization(corpus, options);
+        CHECK(parallel.filmFactors == serial.filmFactors);
+        CHECK(parallel.userFactors == serial.userFactors);
+    }
+
+    options.seed = 2;
+    CHECK(trainFactorization(corpus, options).filmFactors != serial.filmFactors);
+}
+
+// Mini-batch k-means finds well-separated blobs, assigns every point to its nearest
+// centroid, and gives the same clusters whatever the thread count
+void testKMeans() {
+    cout << "k-means clustering" << endl;
+    const size_t numBlobs = 8, dims = 16, numPoints = 2000;
+    mt19937 rng(3);
+    normal_distribution<float> noise(0.0f, 0.1f);
+    vector<float> centers(numBlobs * dims), points(numPoints * dims);
+    for (float& x : centers) x = (float)(rng() % 21) - 10.0f;
+    for (size_t i = 0; i < numPoints; i++) {
+        for (size_t j = 0; j < dims; j++) points[i * dims + j] = centers[i % numBlobs * dims + j] + noise(rng);
+    }
+
+    ClusteringOptions options;
+    options.clusters = numBlobs;
+    options.iterations = 30;
+    options.batchSize = 256;
+    options.threads = 1;
+    FilmClusters clusters = clusterFilms(points.data(), numPoints, dims, options);
+    CHECK(clusters.numClusters == numBlobs);
+    CHECK(clusters.centroids.size() == numBlobs * dims);
+    CHECK(clusters.assignments.size() == numPoints);
+
+    // Each blob lands in one cluster of its own
+    vector<uint32_t> blobCluster(numBlobs);
+    for (size_t b = 0; b < numBlobs; b++) blobCluster[b] = clusters.assignments[b];
+    size_t split = 0, notNearest = 0;
+    for (size_t i = 0; i < numPoints && i < clusters.assignments.size(); i++) {
+        if (clusters.assignments[i] != blobCluster[i % numBlobs]) split++;
+        double best = HUGE_VAL;
+        size_t nearest = 0;
+        for (size_t c = 0; c < clusters.numClusters; c++) {
+            double distance = 0.0;
+            for (size_t j = 0; j < dims; j++) {
+                double diff = (double)points[i * dims + j] - clusters.centroids[c * dims + j];
+                distance += diff * diff;
+            }
+            if (distance < best) {
+                best = distance;
+                nearest = c;
+            }
+        }
+        if (nearest != clusters.assignments[i]) notNearest++;
+    }
+    CHECK(split == 0);
+    CHECK(notNearest == 0);
+    sort(blobCluster.begin(), blobCluster.end());
+    CHECK(unique(blobCluster.begin(), blobCluster.end()) == blobCluster.end());
+
+    options.threads = 4;
+    FilmClusters parallel = clusterFilms(points.data(), numPoints, dims, options);
+    CHECK(parallel.centroids == clusters.centroids);
+    CHECK(parallel.assignments == clusters.assignments);
+
+    // More clusters than points leaves one point per cluster
+    options.clusters = 50;
+    FilmClusters small = clusterFilms(points.data(), 20, dims, options);
+    CHECK(small.numClusters == 20);
+    CHECK(small.assignments.size() == 20);
+}
+
+// Function to measure the fraction of exact top-k films an approximate list found
+double recallAgainst(const vector<ScoredFilm>& exact, const vector<ScoredFilm>& found) {
+    size_t hits = 0;
+    for (const ScoredFilm& film : exact) {
+        for (const ScoredFilm& candidate : found) {
+            if (candidate.filmIndex == film.filmIndex) {
+                hits++;
+                break;
+            }
+        }
+    }
+    return exact.empty() ? 1.0 : (double)hits / exact.size();
+}
+
+// An IVF-PQ index holds every film once, finds nearly all of the exact top 10 when
+// probing a quarter of its lists with reranking, and matches exact search when every
+// film is reranked
+void testIvfPq() {
+    cout << "IVF-PQ recall" << endl;
+    const size_t numFilms = 3000, dims = 32, numLists = 16, numSubspaces = 8, k = 10;
+    mt19937 rng(5);
+    normal_distribution<float> normal(0.0f, 1.0f);
+    vector<float> centers(64 * dims), vectors(numFilms * dims);
+    for (float& x : centers) x = normal(rng);
+    for (size_t f = 0; f < numFilms; f++) {
+        size_t center = rng() % 64;
+        for (size_t j = 0; j < dims; j++) vectors[f * dims + j] = centers[center * dims + j] + 0.3f * normal(rng);
+    }
+
+    ClusteringOptions options;
+    options.iterations = 30;
+    options.batchSize = 512;
+    IvfPqIndex built = buildIvfPq(vectors.data(), numFilms, dims, numLists, numSubspaces, options);
+    CHECK(built.numLists == numLists);
+    CHECK(built.listOffsets.size() == numLists + 1);
+    vector<size_t> seen(numFilms, 0);
+    for (uint32_t id : built.ids) {
+        if (id != PQ_PADDING_ID && id < numFilms) seen[id]++;
+    }
+    CHECK(count(seen.begin(), seen.end(), (size_t)1) == (ptrdiff_t)numFilms);
+
+    IvfPqView index = ivfPqViewOf(built);
+    auto dot = activeKernels().scoring.dotF32;
+    vector<uint64_t> excluded((numFilms + 63) / 64, 0);
+    double probedRecall = 0.0, rerankedRecall = 0.0, exhaustiveRecall = 0.0;
+    size_t excludedReturned = 0;
+    const size_t numQueries = 50;
+    for (size_t q = 0; q < numQueries; q++) {
+        const float* query = &vectors[(q * 61 % numFilms) * dims];
+        vector<ScoredFilm> exact = selectTopK(numFilms, k, nullptr, [&](size_t f) {
+            return dot(query, &vectors[f * dims], dims);
+            });
+        probedRecall += recallAgainst(exact, searchIvfPq(index, query, k, numLists / 4));
+        rerankedRecall += recallAgainst(exact, searchIvfPq(index, query, k, numLists / 4, vectors.data(), 100));
+        exhaustiveRecall += recallAgainst(exact, searchIvfPq(index, query, k, numLists, vectors.data(), numFilms));
+
+        // Excluding the exact best film drops it and nothing else
+        fill(excluded.begin(), excluded.end(), 0);
+        excluded[exact[0].filmIndex >> 6] |= 1ull << (exact[0].filmIndex & 63);
+        for (const ScoredFilm& film : searchIvfPq(index, query, k, numLists, vectors.data(), numFilms, excluded.data())) {
+            if (film.filmIndex == exact[0].filmIndex) excludedReturned++;
+        }
+    }
+    // 4-bit codes alone can't order films within a tight cluster, but they beat the
+    // 1% a random pick from the probed lists would get by far; reranking fixes the order
+    CHECK(probedRecall / numQueries >= 0.25);
+    CHECK(rerankedRecall / numQueries >= 0.8);
+    CHECK(exhaustiveRecall == numQueries);
+    CHECK(excludedReturned == 0);
+}
+
+// Normalization splits every rating exactly into mean, biases and a scaled residual,
+// lays the residuals out in both orders, and doesn't depend on the thread count
+void testNormalization(const RatingCorpus& corpus) {
+    cout << "rating normalization" << endl;
+    double sum = 0.0;
+    size_t rated = 0, badSplits = 0, unratedResiduals = 0;
+    for (size_t u = 0; u < corpus.numUsers(); u++) {
+        for (uint64_t i = corpus.userOffsets[u]; i < corpus.userOffsets[u + 1]; i++) {
+            if (corpus.userHalfStars[i] == 0) {
+                if (corpus.userResiduals[i] != 0.0f) unratedResiduals++;
+                continue;
+            }
+            double rating = corpus.userHalfStars[i] * 0.5;
+            double rebuilt = corpus.globalMean + corpus.userBias[u] + corpus.filmBias[corpus.userFilms[i]]
+                + corpus.userScale[u] * corpus.userResiduals[i];
+            if (fabs(rebuilt - rating) > 1e-4) badSplits++;
+            sum += rating;
+            rated++;
+        }
+    }
+    CHECK(rated > 0);
+    CHECK(fabs(corpus.globalMean - sum / rated) < 1e-5);
+    CHECK(badSplits == 0);
+    CHECK(unratedResiduals == 0);
+
+    // The same split holds for the film-major copy
+    size_t badFilmSplits = 0;
+    for (size_t f = 0; f < corpus.numFilms(); f++) {
+        for (uint64_t i = corpus.filmOffsets[f]; i < corpus.filmOffsets[f + 1]; i++) {
+            uint32_t user = corpus.filmUsers[i];
+            double rebuilt = corpus.globalMean + corpus.userBias[user] + corpus.filmBias[f]
+                + corpus.userScale[user] * corpus.filmResiduals[i];
+            bool ok = corpus.filmHalfStars[i] == 0 ? corpus.filmResiduals[i] == 0.0f
+                : fabs(rebuilt - corpus.filmHalfStars[i] * 0.5) <= 1e-4;
+            if (!ok) badFilmSplits++;
+        }
+    }
+    CHECK(badFilmSplits == 0);
+
+    RatingCorpus serial = corpus;
+    normalizeRatings(serial, 1);
+    CHECK(serial.userBias == corpus.userBias);
+    CHECK(serial.filmBias == corpus.filmBias);
+    CHECK(serial.userScale == corpus.userScale);
+    CHECK(serial.filmResiduals == corpus.filmResiduals);
+
+    // A generous and a harsh rater of the same films
+    RatingCorpus pair;
+    vector<Movie> generous = syntheticDiary(1), harsh = generous;
+    for (Movie& movie : generous) movie.rating = "4.5";
+    for (Movie& movie : harsh) movie.rating = "1.0";
+    addUserDiary(pair, "generous", generous);
+    addUserDiary(pair, "harsh", harsh);
+    buildFilmMajorIndex(pair);
+    normalizeRatings(pair, 1);
+    CHECK(pair.userBias[0] > 0.0f);
+    CHECK(pair.userBias[1] < 0.0f);
+}
+
+// Varints round-trip at every length, postings decode to increasing documents, and
+// BM25 search and film keywords match scoring the review text directly
+void testReviewSearch() {
+    cout << "review search" << endl;
+    vector<uint8_t> bytes;
+    const uint32_t values[] = { 0, 1, 127, 128, 16383, 16384, 2097151, 2097152, 268435455, 268435456, 0xFFFFFFFFu };
+    const size_t lengths[] = { 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5 };
+    size_t expectedBytes = 0;
+    for (size_t i = 0; i < size(values); i++) {
+        writeVarint(bytes, values[i]);
+        expectedBytes += lengths[i];
+        CHECK(bytes.size() == expectedBytes);
+    }
+    const uint8_t* p = bytes.data();
+    for (uint32_t value : values) CHECK(readVarint(p) == value);
+    CHECK(p == bytes.data() + bytes.size());
+
+    // Enough reviews for several index shards, over a skewed vocabulary
+    mt19937 rng(11);
+    vector<vector<Review>> users(6);
+    for (size_t r = 0; r < 2 * REVIEW_SHARD_DOCS + 500; r++) {
+        Review review;
+        size_t film = rng() % 200;
+        review.name = "Film " + to_string(film);
+        review.year = to_string(1950 + film % 70);
+        size_t words = 3 + rng() % 30;
+        for (size_t w = 0; w < words; w++) {
+            size_t word = (rng() % 40) * (rng() % 40) / 4;
+            review.text += (w % 5 == 0 ? "the " : "") + string(w % 7 == 0 ? "W" : "w") + to_string(word) + (w % 3 == 0 ? ", " : " ");
+        }
+        users[r % users.size()].push_back(review);
+    }
+    ReviewIndex index, serial;
+    for (size_t u = 0; u < users.size(); u++) {
+        addUserReviews(index, "user" + to_string(u), users[u]);
+        addUserReviews(serial, "user" + to_string(u), users[u]);
+    }
+    buildReviewIndex(index, 4);
+    buildReviewIndex(serial, 1);
+    CHECK(index.postingBytes == serial.postingBytes);
+    CHECK(index.terms == serial.terms);
+
+    // Reference term frequencies straight from the text
+    size_t numDocs = index.numDocs();
+    vector<unordered_map<string, uint32_t>> docFrequencies(numDocs);
+    unordered_map<string, uint32_t> documentFrequency;
+    vector<string> tokens;
+    for (size_t doc = 0; doc < numDocs; doc++) {
+        tokenizeReviewText(index.docTexts[doc], tokens);
+        CHECK(index.docLengths[doc] == tokens.size());
+        for (const string& token : tokens) docFrequencies[doc][token]++;
+        for (const auto& entry : docFrequencies[doc]) documentFrequency[entry.first]++;
+    }
+    CHECK(index.termIds.size() == documentFrequency.size());
+
+    size_t badPostings = 0;
+    for (const auto& entry : index.termIds) {
+        uint32_t term = entry.second;
+        const uint8_t* posting = index.postingBytes.data() + index.postingOffsets[term];
+        const uint8_t* end = index.postingBytes.data() + index.postingOffsets[term + 1];
+        uint32_t doc = 0, postings = 0;
+        while (posting < end) {
+            uint32_t delta = readVarint(posting);
+            if (postings > 0 && delta == 0) badPostings++;
+            doc += delta;
+            uint32_t tf = readVarint(posting);
+            if (doc >= numDocs || docFrequencies[doc][entry.first] != tf) badPostings++;
+            postings++;
+        }
+        if (postings != documentFrequency[entry.first] || index.documentFrequency[term] != postings) badPostings++;
+    }
+    CHECK(badPostings == 0);
+
+    auto bm25 = [&](size_t doc, const vector<string>& queryTerms) {
+        float score = 0.0f;
+        float averageLength = (float)index.averageLength;
+        for (const string& term : queryTerms) {
+            auto tf = docFrequencies[doc].find(term);
+            if (tf == docFrequencies[doc].end()) continue;
+            double df = documentFrequency[term];
+            float idf = (float)log(1.0 + (numDocs - df + 0.5) / (df + 0.5));
+            float norm = BM25_K1 * (1.0f - BM25_B + BM25_B * index.docLengths[doc] / averageLength);
+            score += idf * tf->second * (BM25_K1 + 1.0f) / (tf->second + norm);
+        }
+        return score;
+    };
+    size_t wrongScores = 0, wrongOrder = 0, wrongUser = 0;
+    for (const string& query : { string("w0"), string("w9 W30"), string("the w1 w100 w2"), string("w361 nothing") }) {
+        vector<string> queryTerms;
+        tokenizeReviewText(query, queryTerms);
+        vector<ReviewHit> hits = searchReviews(index, query, 20);
+        CHECK(!hits.empty());
+        float best = 0.0f;
+        for (size_t doc = 0; doc < numDocs; doc++) best = max(best, bm25(doc, queryTerms));
+        if (!hits.empty() && fabs(hits[0].score - best) > 1e-4f * best) wrongScores++;
+        for (size_t i = 0; i < hits.size(); i++) {
+            float expected = bm25(hits[i].doc, queryTerms);
+            if (fabs(hits[i].score - expected) > 1e-4f * expected) wrongScores++;
+            if (i > 0 && hits[i].score > hits[i - 1].score) wrongOrder++;
+        }
+        for (const ReviewHit& hit : searchReviews(index, query, 20, 2)) {
+            if (index.docUsers[hit.doc] != 2) wrongUser++;
+        }
+    }
+    CHECK(wrongScores == 0);
+    CHECK(wrongOrder == 0);
+    CHECK(wrongUser == 0);
+    CHECK(searchReviews(index, "the and of", 10).empty());
+
+    // Keywords are the terms with the highest summed tf-idf over the film's reviews
+    string filmKey = index.docFilms[0];
+    unordered_map<string, float> expected;
+    for (uint32_t doc : index.filmDocs[filmKey]) {
+        for (const auto& entry : docFrequencies[doc]) {
+            expected[entry.first] += entry.second * index.idf(index.termIds.at(entry.first));
+        }
+    }
+    vector<pair<string, float>> keywords = filmReviewKeywords(index, filmKey, 5);
+    CHECK(keywords.size() == min((size_t)5, expected.size()));
+    size_t wrongKeywords = 0;
+    for (const auto& keyword : keywords) {
+        if (fabs(expected[keyword.first] - keyword.second) > 1e-4f * keyword.second) wrongKeywords++;
+        for (const auto& other : expected) {
+            if (other.second > keyword.second * (1.0f + 1e-4f)
+                && find_if(keywords.begin(), keywords.end(), [&](const pair<string, float>& k) { return k.first == other.first; }) == keywords.end()) {
+                wrongKeywords++;
+            }
+        }
+    }
+    CHECK(wrongKeywords == 0);
+    CHECK(filmReviewKeywords(index, "No Such Film (1900)", 5).empty());
+}
+
+// Function to make a diary row for the rewatch test
+Movie watchedOn(const string& name, const string& day, const string& rating) {
+    Movie movie;
+    movie.name = name;
+    movie.year = "2000";
+    movie.rating = rating;
+    movie.watchedDate = day;
+    movie.date = day;
+    return movie;
+}
+
+// Rewatch intervals, comfort films and seasonal films in a hand-made diary: a film
+// watched every December is seasonal and due next December, a film watched three
+// times in one June is not seasonal however tightly its watches bunch, and the films
+// due today come back comfort films first
+void testRewatches() {
+    cout << "rewatch analytics" << endl;
+    vector<Movie> diary = {
+        watchedOn("Christmas Film", "2021-12-22", "5"),
+        watchedOn("Summer Film", "2023-06-05", "4"),
+        watchedOn("Twice", "2023-03-02", "3"),
+        watchedOn("Disliked", "2022-01-10", "1"),
+        watchedOn("Christmas Film", "2020-12-20", "5"),
+        watchedOn("Summer Film", "2023-06-01", "4"),
+        watchedOn("Once", "2023-02-01", "3"),
+        watchedOn("Disliked", "2022-05-10", "1"),
+        watchedOn("Twice", "2023-01-01", "3"),
+        watchedOn("Christmas Film", "2022-12-18", "5"),
+        watchedOn("Summer Film", "2023-06-10", "4"),
+        watchedOn("Disliked", "2022-09-10", "1"),
+        watchedOn("Once", "", "")
+    };
+    RatingCorpus corpus;
+    addUserDiary(corpus, "rewatcher", diary);
+    RewatchAnalytics analytics = analyzeRewatches(corpus, 0);
+    CHECK(analytics.films.size() == 4);
+
+    auto statsFor = [&](const string& name) -> const FilmRewatchStats* {
+        uint32_t film = corpus.filmIndex.at(filmKeyFor(watchedOn(name, "", "")));
+        for (const FilmRewatchStats& stats : analytics.films) {
+            if (stats.film == film) return &stats;
+        }
+        return nullptr;
+    };
+    const FilmRewatchStats* christmas = statsFor("Christmas Film");
+    const FilmRewatchStats* summer = statsFor("Summer Film");
+    const FilmRewatchStats* twice = statsFor("Twice");
+    const FilmRewatchStats* disliked = statsFor("Disliked");
+    CHECK(statsFor("Once") == nullptr);
+    bool found = christmas != nullptr && summer != nullptr && twice != nullptr && disliked != nullptr;
+    CHECK(found);
+    if (!found) return;
+
+    CHECK(christmas->watches == 3);
+    CHECK(christmas->firstDay == parseDayNumber("2020-12-20"));
+    CHECK(christmas->lastDay == parseDayNumber("2022-12-18"));
+    CHECK(christmas->meanInterval == 364.0f);
+    CHECK(christmas->seasonality > SEASONAL_THRESHOLD);
+    CHECK(christmas->seasonal);
+    CHECK(christmas->comfort);
+    CHECK(christmas->meanRating == 5.0f);
+    CHECK(christmas->dueDay >= parseDayNumber("2023-12-10") && christmas->dueDay <= parseDayNumber("2023-12-28"));
+
+    CHECK(summer->seasonality > SEASONAL_THRESHOLD);
+    CHECK(!summer->seasonal);
+    CHECK(summer->comfort);
+    CHECK(summer->meanInterval == 4.5f);
+    CHECK(summer->dueDay == parseDayNumber("2023-06-15"));
+
+    CHECK(twice->watches == 2);
+    CHECK(!twice->comfort);
+    CHECK(!twice->seasonal);
+    CHECK(twice->meanInterval == 60.0f);
+    CHECK(twice->dueDay == parseDayNumber("2023-05-01"));
+
+    CHECK(disliked->watches == 3);
+    CHECK(!disliked->comfort);
+    CHECK(!disliked->seasonal);
+    CHECK(disliked->seasonality < SEASONAL_THRESHOLD);
+
+    size_t unsorted = 0;
+    for (size_t i = 1; i < analytics.byDueDay.size(); i++) {
+        if (analytics.films[analytics.byDueDay[i]].dueDay < analytics.films[analytics.byDueDay[i - 1]].dueDay) unsorted++;
+    }
+    CHECK(analytics.byDueDay.size() == analytics.films.size());
+    CHECK(unsorted == 0);
+
+    vector<const FilmRewatchStats*> due = dueForRewatch(analytics, parseDayNumber("2023-06-20"), 10);
+    CHECK(due.size() == 3);
+    if (due.size() == 3) {
+        CHECK(due[0] == summer);
+        CHECK(due[1] == twice);
+        CHECK(due[2] == disliked);
+    }
+    CHECK(dueForRewatch(analytics, parseDayNumber("2023-06-20"), 1).size() == 1);
+    CHECK(dueForRewatch(analytics, parseDayNumber("2022-01-01"), 10).empty());
+}
+
+// Scores rather than ids are compared, so ties broken differently don't count
+bool sameScores(const vector<ScoredFilm>& a, const vector<ScoredFilm>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].score != b[i].score) return false;
+    }
+    return true;
+}
+
+// Top-k lists scattered to shard workers and merged match scoring every film in
+// one process, including a k far beyond the number of films
+void testSharding(const ModelView& view) {
+    cout << "sharded scoring" << endl;
+    const size_t numShards = 3;
+    const uint16_t basePort = 47390;
+
+    size_t covered = 0;
+    for (size_t s = 0; s < numShards; s++) {
+        pair<size_t, size_t> range = shardFilmRange(view.numFilms, s, numShards);
+        CHECK(range.first == covered);
+        covered = range.second;
+    }
+    CHECK(covered == view.numFilms);
+
+    vector<thread> workers;
+    vector<string> addresses;
+    for (size_t s = 0; s < numShards; s++) {
+        vector<string> args = { TEST_MODEL_FILE, "--shard=" + to_string(s) + "/" + to_string(numShards),
+            "--port=" + to_string(basePort + s) };
+        workers.emplace_back([args] { runShardWorker(args); });
+        addresses.push_back("127.0.0.1:" + to_string(basePort + s));
+    }
+
+    ShardedRecommender coordinator;
+    bool connected = coordinator.connect(addresses, view.dims);
+    CHECK(connected);
+    if (connected) {
+        vector<float> scratch;
+        size_t mismatches = 0;
+        for (size_t u = 0; u < view.numUsers; u++) {
+            const float* query = view.userVector(u, scratch);
+            vector<uint32_t> excluded = { (uint32_t)(u % view.numFilms), (uint32_t)(u * 7 % view.numFilms) };
+            for (size_t k : { (size_t)1, (size_t)10, view.numFilms + 5 }) {
+                vector<ScoredFilm> sharded;
+                if (!coordinator.topK(query, k, excluded, sharded)
+                    || !sameScores(sharded, topKFilmRange(view, query, 0, view.numFilms, k, excluded.data(), excluded.size()))) {
+                    mismatches++;
+                }
+            }
+        }
+        CHECK(mismatches == 0);
+
+        // Workers clamp k to their slice rather than trusting the wire
+        vector<ScoredFilm> everything;
+        CHECK(coordinator.topK(view.userVector(0, scratch), 0xFFFFFFFFu, {}, everything));
+        CHECK(everything.size() == view.numFilms);
+        coordinator.shutdownWorkers();
+        coordinator.close();
+    }
+    else {
+        // Stop whichever workers did start
+        for (const string& address : addresses) {
+            ShardedRecommender single;
+            if (single.connect({ address }, view.dims, 0)) single.shutdownWorkers();
+            single.close();
+        }
+    }
+    for (auto& worker : workers) worker.join();
+}
+
+// Requests encoded by the client decode on the server side, and responses encoded
+// by the server decode on the client side
+void testProtocol(const ModelView& view) {
+    cout << "binary protocol" << endl;
+    vector<float> scratch;
+    const float* query = view.userVector(0, scratch);
+    vector<uint32_t> excluded = { 1, 5 };
+
+    RecommendClient client;
+    uint32_t vectorId = client.sendRecommendVector(query, view.dims, excluded, 10);
+    client.deadlineUs = 2500;
+    uint32_t userId = client.sendRecommendUser(3, 7);
+    CHECK(vectorId != userId);
+
+    const char* data = client.output.data();
+    size_t available = client.output.size();
+    FrameHeader header;
+    size_t frame = nextFrame(data, available, header);
+    CHECK(frame == PROTOCOL_HEADER_SIZE + (view.dims + excluded.size()) * 4);
+    CHECK(header.requestId == vectorId);
+    CHECK(header.code == REQUEST_RECOMMEND_VECTOR);
+    CHECK(header.count == 10);
+    CHECK(nextFrame(data, frame - 1, header) == 0);
+    CHECK(nextFrame(data, 2, header) == 0);
+
+    vector<ScoredFilm> films;
+    RequestView request = { header.requestId, header.code, header.count,
+        (const uint32_t*)(data + PROTOCOL_HEADER_SIZE), (frame - PROTOCOL_HEADER_SIZE) / 4 };
+    CHECK(handleRequest(view, request, films) == STATUS_OK);
+    CHECK(sameScores(films, topKFilmRange(view, query, 0, view.numFilms, 10, excluded.data(), excluded.size())));
+
+    size_t second = nextFrame(data + frame, available - frame, header);
+    CHECK(second == PROTOCOL_HEADER_SIZE + 2 * 4);
+    CHECK(frame + second == available);
+    CHECK(header.requestId == userId);
+    CHECK(header.code == (REQUEST_RECOMMEND_USER | REQUEST_FLAG_DEADLINE));
+    CHECK(header.count == 7);
+    const uint32_t* payload = (const uint32_t*)(data + frame + PROTOCOL_HEADER_SIZE);
+    CHECK(payload[0] == 2500);
+    CHECK(payload[1] == 3);
+
+    vector<char> response;
+    appendResponse(response, vectorId, STATUS_OK, films);
+    appendResponse(response, userId, STATUS_OVERLOADED, {});
+    RecommendClient reader;
+    memcpy(reader.input.data(), response.data(), response.size());
+    reader.filled = response.size();
+    ResponseView decoded = {};
+    CHECK(reader.readResponse(decoded));
+    CHECK(decoded.requestId == vectorId);
+    CHECK(decoded.status == STATUS_OK);
+    CHECK(decoded.count == films.size());
+    for (size_t i = 0; i < decoded.count && i < films.size(); i++) {
+        CHECK(decoded.film(i).filmIndex == films[i].filmIndex);
+        CHECK(decoded.film(i).score == films[i].score);
+    }
+    CHECK(reader.readResponse(decoded));
+    CHECK(decoded.requestId == userId);
+    CHECK(decoded.status == STATUS_OVERLOADED);
+    CHECK(decoded.count == 0);
+
+    // Frames shorter than a header, longer than the limit or not a multiple of 4
+    uint32_t malformed[3] = { 4, 0, 0 };
+    CHECK(nextFrame((const char*)malformed, sizeof(malformed), header) == SIZE_MAX);
+    malformed[0] = 9;
+    CHECK(nextFrame((const char*)malformed, sizeof(malformed), header) == SIZE_MAX);
+    malformed[0] = (uint32_t)PROTOCOL_MAX_FRAME;
+    CHECK(nextFrame((const char*)malformed, sizeof(malformed), header) == SIZE_MAX);
+}
+
+// Malformed requests and unknown ids get the same status from the check a degraded
+// answer runs as from a full answer, so overload never turns them into film lists
+void testRequestChecks(const ModelView& view) {
+    cout << "request checks" << endl;
+    vector<uint32_t> vectorPayload(view.dims + 1, 0);
+    uint32_t validUser = (uint32_t)view.numUsers - 1, missingUser = (uint32_t)view.numUsers;
+    uint32_t validFilm = (uint32_t)view.numFilms - 1, missingFilm = (uint32_t)view.numFilms;
+    struct Case {
+        uint16_t type;
+        const uint32_t* payload;
+        size_t payloadWords;
+        uint16_t status;
+    };
+    const Case cases[] = {
+        { REQUEST_PING, nullptr, 0, STATUS_OK },
+        { REQUEST_RECOMMEND_USER, &validUser, 1, STATUS_OK },
+        { REQUEST_RECOMMEND_USER, &missingUser, 1, STATUS_NOT_FOUND },
+        { REQUEST_RECOMMEND_USER, &validUser, 0, STATUS_BAD_REQUEST },
+        { REQUEST_RECOMMEND_VECTOR, vectorPayload.data(), vectorPayload.size(), STATUS_OK },
+        { REQUEST_RECOMMEND_VECTOR, vectorPayload.data(), view.dims - 1, STATUS_BAD_REQUEST },
+        { REQUEST_SIMILAR_FILMS, &validFilm, 1, STATUS_OK },
+        { REQUEST_SIMILAR_FILMS, &missingFilm, 1, STATUS_NOT_FOUND },
+        { REQUEST_SIMILAR_FILMS, vectorPayload.data(), 2, STATUS_BAD_REQUEST },
+        { 77, nullptr, 0, STATUS_BAD_REQUEST }
+    };
+    vector<ScoredFilm> films;
+    for (const Case& test : cases) {
+        RequestView request = { 1, test.type, 5, test.payload, test.payloadWords };
+        CHECK(checkRequest(view, request) == test.status);
+        CHECK(handleRequest(view, request, films) == test.status);
+        CHECK(films.empty() == (test.status != STATUS_OK || test.type == REQUEST_PING));
+    }
+}
+
+// Every fp16 and bf16 value survives widening and narrowing, and narrowing rounds
+// to nearest even
+void testHalfConversions() {
+    cout << "half-precision conversions" << endl;
+    size_t halfMismatches = 0, bfloatMismatches = 0;
+    for (uint32_t bits = 0; bits <= 0xFFFF; bits++) {
+        float half = halfToFloat((uint16_t)bits);
+        if (isnan(half)) {
+            if (!isnan(halfToFloat(floatToHalf(half)))) halfMismatches++;
+        }
+        else if (floatToHalf(half) != bits) {
+            halfMismatches++;
+        }
+
+        float bfloat = bfloat16ToFloat((uint16_t)bits);
+        if (isnan(bfloat)) {
+            if (!isnan(bfloat16ToFloat(floatToBfloat16(bfloat)))) bfloatMismatches++;
+        }
+        else if (floatToBfloat16(bfloat) != bits) {
+            bfloatMismatches++;
+        }
+    }
+    CHECK(halfMismatches == 0);
+    CHECK(bfloatMismatches == 0);
+
+    CHECK(floatToHalf(1.0f + 1.0f / 2048) == 0x3C00);
+    CHECK(floatToHalf(1.0f + 3.0f / 2048) == 0x3C02);
+    CHECK(floatToHalf(65520.0f) == 0x7C00);
+    CHECK(floatToHalf(-1e-9f) == 0x8000);
+    CHECK(floatToBfloat16(1.0f + 1.0f / 256) == 0x3F80);
+    CHECK(floatToBfloat16(1.0f + 3.0f / 256) == 0x3F82);
+}
+
+// A bulk import gives the same corpus as adding the diaries one by one, whatever the
+// thread count and batch size, and a snapshot reads back unchanged
+void testBulkImport() {
+    cout << "bulk import and corpus snapshots" << endl;
+    vector<string> files;
+    for (size_t u = 0; u < 25; u++) {
+        files.push_back("movierec_tests_user" + to_string(u) + ".csv");
+        writeDiaryFile(files.back(), syntheticDiary(u));
+    }
+
+    RatingCorpus expected;
+    for (const string& file : files) {
+        addUserDiary(expected, exportUserName(file), readLetterboxdCSV(file, false));
+    }
+    CHECK(expected.numUsers() == files.size());
+    CHECK(expected.numFilms() > 0);
+
+    for (unsigned threads : { 1u, 4u }) {
+        for (size_t batchSize : { (size_t)1, (size_t)3, (size_t)64 }) {
+            RatingCorpus imported = importUserExports(files, threads, batchSize);
+            CHECK(sameRows(imported, expected));
+            CHECK(imported.filmIndex == expected.filmIndex);
+        }
+    }
+
+    RatingCorpus imported = importUserExports(files, 4, 3);
+    ensureUserProfiles(imported, 4);
+    CHECK(writeCorpusSnapshot(TEST_SNAPSHOT_FILE, imported));
+    RatingCorpus restored;
+    CHECK(readCorpusSnapshot(TEST_SNAPSHOT_FILE, restored));
+    CHECK(sameRows(restored, imported));
+    CHECK(restored.filmIndex == imported.filmIndex);
+    CHECK(restored.userProfiles == imported.userProfiles);
+
+    DeleteFileA(TEST_SNAPSHOT_FILE);
+    for (const string& file : files) DeleteFileA(file.c_str());
+}
+
+// Ids from concurrent intern() calls are dense and stable, and find() returns them
+// both before and after freeze()
+void testInternTable() {
+    cout << "intern table" << endl;
+    const size_t numKeys = 20000;
+    vector<string> keys(numKeys);
+    for (size_t i = 0; i < numKeys; i++) keys[i] = "film " + to_string(i * 7919 % 100003);
+
+    InternTable table(4);
+    vector<uint32_t> ids(2 * numKeys);
+    parallelFor(ids.size(), 4, [&](size_t i) {
+        size_t k = i % numKeys;
+        ids[i] = table.intern(keys[k], (uint32_t)k);
+        });
+    CHECK(table.size() == numKeys);
+
+    size_t idMismatches = 0, findMismatches = 0;
+    vector<bool> seen(numKeys, false);
+    for (size_t k = 0; k < numKeys; k++) {
+        if (ids[k] != ids[k + numKeys] || ids[k] >= numKeys || seen[ids[k]]) idMismatches++;
+        else seen[ids[k]] = true;
+        if (table.find(keys[k]) != ids[k]) findMismatches++;
+    }
+    CHECK(idMismatches == 0);
+    CHECK(findMismatches == 0);
+    CHECK(table.find("not a film") == InternTable::NOT_FOUND);
+
+    table.freeze();
+    size_t frozenMismatches = 0;
+    for (size_t k = 0; k < numKeys; k++) {
+        uint32_t id = table.find(keys[k]);
+        if (id != ids[k] || table.key(id) != keys[k] || table.value(id) != k) frozenMismatches++;
+    }
+    CHECK(frozenMismatches == 0);
+    CHECK(table.find("not a film") == InternTable::NOT_FOUND);
+    CHECK(table.find("") == InternTable::NOT_FOUND);
+}
+
+int main() {
+    testKMeans();
+    testIvfPq();
+    testReviewSearch();
+    testRewatches();
+    testHalfConversions();
+    testBulkImport();
+    testInternTable();
+
+    RatingCorpus corpus = syntheticCorpus(80);
+    testNormalization(corpus);
+    testTrainingThreads(corpus);
+
+    TrainingOptions options;
+    options.dims = 16;
+    options.epochs = 3;
+    CHECK(writeTrainedModel(TEST_MODEL_FILE, corpus, trainFactorization(corpus, options)));
+    {
+        MappedModel model;
+        ModelView view;
+        bool loaded = openModelFile(TEST_MODEL_FILE, ModelValidation::Full, model) && loadModelView(model, view);
+        CHECK(loaded);
+        if (loaded) {
+            testFoldIn(view);
+            testProtocol(view);
+            testRequestChecks(view);
+            testSharding(view);
+        }
+    }
+    DeleteFileA(TEST_MODEL_FILE);
+
+    if (failures != 0) {
+        cout << failures << " check(s) failed" << endl;
+        return 1;
+    }
+    cout << "All tests passed" << endl;
+    return 0;
+}